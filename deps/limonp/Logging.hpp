@@ -3,18 +3,36 @@
 
 #include <sstream>
 #include <iostream>
+#include <atomic>
+#include <chrono>
+#include <string>
 #include <cassert>
+#include <cstdio>
 #include <cstdlib>
 #include <ctime>
 
 #ifdef XLOG
 #error "XLOG has been defined already"
 #endif // XLOG
+#ifdef XLOG_RATE
+#error "XLOG_RATE has been defined already"
+#endif // XLOG_RATE
 #ifdef XCHECK
 #error "XCHECK has been defined already"
 #endif // XCHECK
 
-#define XLOG(level) limonp::Logger(limonp::LL_##level, __FILE__, __LINE__).Stream()
+// the levels below LOGGING_LEVEL are compiled out, their arguments are not even evaluated
+#define XLOG(level) \
+  !limonp::IsLogLevelOn(limonp::LL_##level) ? (void)0 : \
+  limonp::LogVoidify() & limonp::Logger(limonp::LL_##level, __FILE__, __LINE__).Stream()
+
+// at most `per_second` lines a second from this call site, the next line counts the ones suppressed meanwhile
+#define XLOG_RATE(level, per_second) \
+  for (size_t limonp_log_rate = !limonp::IsLogLevelOn(limonp::LL_##level) ? 0 : \
+         [](size_t n) -> size_t { static limonp::LogRateLimiter limiter; return limiter.Allow(n); }(per_second); \
+       limonp_log_rate != 0; limonp_log_rate = 0) \
+    limonp::Logger(limonp::LL_##level, __FILE__, __LINE__, limonp_log_rate - 1).Stream()
+
 #define XCHECK(exp) if(!(exp)) XLOG(FATAL) << "exp: ["#exp << "] false. "
 
 namespace limonp {
@@ -27,17 +45,96 @@ enum {
   LL_FATAL = 4,
 }; // enum
 
+#ifdef LOGGING_LEVEL
+enum { LL_MIN = LOGGING_LEVEL };
+#else
+enum { LL_MIN = LL_DEBUG };
+#endif
+
 static const char * LOG_LEVEL_ARRAY[] = {"DEBUG","INFO","WARN","ERROR","FATAL"};
 
+// FATAL is never compiled out, XCHECK has to abort
+constexpr bool IsLogLevelOn(size_t level) {
+  return level >= (size_t)LL_MIN || level == (size_t)LL_FATAL;
+}
+
+// where the formatted lines go, may be called by several threads at once
+class LogSink {
+ public:
+  virtual ~LogSink() {
+  }
+  // `line` has no trailing newline
+  virtual void Write(size_t level, const char* line, size_t size) = 0;
+  // called before aborting on FATAL
+  virtual void Flush() {
+  }
+}; // class LogSink
+
+class StderrLogSink: public LogSink {
+ public:
+  virtual void Write(size_t level, const char* line, size_t size) {
+    std::string buf(line, size);
+    buf += '\n';
+    fwrite(buf.data(), 1, buf.size(), stderr);
+  }
+  virtual void Flush() {
+    fflush(stderr);
+  }
+}; // class StderrLogSink
+
+inline std::atomic<LogSink*>& LogSinkSlot() {
+  static std::atomic<LogSink*> sink(NULL);
+  return sink;
+}
+
+inline LogSink* GetLogSink() {
+  static StderrLogSink stderr_sink;
+  LogSink* sink = LogSinkSlot().load(std::memory_order_acquire);
+  return sink != NULL ? sink : &stderr_sink;
+}
+
+// NULL for stderr, returns the previous sink (NULL for stderr). The sink must outlive the lines logged into it.
+inline LogSink* SetLogSink(LogSink* sink) {
+  return LogSinkSlot().exchange(sink, std::memory_order_acq_rel);
+}
+
+// the counters of a call site of XLOG_RATE
+class LogRateLimiter {
+ public:
+  LogRateLimiter(): second_(-1), count_(0), suppressed_(0) {
+  }
+
+  // 0 once `per_second` lines were allowed in the current second, else 1 + the lines suppressed since the last one
+  size_t Allow(size_t per_second) {
+    const int64_t now = std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    int64_t second = second_.load(std::memory_order_relaxed);
+    if (second != now && second_.compare_exchange_strong(second, now, std::memory_order_relaxed)) {
+      count_.store(0, std::memory_order_relaxed);
+    }
+    if (count_.fetch_add(1, std::memory_order_relaxed) < per_second) {
+      return 1 + suppressed_.exchange(0, std::memory_order_relaxed);
+    }
+    suppressed_.fetch_add(1, std::memory_order_relaxed);
+    return 0;
+  }
+
+ private:
+  std::atomic<int64_t> second_;
+  std::atomic<size_t> count_;
+  std::atomic<size_t> suppressed_;
+}; // class LogRateLimiter
+
+// lets the XLOG expression be the void branch of a conditional
+struct LogVoidify {
+  void operator&(std::ostream&) {
+  }
+}; // struct LogVoidify
+
 class Logger {
  public:
-  Logger(size_t level, const char* filename, int lineno)
-   : level_(level) {
-#ifdef LOGGING_LEVEL
-     if (level_ < LOGGING_LEVEL) {
-       return;
-     }
-#endif
+  Logger(size_t level, const char* filename, int lineno, size_t suppressed = 0)
+   : level_(level), suppressed_(suppressed) {
     assert(level_ <= sizeof(LOG_LEVEL_ARRAY)/sizeof(*LOG_LEVEL_ARRAY));
     char buf[32];
     time_t now;
@@ -52,13 +149,14 @@ class Logger {
       << " ";
   }
   ~Logger() {
-#ifdef LOGGING_LEVEL
-     if (level_ < LOGGING_LEVEL) {
-       return;
-     }
-#endif
-    std::cerr << stream_.str() << std::endl;
+    if (suppressed_ > 0) {
+      stream_ << " (" << suppressed_ << " similar lines suppressed)";
+    }
+    const std::string line = stream_.str();
+    LogSink* sink = GetLogSink();
+    sink->Write(level_, line.data(), line.size());
     if (level_ == LL_FATAL) {
+      sink->Flush();
       abort();
     }
   }
@@ -70,6 +168,7 @@ class Logger {
  private:
   std::ostringstream stream_;
   size_t level_;
+  size_t suppressed_;
 }; // class Logger
 
 } // namespace limonp
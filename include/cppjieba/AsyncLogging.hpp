@@ -0,0 +1,222 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "limonp/Logging.hpp"
+
+namespace cppjieba {
+
+/*
+ * Log sink writing on a background thread, so that the threads logging on hot paths (malformed input floods) neither
+ * block on nor contend for the output. Each logging thread copies its lines into its own ring of `ringSize` lines,
+ * whose slots keep their capacity so that the steady state does not allocate; the flusher drains the rings every
+ * `flushMs` and writes them with one fwrite. The lines of a full ring are dropped and counted.
+ *
+ *   cppjieba::AsyncLogSink sink;
+ *   limonp::SetLogSink(&sink);
+ *   ...
+ *   limonp::SetLogSink(nullptr); // once the threads are done logging, the destructor does it too
+ * */
+class AsyncLogSink: public limonp::LogSink {
+public:
+    explicit AsyncLogSink(FILE* out = stderr, size_t ringSize = 1024, size_t flushMs = 10)
+        : out_(out), ringSize_(1), flushMs_(flushMs), id_(NextId()), dropped_(0), stop_(false) {
+        while (ringSize_ < ringSize) {
+            ringSize_ <<= 1;
+        }
+
+        flusher_ = std::thread(&AsyncLogSink::FlushLoop, this);
+    }
+
+    ~AsyncLogSink() {
+        limonp::LogSink* self = this;
+        limonp::LogSinkSlot().compare_exchange_strong(self, nullptr);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+
+        cv_.notify_one();
+        flusher_.join();
+    }
+
+    AsyncLogSink(const AsyncLogSink &) = delete;
+    AsyncLogSink &operator=(const AsyncLogSink &) = delete;
+
+    virtual void Write(size_t level, const char* line, size_t size) override {
+        if (!GetRing()->Push(line, size)) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // writes the lines logged so far, from the calling thread
+    virtual void Flush() override {
+        Drain();
+    }
+
+    size_t GetDroppedNum() const {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+
+private:
+    // single producer, the logging thread, single consumer, Drain under drainMutex_
+    class Ring {
+    public:
+        explicit Ring(size_t size)
+            : slots_(size), mask_(size - 1), head_(0), tail_(0), closed_(false) {
+        }
+
+        bool Push(const char* line, size_t size) {
+            const size_t tail = tail_.load(std::memory_order_relaxed);
+
+            if (tail - head_.load(std::memory_order_acquire) == slots_.size()) {
+                return false;
+            }
+
+            slots_[tail & mask_].assign(line, size);
+            tail_.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        // appends the lines pushed so far to `buf`, one per line
+        void Pop(std::string& buf) {
+            size_t head = head_.load(std::memory_order_relaxed);
+            const size_t tail = tail_.load(std::memory_order_acquire);
+
+            for (; head != tail; head++) {
+                buf += slots_[head & mask_];
+                buf += '\n';
+            }
+
+            head_.store(head, std::memory_order_release);
+        }
+
+        // the producer is gone, the ring is released once drained
+        void Close() {
+            closed_.store(true, std::memory_order_release);
+        }
+
+        bool Closed() const {
+            return closed_.load(std::memory_order_acquire);
+        }
+
+    private:
+        std::vector<std::string> slots_;
+        const size_t mask_;
+        std::atomic<size_t> head_;
+        std::atomic<size_t> tail_;
+        std::atomic<bool> closed_;
+    };
+
+    // the ring of the calling thread for the sink it logged into last
+    struct LocalRing {
+        ~LocalRing() {
+            if (ring) {
+                ring->Close();
+            }
+        }
+
+        uint64_t sinkId = 0;
+        std::shared_ptr<Ring> ring;
+    };
+
+    static uint64_t NextId() {
+        static std::atomic<uint64_t> id(0);
+        return ++id;
+    }
+
+    Ring* GetRing() {
+        static thread_local LocalRing local;
+
+        if (local.sinkId != id_) {
+            if (local.ring) {
+                local.ring->Close();
+            }
+
+            local.ring = std::make_shared<Ring>(ringSize_);
+            local.sinkId = id_;
+            std::lock_guard<std::mutex> lock(ringsMutex_);
+            rings_.push_back(local.ring);
+        }
+
+        return local.ring.get();
+    }
+
+    void Drain() {
+        std::lock_guard<std::mutex> drainLock(drainMutex_);
+        std::vector<std::shared_ptr<Ring> > rings;
+
+        {
+            std::lock_guard<std::mutex> lock(ringsMutex_);
+            rings = rings_;
+        }
+
+        for (const auto & ring : rings) {
+            // checked first, a line pushed before closing is drained below
+            const bool closed = ring->Closed();
+            ring->Pop(buf_);
+
+            if (closed) {
+                std::lock_guard<std::mutex> lock(ringsMutex_);
+                rings_.erase(std::find(rings_.begin(), rings_.end(), ring));
+            }
+        }
+
+        const size_t dropped = dropped_.load(std::memory_order_relaxed);
+
+        if (dropped != reported_) {
+            buf_ += std::to_string(dropped - reported_) + " log lines dropped\n";
+            reported_ = dropped;
+        }
+
+        if (!buf_.empty()) {
+            fwrite(buf_.data(), 1, buf_.size(), out_);
+            fflush(out_);
+            buf_.clear();
+        }
+    }
+
+    void FlushLoop() {
+        bool stop = false;
+
+        while (!stop) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait_for(lock, std::chrono::milliseconds(flushMs_), [this]() {
+                    return stop_;
+                });
+                stop = stop_;
+            }
+
+            Drain();
+        }
+    }
+
+    FILE* out_;
+    size_t ringSize_;
+    const size_t flushMs_;
+    const uint64_t id_;
+    std::atomic<size_t> dropped_;
+    size_t reported_ = 0; // dropped lines written so far, under drainMutex_
+
+    std::mutex ringsMutex_;
+    std::vector<std::shared_ptr<Ring> > rings_;
+    std::mutex drainMutex_;
+    std::string buf_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stop_;
+    std::thread flusher_;
+}; // class AsyncLogSink
+
+} // namespace cppjieba
@@ -0,0 +1,307 @@
+#pragma once
+
+#include <climits>
+#include <cstdlib>
+#include <dirent.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "limonp/FileLock.hpp"
+#include "limonp/Logging.hpp"
+#include "Error.hpp"
+
+namespace cppjieba {
+
+/*
+ * Lock of a cache file, so that of the threads and processes starting together without the cache one builds it while
+ * the others wait, then attach to what it built:
+ *
+ *   if (attach fails) {
+ *       CacheLock lock(cache_path);
+ *       if (lock.Lock() && attach succeeds) { built by another thread or process while waiting }
+ *       else { build }
+ *   }
+ *
+ * Between processes, it is an advisory fcntl lock on `<cache>.lock` next to the cache, released by the kernel when its
+ * holder dies, so a crashed builder does not block the next ones. A fcntl lock belongs to the process, though: it does
+ * not exclude the threads of the holder, and closing any fd of the lock file releases it. So a mutex per cache path
+ * comes first, held by one thread of the process at most, which then takes the fcntl lock for the process. The lock
+ * file is left in place, removing it would let a waiter lock a file no longer the one of the next builder.
+ * */
+class CacheLock {
+public:
+    enum : size_t {
+        DEFAULT_TIMEOUT_MS = 120000,
+        POLL_INTERVAL_MS = 20,
+    };
+
+    explicit CacheLock(const std::string& cache_path)
+        : cache_path_(cache_path) {
+    }
+
+    ~CacheLock() {
+        UnLock();
+    }
+
+    CacheLock(const CacheLock &) = delete;
+    CacheLock &operator=(const CacheLock &) = delete;
+
+    // waits `timeout_ms` at most for the lock, false on timeout or if the lock file cannot be created
+    bool Lock(size_t timeout_ms = DEFAULT_TIMEOUT_MS) {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        thread_mutex_ = GetThreadMutex(cache_path_);
+        std::unique_lock<std::timed_mutex> thread_lock(*thread_mutex_, std::defer_lock);
+
+        if (!thread_lock.try_lock()) {
+            XLOG(INFO) << "waiting for another thread building " << cache_path_;
+
+            if (!thread_lock.try_lock_until(deadline)) {
+                XLOG(WARNING) << "timeout waiting for the builder of " << cache_path_;
+                return false;
+            }
+        }
+
+        bool waited = false;
+
+        for (;;) {
+            // FileLock keeps its first error, so each attempt takes a new one. No other thread of the process holds
+            // the fcntl lock meanwhile, closing the fd of a failed attempt releases nothing
+            lock_.reset(new limonp::FileLock());
+            lock_->Open(cache_path_ + ".lock");
+
+            if (!lock_->Ok()) {
+                XLOG(WARNING) << "open " << cache_path_ << ".lock failed: " << lock_->Error();
+                lock_.reset();
+                return false;
+            }
+
+            lock_->Lock();
+
+            if (lock_->Ok()) {
+                thread_lock_ = std::move(thread_lock);
+                locked_ = true;
+                return true;
+            }
+
+            lock_.reset();
+
+            if (std::chrono::steady_clock::now() >= deadline) {
+                XLOG(WARNING) << "timeout waiting for the builder of " << cache_path_;
+                return false;
+            }
+
+            if (!waited) {
+                XLOG(INFO) << "waiting for another process building " << cache_path_;
+                waited = true;
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(POLL_INTERVAL_MS));
+        }
+    }
+
+    // the fcntl lock first, the mutex then, no other thread of the process may touch the lock file before
+    void UnLock() {
+        if (locked_) {
+            lock_->UnLock();
+            locked_ = false;
+        }
+
+        lock_.reset();
+
+        if (thread_lock_.owns_lock()) {
+            thread_lock_.unlock();
+        }
+    }
+
+    bool IsLocked() const {
+        return locked_;
+    }
+
+    /*
+     * Removes the temporary files of WriteCacheFile left by builders that died before renaming them. Only the holder of
+     * the lock may, and only the files of the processes of this host and pid namespace which are gone: a builder that
+     * timed out waiting may be writing one still, and the pids of other hosts or containers cannot be checked.
+     * */
+    size_t RemoveStaleTempFiles() const {
+        if (!locked_) {
+            return 0;
+        }
+
+        const size_t slash = cache_path_.rfind('/');
+        const std::string dir = slash == std::string::npos ? "." : cache_path_.substr(0, slash + 1);
+        const std::string prefix = (slash == std::string::npos ? cache_path_ : cache_path_.substr(slash + 1)) + "_"
+                                   + GetOwnerTag() + ".";
+        DIR* d = ::opendir(dir.c_str());
+
+        if (d == nullptr) {
+            return 0;
+        }
+
+        size_t removed = 0;
+
+        for (struct dirent* entry = ::readdir(d); entry != nullptr; entry = ::readdir(d)) {
+            const std::string name = entry->d_name;
+            pid_t pid = 0;
+
+            if (!ParseTempFileName(name, prefix, pid) || pid == ::getpid() || 0 == ::kill(pid, 0) || errno != ESRCH) {
+                continue;
+            }
+
+            const std::string path = dir + (slash == std::string::npos ? "/" : "") + name;
+
+            if (0 == ::unlink(path.c_str())) {
+                XLOG(INFO) << "removed stale " << path;
+                removed++;
+            }
+        }
+
+        ::closedir(d);
+        return removed;
+    }
+
+    // the mkstemp template of the temporary files of `cache_path`: `<cache>_<host>-<pid namespace>.<pid>_XXXXXX`
+    static std::string GetTempFileTemplate(const std::string& cache_path) {
+        return cache_path + "_" + GetOwnerTag() + "." + std::to_string(::getpid()) + "_XXXXXX";
+    }
+
+private:
+    // the processes of which the pids can be checked with kill
+    static std::string GetOwnerTag() {
+        char host[256] = {};
+        struct stat st;
+
+        if (0 != ::gethostname(host, sizeof(host) - 1)) {
+            host[0] = '\0';
+        }
+
+        std::string tag = host;
+
+        for (auto & c : tag) {
+            if (c == '/' || c == '_' || c == '.') {
+                c = '-';
+            }
+        }
+
+        return tag + "-" + std::to_string(0 == ::stat("/proc/self/ns/pid", &st) ? (unsigned long long)st.st_ino : 0ULL);
+    }
+
+    // `<prefix><pid>_XXXXXX`
+    static bool ParseTempFileName(const std::string& name, const std::string& prefix, pid_t& pid) {
+        // the suffix of mkstemp is 6 characters
+        if (name.size() < prefix.size() + 8 || 0 != name.compare(0, prefix.size(), prefix)
+                || name[name.size() - 7] != '_') {
+            return false;
+        }
+
+        const std::string digits = name.substr(prefix.size(), name.size() - 7 - prefix.size());
+
+        if (digits.empty() || digits.size() > 9 || digits.find_first_not_of("0123456789") != std::string::npos) {
+            return false;
+        }
+
+        pid = (pid_t)std::atol(digits.c_str());
+        return pid > 0;
+    }
+
+    /*
+     * One per cache file, whatever the spelling of its path, while a CacheLock of it is alive. And one per process: the
+     * child of a fork gets a copy of the mutexes, locked by threads it does not have.
+     * */
+    static std::shared_ptr<std::timed_mutex> GetThreadMutex(const std::string& cache_path) {
+        static std::mutex mutex;
+        static std::map<std::string, std::weak_ptr<std::timed_mutex> > mutexes;
+        const size_t slash = cache_path.rfind('/');
+        const std::string dir = slash == std::string::npos ? "." : cache_path.substr(0, slash + 1);
+        char real_dir[PATH_MAX];
+        const std::string key = std::to_string(::getpid()) + ":"
+                                + (::realpath(dir.c_str(), real_dir) != nullptr ? std::string(real_dir) : dir) + "/"
+                                + (slash == std::string::npos ? cache_path : cache_path.substr(slash + 1));
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        for (auto it = mutexes.begin(); it != mutexes.end();) {
+            it = it->second.expired() ? mutexes.erase(it) : std::next(it);
+        }
+
+        std::shared_ptr<std::timed_mutex> thread_mutex = mutexes[key].lock();
+
+        if (!thread_mutex) {
+            thread_mutex = std::make_shared<std::timed_mutex>();
+            mutexes[key] = thread_mutex;
+        }
+
+        return thread_mutex;
+    }
+
+    std::string cache_path_;
+    std::shared_ptr<std::timed_mutex> thread_mutex_;
+    std::unique_lock<std::timed_mutex> thread_lock_;
+    std::unique_ptr<limonp::FileLock> lock_;
+    bool locked_ = false;
+}; // class CacheLock
+
+/*
+ * Writes `parts` to `cache_path` through a temporary file renamed over it, so that a reader maps either the former
+ * cache or the whole new one. A failed write does not leave its temporary file behind, the ones of a crashed writer
+ * are removed by CacheLock::RemoveStaleTempFiles.
+ * */
+inline Error WriteCacheFile(const std::string& cache_path, const std::vector<std::pair<const void*, size_t> >& parts) {
+    std::string tmp_filepath = CacheLock::GetTempFileTemplate(cache_path);
+    ::umask(S_IWGRP | S_IWOTH);
+    const int fd = ::mkstemp(&tmp_filepath[0]);
+    if (fd < 0) {
+        XLOG(ERROR) << "make temporary file failed";
+        return Error::OpenFileFailed;
+    }
+    auto discard = [&tmp_filepath](int fd) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        ::unlink(tmp_filepath.c_str());
+    };
+
+    auto st = ::fchmod(fd, 0644);
+    if (st != 0) {
+        XLOG(ERROR) << "change temporary file mode to 0644 failed. Please check permission";
+        discard(fd);
+        return Error::FileOperationError;
+    }
+
+    size_t expected_bytes = 0;
+    ssize_t write_bytes = 0;
+
+    for (const auto & part : parts) {
+        expected_bytes += part.second;
+        write_bytes += ::write(fd, (const char *)part.first, part.second);
+    }
+
+    if (write_bytes != (ssize_t)expected_bytes) {
+        XLOG(ERROR) << "check written data size failed. ";
+        discard(fd);
+        return Error::FileOperationError;
+    }
+    st = ::close(fd);
+    if (st != 0) {
+        XLOG(ERROR) << "Closing " << tmp_filepath << " failed";
+        discard(-1);
+        return Error::FileOperationError;
+    }
+
+    if (0 != ::rename(tmp_filepath.c_str(), cache_path.c_str())) {
+        XLOG(ERROR) << "rename " << tmp_filepath << " to " << cache_path << " failed. ";
+        discard(-1);
+        return Error::FileOperationError;
+    }
+
+    return Error::Ok;
+}
+
+} // namespace cppjieba
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <cerrno>
 #include <cstdint>
+#include <cstring>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/mman.h>
@@ -13,6 +15,7 @@
 #include "limonp/Md5.hpp"
 #include "Unicode.hpp"
 #include "darts-clone/include/darts.h"
+#include "CacheLock.hpp"
 #include "Error.hpp"
 
 namespace cppjieba {
@@ -57,34 +60,63 @@ inline std::ostream & operator << (std::ostream& os, const DatMemElem & elem) {
 
 struct DatDag {
     limonp::LocalVector<pair<size_t, const DatMemElem *> > nexts;
-    double max_weight;
     int max_next;
+    // element of the edge to max_next
+    const DatMemElem * max_elem = nullptr;
 };
 
 typedef Darts::DoubleArray JiebaDAT;
 
 
+/*
+ * Cache file layout:
+ *   CacheFileHeader
+ *   DatMemElem  elements[elements_num]
+ *   double      column[column_num]      optional values keyed by the element ids of another trie
+ *   DAT units   [dat_size]
+ *   Rune        runes[rune_num]         optional, e.g. the single-rune words of the user dicts of a DictTrie
+ * */
 struct CacheFileHeader {
     char md5_hex[32] = {};
     double min_weight = 0;
     uint32_t elements_num = 0;
     uint32_t dat_size = 0;
+    double mean_weight = 0;
+    uint32_t column_num = 0;
+    uint32_t rune_num = 0;
+    uint64_t fingerprint = 0; // of the source files, see CalcFileListFingerprint
+    uint64_t reserved = 0;
+    double freq_sum = 0;       // of the raw weights, for the layers built over this one, see DictTrie
+    double default_weight = 0; // of the words of those layers without one
 };
 
 static_assert(sizeof(DatMemElem) == 16, "DatMemElem length invalid");
 static_assert((sizeof(CacheFileHeader) % sizeof(DatMemElem)) == 0, "DatMemElem CacheFileHeader length equal");
 
 
+enum DatHugePages {
+    HugePagesNone,
+    HugePagesTransparent, // a 2MB aligned copy with madvise(MADV_HUGEPAGE), see transparent_hugepage/enabled
+    HugePagesExplicit,    // a MAP_HUGETLB copy from the vm.nr_hugepages pool, else a transparent one
+};
+
+// how the DAT cache is mapped, see DatTrie::Remap
+struct DatMapOptions {
+    bool populate = false;                   // fault the pages in up front
+    DatHugePages huge_pages = HugePagesNone; // copies are populated, whatever `populate`
+    bool lock = false;                       // mlock, needs RLIMIT_MEMLOCK
+};
+
 class DatTrie {
 public:
     DatTrie() {}
     ~DatTrie() {
-        ::munmap(mmap_addr_, mmap_length_);
+        if (mmap_addr_ != nullptr) {
+            ::munmap(mmap_addr_, mmap_length_);
+        }
+
         mmap_addr_ = nullptr;
         mmap_length_ = 0;
-
-        ::close(mmap_fd_);
-        mmap_fd_ = -1;
     }
 
     DatTrie(const DatTrie &) = delete;
@@ -109,36 +141,40 @@ public:
         const string text_str = EncodeRunesToString(begin, end);
 
         for (size_t i = 0, begin_pos = 0; i < size_t(end - begin); i++) {
-            static const size_t max_num = 128;
-            JiebaDAT::result_pair_type result_pairs[max_num] = {};
-            std::size_t num_results = dat_.commonPrefixSearch(&text_str[begin_pos], &result_pairs[0], max_num);
+            Find(&text_str[begin_pos], text_str.size() - begin_pos, i, res[i], max_word_len);
+            begin_pos += limonp::UnicodeToUtf8Bytes((begin + i)->rune);
+        }
+    }
 
-            res[i].nexts.push_back(pair<size_t, const DatMemElem *>(i + 1, nullptr));
+    // DAG node of the words starting at `text`, which is the rune at position `pos`
+    void Find(const char * text, size_t length, size_t pos, DatDag & dag, size_t max_word_len) const {
+        static const size_t max_num = 128;
+        JiebaDAT::result_pair_type result_pairs[max_num] = {};
+        std::size_t num_results = dat_.commonPrefixSearch(text, &result_pairs[0], max_num, length);
 
-            for (std::size_t idx = 0; idx < num_results; ++idx) {
-                auto & match = result_pairs[idx];
+        dag.nexts.push_back(pair<size_t, const DatMemElem *>(pos + 1, nullptr));
 
-                if ((match.value < 0) || (match.value >= elements_num_)) {
-                    continue;
-                }
+        for (std::size_t idx = 0; idx < num_results; ++idx) {
+            auto & match = result_pairs[idx];
 
-                auto const char_num = Utf8CharNum(&text_str[begin_pos], match.length);
+            if ((match.value < 0) || (match.value >= elements_num_)) {
+                continue;
+            }
 
-                if (char_num > max_word_len) {
-                    continue;
-                }
+            auto const char_num = Utf8CharNum(text, match.length);
 
-                auto pValue = &elements_ptr_[match.value];
+            if (char_num > max_word_len) {
+                continue;
+            }
 
-                if (1 == char_num) {
-                    res[i].nexts[0].second = pValue;
-                    continue;
-                }
+            auto pValue = &elements_ptr_[match.value];
 
-                res[i].nexts.push_back(pair<size_t, const DatMemElem *>(i + char_num, pValue));
+            if (1 == char_num) {
+                dag.nexts[0].second = pValue;
+                continue;
             }
 
-            begin_pos += limonp::UnicodeToUtf8Bytes((begin + i)->rune);
+            dag.nexts.push_back(pair<size_t, const DatMemElem *>(pos + char_num, pValue));
         }
     }
 
@@ -150,54 +186,277 @@ public:
         min_weight_ = d ;
     }
 
-    Error InitBuildDat(vector<DatElement>& elements, const string & dat_cache_file, const string & md5) {
-        auto status = BuildDatCache(elements, dat_cache_file, md5);
+    double GetMeanWeight() const {
+        return mean_weight_;
+    }
+
+    void SetMeanWeight(double d) {
+        mean_weight_ = d;
+    }
+
+    double GetFreqSum() const {
+        return freq_sum_;
+    }
+
+    void SetFreqSum(double d) {
+        freq_sum_ = d;
+    }
+
+    double GetDefaultWeight() const {
+        return default_weight_;
+    }
+
+    void SetDefaultWeight(double d) {
+        default_weight_ = d;
+    }
+
+    size_t GetElementsNum() const {
+        return elements_num_;
+    }
+
+    bool IsElement(const DatMemElem * elem) const {
+        return elem >= elements_ptr_ && elem < elements_ptr_ + elements_num_;
+    }
+
+    // id of an element returned by Find, in [0, GetElementsNum())
+    size_t GetElementIndex(const DatMemElem * elem) const {
+        assert(elem >= elements_ptr_ && elem < elements_ptr_ + elements_num_);
+        return elem - elements_ptr_;
+    }
+
+    const double * GetColumn() const {
+        return column_ptr_;
+    }
+
+    size_t GetColumnSize() const {
+        return column_num_;
+    }
+
+    // checksum of the source files the cache was built from
+    string GetMd5() const {
+        return mmap_addr_ == nullptr ? string() : string(GetHeader().md5_hex, sizeof(GetHeader().md5_hex));
+    }
+
+    uint64_t GetFingerprint() const {
+        return mmap_addr_ == nullptr ? 0 : GetHeader().fingerprint;
+    }
+
+    const Rune * GetRunes() const {
+        return runes_ptr_;
+    }
+
+    size_t GetRuneNum() const {
+        return rune_num_;
+    }
+
+    Error InitBuildDat(vector<DatElement>& elements, const string & dat_cache_file, const string & md5,
+                       const vector<double> & column = vector<double>(), const vector<Rune> & runes = vector<Rune>(),
+                       uint64_t fingerprint = 0) {
+        auto status = BuildDatCache(elements, dat_cache_file, md5, column, runes, fingerprint);
         if (status != Error::Ok) {
             return status;
         }
         return InitAttachDat(dat_cache_file, md5);
     }
 
+    // an empty `md5` is not checked, the caller checks GetFingerprint instead
     Error InitAttachDat(const string & dat_cache_file, const string & md5) {
-        mmap_fd_ = ::open(dat_cache_file.c_str(), O_RDONLY);
+        const int fd = ::open(dat_cache_file.c_str(), O_RDONLY);
 
-        if (mmap_fd_ < 0) {
+        if (fd < 0) {
             return Error::OpenFileFailed;
         }
 
-        mmap_length_ = ::lseek(mmap_fd_, 0, SEEK_END);
-        if (mmap_length_ < sizeof(CacheFileHeader)) {
+        const off_t length = ::lseek(fd, 0, SEEK_END);
+        if (length < (off_t)sizeof(CacheFileHeader)) {
+            ::close(fd);
             return Error::FileOperationError;
         }
 
-        mmap_addr_ = reinterpret_cast<char *>(mmap(nullptr, mmap_length_, PROT_READ, MAP_SHARED, mmap_fd_, 0));
-        if (MAP_FAILED == mmap_addr_) {
+        // the mapping outlives the fd
+        char * addr = reinterpret_cast<char *>(::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0));
+        ::close(fd);
+        if (MAP_FAILED == addr) {
             return Error::MmapError;
         }
 
-        // assert(mmap_length_ >= sizeof(CacheFileHeader));
-        CacheFileHeader & header = *reinterpret_cast<CacheFileHeader*>(mmap_addr_);
+        const CacheFileHeader & header = *reinterpret_cast<const CacheFileHeader*>(addr);
+        Error status = Error::Ok;
+
+        if (!md5.empty() && (md5.size() != sizeof(header.md5_hex) || 0 != memcmp(&header.md5_hex[0], md5.c_str(), md5.size()))) {
+            XLOG(ERROR) << "MD5 checksum failed for file: " << dat_cache_file;
+            status = Error::ValueError;
+        } else if ((size_t)length != sizeof(header) + header.elements_num * sizeof(DatMemElem)
+                   + header.column_num * sizeof(double) + header.dat_size * dat_.unit_size()
+                   + header.rune_num * sizeof(Rune)) {
+            XLOG(ERROR) << "mmap length check failed. ";
+            status = Error::ValueError;
+        }
+
+        if (status != Error::Ok) {
+            ::munmap(addr, length);
+            return status;
+        }
+
         elements_num_ = header.elements_num;
         min_weight_ = header.min_weight;
-        assert(sizeof(header.md5_hex) == md5.size());
+        mean_weight_ = header.mean_weight;
+        freq_sum_ = header.freq_sum;
+        default_weight_ = header.default_weight;
+        column_num_ = header.column_num;
+        rune_num_ = header.rune_num;
+        Rebase(addr, length, header.dat_size);
+        return Error::Ok;
+    }
 
-        if (0 != memcmp(&header.md5_hex[0], md5.c_str(), md5.size())) {
-            XLOG(ERROR) << "MD5 checksum failed for file: " << dat_cache_file;
+    // copies the trie of `other` into anonymous memory, which the calling thread touches first, see NumaReplicas
+    Error InitCopyDat(const DatTrie & other) {
+        if (other.mmap_addr_ == nullptr) {
             return Error::ValueError;
         }
 
-        if (mmap_length_ != sizeof(header) + header.elements_num * sizeof(DatMemElem) + header.dat_size * dat_.unit_size()) {
-            XLOG(ERROR) << "mmap length check failed. ";
+        const size_t length = other.GetDataLength();
+        void * addr = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (MAP_FAILED == addr) {
+            XLOG(ERROR) << "mmap " << length << " bytes failed";
+            return Error::MmapError;
+        }
+
+        memcpy(addr, other.mmap_addr_, length);
+        ::mprotect(addr, length, PROT_READ);
+
+        elements_num_ = other.elements_num_;
+        min_weight_ = other.min_weight_;
+        mean_weight_ = other.mean_weight_;
+        freq_sum_ = other.freq_sum_;
+        default_weight_ = other.default_weight_;
+        column_num_ = other.column_num_;
+        rune_num_ = other.rune_num_;
+        Rebase((char *)addr, length, other.dat_.size());
+        return Error::Ok;
+    }
+
+    /*
+     * Applies `options` to the attached trie. The cache is mapped lazily, so without them the first probes after
+     * start take a page fault per 4KB page they reach, and the probes of a warm trie miss the dTLB over its pages.
+     * Moves the arrays, so it must be done before the first Find, not concurrently with one.
+     * */
+    Error Remap(const DatMapOptions & options) {
+        if (mmap_addr_ == nullptr) {
             return Error::ValueError;
         }
-        elements_ptr_ = (const DatMemElem *)(mmap_addr_ + sizeof(header));
-        const char * dat_ptr = mmap_addr_ + sizeof(header) + sizeof(DatMemElem) * elements_num_;
-        dat_.set_array(dat_ptr, header.dat_size);
+
+        if (options.huge_pages != HugePagesNone) {
+            auto status = CopyToHugePages(options.huge_pages == HugePagesExplicit);
+            if (status != Error::Ok) {
+                return status;
+            }
+        } else if (options.populate) {
+            Populate();
+        }
+
+        if (options.lock && 0 != ::mlock(mmap_addr_, mmap_length_)) {
+            XLOG(ERROR) << "mlock " << mmap_length_ << " bytes failed: " << strerror(errno)
+                        << ". Please check ulimit -l";
+            return Error::MmapError;
+        }
+
         return Error::Ok;
     }
 
+    // the bytes of the header and the arrays, the mapping may be larger
+    size_t GetDataLength() const {
+        return sizeof(CacheFileHeader) + elements_num_ * sizeof(DatMemElem) + column_num_ * sizeof(double)
+               + dat_.total_size() + rune_num_ * sizeof(Rune);
+    }
+
 private:
-    Error BuildDatCache(vector<DatElement>& elements, const string & dat_cache_file, const string & md5) {
+    // makes the arrays point into the copy of the data at `addr`, which replaces the current mapping
+    void Rebase(char * addr, size_t length, size_t dat_size) {
+        if (mmap_addr_ != nullptr) {
+            ::munmap(mmap_addr_, mmap_length_);
+        }
+
+        mmap_addr_ = addr;
+        mmap_length_ = length;
+        elements_ptr_ = (const DatMemElem *)(mmap_addr_ + sizeof(CacheFileHeader));
+        column_ptr_ = (const double *)(elements_ptr_ + elements_num_);
+        dat_.set_array(column_ptr_ + column_num_, dat_size);
+        runes_ptr_ = (const Rune *)((const char *)(column_ptr_ + column_num_) + dat_.total_size());
+    }
+
+    const CacheFileHeader & GetHeader() const {
+        return *reinterpret_cast<const CacheFileHeader*>(mmap_addr_);
+    }
+
+    // faults in the pages of the mapping, with one syscall where the kernel has MADV_POPULATE_READ (5.14)
+    void Populate() {
+        ::madvise(mmap_addr_, mmap_length_, MADV_WILLNEED);
+
+#ifdef MADV_POPULATE_READ
+        if (0 == ::madvise(mmap_addr_, mmap_length_, MADV_POPULATE_READ)) {
+            return;
+        }
+#endif
+
+        const size_t page = ::sysconf(_SC_PAGESIZE);
+        volatile char sink = 0;
+
+        for (size_t i = 0; i < mmap_length_; i += page) {
+            sink += mmap_addr_[i];
+        }
+    }
+
+    // copies the data into a 2MB aligned anonymous region backed by huge pages, which is populated by the copy
+    Error CopyToHugePages(bool explicit_pages) {
+        const size_t HUGE_PAGE_SIZE = 2 << 20;
+        const size_t data_length = GetDataLength();
+        const size_t length = (data_length + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+        void * addr = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+        if (explicit_pages) {
+            addr = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        }
+#endif
+
+        if (explicit_pages && MAP_FAILED == addr) {
+            XLOG(WARNING) << "no explicit huge page left, see vm.nr_hugepages. Falling back to transparent ones";
+        }
+
+        if (MAP_FAILED == addr) {
+            // mapped with a huge page of slack, which is cut off on both sides of the aligned region
+            char * raw = (char *)::mmap(nullptr, length + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (MAP_FAILED == raw) {
+                XLOG(ERROR) << "mmap " << length << " bytes failed";
+                return Error::MmapError;
+            }
+
+            char * aligned = (char *)(((uintptr_t)raw + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+
+            if (aligned > raw) {
+                ::munmap(raw, aligned - raw);
+            }
+
+            if (raw + HUGE_PAGE_SIZE > aligned) {
+                ::munmap(aligned + length, raw + HUGE_PAGE_SIZE - aligned);
+            }
+
+#ifdef MADV_HUGEPAGE
+            ::madvise(aligned, length, MADV_HUGEPAGE);
+#endif
+            addr = aligned;
+        }
+
+        memcpy(addr, mmap_addr_, data_length);
+        ::mprotect(addr, length, PROT_READ);
+        Rebase((char *)addr, length, dat_.size());
+        return Error::Ok;
+    }
+
+    Error BuildDatCache(vector<DatElement>& elements, const string & dat_cache_file, const string & md5,
+                        const vector<double> & column, const vector<Rune> & runes, uint64_t fingerprint) {
         std::sort(elements.begin(), elements.end());
 
         vector<const char*> keys_ptr_vec;
@@ -210,6 +469,12 @@ private:
 
         CacheFileHeader header;
         header.min_weight = min_weight_;
+        header.mean_weight = mean_weight_;
+        header.freq_sum = freq_sum_;
+        header.default_weight = default_weight_;
+        header.column_num = column.size();
+        header.rune_num = runes.size();
+        header.fingerprint = fingerprint;
         assert(sizeof(header.md5_hex) == md5.size());
         memcpy(&header.md5_hex[0], md5.c_str(), md5.size());
 
@@ -230,43 +495,13 @@ private:
         header.elements_num = mem_elem_vec.size();
         header.dat_size = dat_.size();
 
-        {
-            string tmp_filepath = string(dat_cache_file) + "_XXXXXX";
-            ::umask(S_IWGRP | S_IWOTH);
-            const int fd = ::mkstemp(&tmp_filepath[0]);
-            if (fd < 0) {
-                XLOG(ERROR) << "make temporary file failed";
-                return Error::OpenFileFailed;
-            }
-            auto st = ::fchmod(fd, 0644);
-            if (st != 0) {
-                XLOG(ERROR) << "change temporary file mode to 0644 failed. Please check permission";
-                return Error::FileOperationError;
-            }
-
-            auto write_bytes = ::write(fd, (const char *)&header, sizeof(header));
-            write_bytes += ::write(fd, (const char *)&mem_elem_vec[0], sizeof(mem_elem_vec[0]) * mem_elem_vec.size());
-            write_bytes += ::write(fd, dat_.array(), dat_.total_size());
-
-            // assert(write_bytes == sizeof(header) + mem_elem_vec.size() * sizeof(mem_elem_vec[0]) + dat_.total_size());
-            if (write_bytes != sizeof(header) + mem_elem_vec.size() * sizeof(mem_elem_vec[0]) + dat_.total_size()) {
-                XLOG(ERROR) << "check written data size failed. ";
-                return Error::FileOperationError;
-            }
-            st = ::close(fd);
-            if (st != 0) {
-                XLOG(ERROR) << "Closing " << tmp_filepath << " failed";
-                return Error::FileOperationError;
-            }
-
-            const auto rename_ret = ::rename(tmp_filepath.c_str(), dat_cache_file.c_str());
-            if (0 != rename_ret) {
-                XLOG(ERROR) << "rename " << tmp_filepath << " to " << dat_cache_file << " failed. ";
-                return Error::FileOperationError;
-            }
-        }
-
-        return Error::Ok;
+        return WriteCacheFile(dat_cache_file, {
+            {&header, sizeof(header)},
+            {mem_elem_vec.data(), sizeof(mem_elem_vec[0]) * mem_elem_vec.size()},
+            {column.data(), sizeof(double) * column.size()},
+            {dat_.array(), dat_.total_size()},
+            {runes.data(), sizeof(Rune) * runes.size()},
+        });
     }
 
 
@@ -275,13 +510,68 @@ private:
     const DatMemElem * elements_ptr_ = nullptr;
     size_t elements_num_ = 0;
     double min_weight_ = 0;
+    double mean_weight_ = 0;
+    double freq_sum_ = 0;
+    double default_weight_ = 0;
+    const double * column_ptr_ = nullptr;
+    size_t column_num_ = 0;
+    const Rune * runes_ptr_ = nullptr;
+    size_t rune_num_ = 0;
 
-    int mmap_fd_ = -1;
     size_t mmap_length_ = 0;
     char * mmap_addr_ = nullptr;
 };
 
 
+/*
+ * Cheap identity of `files` and `salt`, from the size, mtime and inode of each file rather than its bytes, so that a
+ * cache is validated without reading its sources. Editing or replacing a file changes it; so does touching one, which
+ * only costs a rebuild.
+ * */
+inline Error CalcFileListFingerprint(const vector<string>& files, const string& salt, size_t& file_size_sum,
+                                     uint64_t& fingerprint) {
+    uint64_t hash = 14695981039346656037ULL; // FNV-1a
+    auto mix = [&hash](uint64_t value) {
+        for (size_t i = 0; i < sizeof(value); i++) {
+            hash ^= (value >> (8 * i)) & 0xff;
+            hash *= 1099511628211ULL;
+        }
+    };
+
+    file_size_sum = 0;
+
+    for (char c : salt) {
+        mix((unsigned char)c);
+    }
+
+    for (auto const & local_path : files) {
+        if (local_path.empty()) {
+            continue;
+        }
+
+        struct stat st;
+        if (0 != ::stat(local_path.c_str(), &st)) {
+            XLOG(ERROR) << "failed to stat " << local_path;
+            return Error::OpenFileFailed;
+        }
+
+#ifdef __APPLE__
+        const uint64_t mtime_ns = st.st_mtimespec.tv_sec * 1000000000ULL + st.st_mtimespec.tv_nsec;
+#else
+        const uint64_t mtime_ns = st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+#endif
+        mix(st.st_size);
+        mix(mtime_ns);
+        mix(st.st_ino);
+        mix(st.st_dev);
+        file_size_sum += st.st_size;
+    }
+
+    // 0 is no fingerprint in CacheFileHeader
+    fingerprint = hash != 0 ? hash : 1;
+    return Error::Ok;
+}
+
 inline Error CalcFileListMD5(const vector<string>& files, size_t& file_size_sum, string& md5sum) {
     limonp::MD5 md5;
     file_size_sum = 0;
@@ -6,14 +6,17 @@
 #include <string>
 #include <cstring>
 #include <cstdlib>
+#include <cstdio>
 #include <cstdint>
 #include <cmath>
 #include <cerrno>
 #include <limits>
+#include <memory>
 #include "limonp/StringUtil.hpp"
 #include "limonp/Logging.hpp"
 #include "Unicode.hpp"
 #include "DatTrie.hpp"
+#include "CacheLock.hpp"
 #include "Error.hpp"
 
 
@@ -26,6 +29,18 @@ const double MAX_DOUBLE = 3.14e+100;
 const size_t DICT_COLUMN_NUM = 3;
 const char* const UNKNOWN_TAG = "";
 
+/*
+ * The dictionary is a stack of DAT layers, each with a cache of its own: the base dict, then one layer per user dict.
+ * Editing a user dict only rebuilds its layer, the base is attached as it is. The layers of the user dicts depend on
+ * the base (the weights of their words are relative to it), so editing the base rebuilds them all.
+ *
+ * An overlay (see the ShareLayers constructor, and Jieba::AddTenant) shares the layers of its base, in memory, and
+ * stacks the layers of its own user dicts on them with AddUserDicts.
+ *
+ * Find merges the matches of all the layers. A word found in several layers is the entry of the highest weight, the
+ * one of the later layer on a tie, as a single trie of all the dicts kept the heaviest of duplicated words. The element
+ * ids are the ones of the base then of each user layer in turn, see GetElementIndex.
+ * */
 class DictTrie {
 public:
     enum UserWordWeightOption {
@@ -34,36 +49,157 @@ public:
         WordWeightMax,
     }; // enum UserWordWeightOption
 
+    // how a dat cache found on disk is told to be the one of the dict files
+    enum CacheValidation {
+        ValidateFingerprint, // size, mtime and inode of the files, see CalcFileListFingerprint
+        ValidateMd5,         // md5 of their content, which reads them all
+    }; // enum CacheValidation
+
+    // tag of the overlay constructor
+    enum LayerSharing {
+        ShareLayers,
+    }; // enum LayerSharing
+
     DictTrie(const string& dict_path, const string& user_dict_paths = "", const string & dat_cache_path = "",
-             UserWordWeightOption user_word_weight_opt = WordWeightMedian) {
-        Create(dict_path, user_dict_paths, dat_cache_path, user_word_weight_opt);
+             UserWordWeightOption user_word_weight_opt = WordWeightMedian,
+             CacheValidation validation = ValidateFingerprint) {
+        Create(dict_path, user_dict_paths, dat_cache_path, user_word_weight_opt, validation);
+    }
+
+    // copies the layers into memory touched first by the calling thread, see NumaReplicas
+    DictTrie(const DictTrie& other)
+        : total_dict_size_(other.total_dict_size_), md5_(other.md5_), freq_sum_(other.freq_sum_),
+          user_word_default_weight_(other.user_word_default_weight_),
+          user_dict_single_chinese_word_(other.user_dict_single_chinese_word_) {
+        for (const auto & layer : other.layers_) {
+            layers_.push_back(std::make_shared<DatTrie>());
+            layers_.back()->InitCopyDat(*layer);
+        }
+    }
+
+    /*
+     * Overlay of the layers of `base`, which it shares rather than copies, so that the user dicts stacked on it with
+     * AddUserDicts take the memory of their own layers only.
+     * */
+    DictTrie(const DictTrie& base, LayerSharing)
+        : total_dict_size_(base.total_dict_size_), md5_(base.md5_), layers_(base.layers_),
+          shared_layer_num_(base.layers_.size()), freq_sum_(base.freq_sum_),
+          user_word_default_weight_(base.user_word_default_weight_),
+          user_dict_single_chinese_word_(base.user_dict_single_chinese_word_) {
     }
 
+    DictTrie& operator=(const DictTrie&) = delete;
+
     ~DictTrie() = default;
 
     const DatMemElem* Find(const string & word) const {
-        return dat_.Find(word);
+        const DatMemElem* elem = layers_[0]->Find(word);
+
+        for (size_t i = 1; i < layers_.size(); i++) {
+            const DatMemElem* user_elem = layers_[i]->Find(word);
+
+            if (user_elem != nullptr && (elem == nullptr || user_elem->weight >= elem->weight)) {
+                elem = user_elem;
+            }
+        }
+
+        return elem;
     }
 
     void Find(RuneStrArray::const_iterator begin,
               RuneStrArray::const_iterator end,
               vector<struct DatDag>&res,
               size_t max_word_len = MAX_WORD_LENGTH) const {
-        dat_.Find(begin, end, res, max_word_len);
+        if (layers_.size() == 1) {
+            layers_[0]->Find(begin, end, res, max_word_len);
+            return;
+        }
+
+        res.clear();
+        res.resize(end - begin);
+        const string text_str = EncodeRunesToString(begin, end);
+
+        for (size_t i = 0, begin_pos = 0; i < size_t(end - begin); i++) {
+            Find(&text_str[begin_pos], text_str.size() - begin_pos, i, res[i], max_word_len);
+            begin_pos += limonp::UnicodeToUtf8Bytes((begin + i)->rune);
+        }
+    }
+
+    void Find(const char * text, size_t length, size_t pos, DatDag & dag,
+              size_t max_word_len = MAX_WORD_LENGTH) const {
+        layers_[0]->Find(text, length, pos, dag, max_word_len);
+
+        for (size_t i = 1; i < layers_.size(); i++) {
+            DatDag user_dag;
+            layers_[i]->Find(text, length, pos, user_dag, max_word_len);
+            MergeDag(user_dag, dag);
+        }
     }
 
     bool IsUserDictSingleChineseWord(const Rune& word) const {
-        return IsIn(user_dict_single_chinese_word_, word);
+        return user_dict_single_chinese_word_.Contains(word);
     }
 
     double GetMinWeight() const {
-        return dat_.GetMinWeight();
+        return layers_[0]->GetMinWeight();
     }
 
     size_t GetTotalDictSize() const {
         return total_dict_size_;
     }
 
+    // checksum of the dict files, which identifies the element ids of the layers
+    const string& GetMd5() const {
+        return md5_;
+    }
+
+    size_t GetElementsNum() const {
+        size_t num = 0;
+
+        for (const auto & layer : layers_) {
+            num += layer->GetElementsNum();
+        }
+
+        return num;
+    }
+
+    // the layers of the user dicts, on top of the base one, the ones of the base of an overlay included
+    size_t GetUserLayerNum() const {
+        return layers_.size() - 1;
+    }
+
+    // see DatTrie::Remap, before the segments start cutting. An overlay remaps its own layers only, the shared ones are
+    // the ones of its base
+    Error SetMapOptions(const DatMapOptions& options) {
+        Error status = Error::Ok;
+
+        for (size_t i = shared_layer_num_; i < layers_.size() && status == Error::Ok; i++) {
+            status = layers_[i]->Remap(options);
+        }
+
+        return status;
+    }
+
+    // id of an element returned by Find, in [0, GetElementsNum())
+    size_t GetElementIndex(const DatMemElem* elem) const {
+        if (layers_.size() == 1 || layers_[0]->IsElement(elem)) {
+            return layers_[0]->GetElementIndex(elem);
+        }
+
+        size_t offset = 0;
+
+        for (const auto & layer : layers_) {
+            if (layer->IsElement(elem)) {
+                return offset + layer->GetElementIndex(elem);
+            }
+
+            offset += layer->GetElementsNum();
+        }
+
+        assert(false);
+        return offset;
+    }
+
     void InsertUserDictNode(const string& line, bool saveNodeInfo = true) {
         vector<string> buf;
 
@@ -96,7 +232,8 @@ public:
             RuneArray word;
 
             if (DecodeRunesInString(node_info.word, word)) {
-                user_dict_single_chinese_word_.insert(word[0]);
+                user_dict_single_chinese_word_.Insert(word[0]);
+                user_dict_single_runes_.push_back(word[0]);
             } else {
                 XLOG(ERROR) << "Decode " << node_info.word << " failed. Ignored. Please Check the user dict";
             }
@@ -105,6 +242,10 @@ public:
 
     Error LoadUserDict(const vector<string>& files, bool saveNodeInfo = true) {
         for (auto & file : files) {
+            if (file.empty()) {
+                continue;
+            }
+
             ifstream ifs(file.c_str());
             if (!ifs.is_open()) {
                 XLOG(ERROR) << "open " << file << " failed";
@@ -124,59 +265,227 @@ public:
 
 
 public:
-    Error Create(const string& dict_path, const string& user_dict_paths, string dat_cache_path,
-                 UserWordWeightOption user_word_weight_opt) {
-        size_t file_size_sum = 0;
-        string md5;
-        Error status = CalcFileListMD5({dict_path, user_dict_paths}, file_size_sum, md5);
+    /*
+     * `user_dict_paths` separated by ';' or '|'. The cache of the base is `dat_cache_path`, the ones of the user dicts
+     * `dat_cache_path`.1, .2..., by their layer. When it is empty, each cache is named after its dict file and the identity of the
+     * file, next to it.
+     * */
+    Error Create(const string& dict_path, const string& user_dict_paths, const string& dat_cache_path,
+                 UserWordWeightOption user_word_weight_opt, CacheValidation validation = ValidateFingerprint) {
+        total_dict_size_ = 0;
+        layers_.assign(1, std::make_shared<DatTrie>());
+        shared_layer_num_ = 0;
+        user_dict_single_chinese_word_.Clear();
+
+        DatTrie& base = *layers_[0];
+        Error status = AttachOrBuild(base, dict_path, to_string(user_word_weight_opt), dat_cache_path, validation,
+        [this, &dict_path, user_word_weight_opt](vector<DatElement>& elements, vector<Rune>&) {
+            return BuildBase(dict_path, user_word_weight_opt, elements);
+        });
         if (status != Error::Ok) {
             return status;
         }
-        total_dict_size_ = file_size_sum;
 
-        if (dat_cache_path.empty()) {
-            dat_cache_path = dict_path + "." + md5 + "." + to_string(user_word_weight_opt) +  ".dat_cache";
+        freq_sum_ = base.GetFreqSum();
+        user_word_default_weight_ = base.GetDefaultWeight();
+        return AddUserDicts(user_dict_paths, dat_cache_path, validation);
+    }
+
+    /*
+     * Stacks the layers of `user_dict_paths` on the ones there are, with the caches of the ones of Create. Not while
+     * segments cut with the trie.
+     * */
+    Error AddUserDicts(const string& user_dict_paths, const string& dat_cache_path = "",
+                       CacheValidation validation = ValidateFingerprint) {
+        vector<string> user_files;
+
+        for (auto & path : Split(user_dict_paths, "|;")) {
+            if (!path.empty()) {
+                user_files.push_back(path);
+            }
         }
 
-        if (dat_.InitAttachDat(dat_cache_path, md5)) {
-            status = LoadUserDict({user_dict_paths}, false); // for load user_dict_single_chinese_word_;
+        Error status = Error::Ok;
+
+        for (size_t i = 0; i < user_files.size() && status == Error::Ok; i++) {
+            auto layer = std::make_shared<DatTrie>();
+            const string cache_path = dat_cache_path.empty() ? "" : dat_cache_path + "." + to_string(layers_.size());
+
+            // the weights of the user words are relative to the base
+            status = AttachOrBuild(*layer, user_files[i], layers_[0]->GetMd5(), cache_path, validation,
+            [this, &user_files, i](vector<DatElement>& elements, vector<Rune>& runes) {
+                return BuildUserLayer(user_files[i], elements, runes);
+            });
             if (status != Error::Ok) {
-                return status;
+                break;
             }
-            return Error::Ok;
+
+            for (size_t j = 0; j < layer->GetRuneNum(); j++) {
+                user_dict_single_chinese_word_.Insert(layer->GetRunes()[j]);
+            }
+
+            layers_.push_back(layer);
+        }
+
+        md5_.clear();
+
+        for (const auto & layer : layers_) {
+            md5_ += layer->GetMd5();
+        }
+
+        if (layers_.size() > 1) {
+            md5String(md5_.c_str(), md5_);
         }
 
-        status = LoadDefaultDict(dict_path);
+        return status;
+    }
+
+private:
+    /*
+     * Attaches `dat` to the cache of `file` and `salt`, what the layer depends on besides the file. When there is none,
+     * or it is the one of an older file, one process builds it with `build` while the others wait for it and attach to
+     * what it built.
+     * */
+    template <class Build>
+    Error AttachOrBuild(DatTrie& dat, const string& file, const string& salt, string cache_path,
+                        CacheValidation validation, Build build) {
+        size_t file_size = 0;
+        uint64_t fingerprint = 0;
+        string md5;
+        Error status = Error::Ok;
+
+        if (validation == ValidateFingerprint) {
+            status = CalcFileListFingerprint({file}, salt, file_size, fingerprint);
+        } else {
+            status = CalcLayerMd5(file, salt, file_size, md5);
+        }
         if (status != Error::Ok) {
             return status;
         }
+        total_dict_size_ += file_size;
 
-        double min_weight, max_weight;
+        if (cache_path.empty()) {
+            cache_path = file + "." + (validation == ValidateFingerprint ? ToHex(fingerprint) : md5) + ".dat_cache";
+        }
 
-        std::tie(freq_sum_, min_weight, max_weight) = CalculateWeight(static_node_infos_);
+        if (AttachCache(dat, cache_path, validation, fingerprint, md5)) {
+            return Error::Ok;
+        }
 
-        status = SetUserWordWeights(user_word_weight_opt);
+        CacheLock lock(cache_path);
+
+        if (lock.Lock() && AttachCache(dat, cache_path, validation, fingerprint, md5)) {
+            return Error::Ok;
+        }
+
+        lock.RemoveStaleTempFiles();
+
+        // the element ids of the cache are identified by the md5 of the dict files, see IdfTrie
+        if (md5.empty()) {
+            status = CalcLayerMd5(file, salt, file_size, md5);
+            if (status != Error::Ok) {
+                return status;
+            }
+        }
+
+        vector<DatElement> elements;
+        vector<Rune> runes;
+        status = build(elements, runes);
         if (status != Error::Ok) {
             return status;
         }
 
-        dat_.SetMinWeight(min_weight);
+        dat.SetMinWeight(layers_[0]->GetMinWeight());
+        dat.SetFreqSum(freq_sum_);
+        dat.SetDefaultWeight(user_word_default_weight_);
+        return dat.InitBuildDat(elements, cache_path, md5, {}, runes, fingerprint);
+    }
+
+    // attaches `dat` to the cache at `path` if it is the one of the dict file, the fingerprint or the md5 of which is given
+    static bool AttachCache(DatTrie& dat, const string& path, CacheValidation validation, uint64_t fingerprint,
+                            const string& md5) {
+        if (Error::Ok != dat.InitAttachDat(path, validation == ValidateMd5 ? md5 : "")) {
+            return false;
+        }
+
+        return validation != ValidateFingerprint || dat.GetFingerprint() == fingerprint;
+    }
+
+    static Error CalcLayerMd5(const string& file, const string& salt, size_t& file_size, string& md5) {
+        Error status = CalcFileListMD5({file}, file_size, md5);
+
+        if (status == Error::Ok) {
+            md5String((md5 + salt).c_str(), md5);
+        }
+
+        return status;
+    }
 
-        status = LoadUserDict({user_dict_paths});
+    Error BuildBase(const string& dict_path, UserWordWeightOption user_word_weight_opt, vector<DatElement>& elements) {
+        Error status = LoadDefaultDict(dict_path);
         if (status != Error::Ok) {
             return status;
         }
 
-        status = dat_.InitBuildDat(static_node_infos_, dat_cache_path, md5);
-        if (Error::Ok != status) {
+        double min_weight, max_weight;
+
+        std::tie(freq_sum_, min_weight, max_weight) = CalculateWeight(static_node_infos_);
+
+        status = SetUserWordWeights(user_word_weight_opt);
+        if (status != Error::Ok) {
             return status;
         }
 
+        layers_[0]->SetMinWeight(min_weight);
+        elements.swap(static_node_infos_);
         vector<DatElement>().swap(static_node_infos_);
         return Error::Ok;
     }
 
-private:
+    Error BuildUserLayer(const string& file, vector<DatElement>& elements, vector<Rune>& runes) {
+        Error status = LoadUserDict({file});
+
+        elements.swap(static_node_infos_);
+        runes.swap(user_dict_single_runes_);
+        vector<DatElement>().swap(static_node_infos_);
+        vector<Rune>().swap(user_dict_single_runes_);
+        return status;
+    }
+
+    // merges the matches of a user layer into `dag`, both ordered by their end as DatTrie::Find makes them
+    static void MergeDag(const DatDag& user_dag, DatDag& dag) {
+        typedef pair<size_t, const DatMemElem *> Next;
+
+        if (user_dag.nexts.size() == 1 && user_dag.nexts[0].second == nullptr) {
+            return;
+        }
+
+        limonp::LocalVector<Next> merged;
+        size_t i = 0, j = 0;
+
+        while (i < dag.nexts.size() || j < user_dag.nexts.size()) {
+            if (j == user_dag.nexts.size() || (i < dag.nexts.size() && dag.nexts[i].first < user_dag.nexts[j].first)) {
+                merged.push_back(dag.nexts[i++]);
+            } else if (i == dag.nexts.size() || user_dag.nexts[j].first < dag.nexts[i].first) {
+                merged.push_back(user_dag.nexts[j++]);
+            } else {
+                const Next& base = dag.nexts[i++];
+                const Next& user = user_dag.nexts[j++];
+                const bool user_wins = user.second != nullptr &&
+                                       (base.second == nullptr || user.second->weight >= base.second->weight);
+                merged.push_back(user_wins ? user : base);
+            }
+        }
+
+        dag.nexts = merged;
+    }
+
+    static string ToHex(uint64_t value) {
+        char buf[17];
+        snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)value);
+        return buf;
+    }
+
     Error LoadDefaultDict(const string& filePath) {
         ifstream ifs(filePath.c_str());
         if (!ifs.is_open()) {
@@ -256,19 +565,16 @@ private:
     }
 
     static std::tuple<double, double, double> CalculateWeight(vector<DatElement>& node_infos) {
-        double min_weight = node_infos[0].weight;
-        double max_weight = node_infos[0].weight;
+        double min_weight = MAX_DOUBLE;
+        double max_weight = MIN_DOUBLE;
         double sum = CalcFreqSum(node_infos);
 
+        // of the log weights, the ones MPSegment scores with
         for (auto & node_info : node_infos) {
-            if (node_info.weight < min_weight) {
-                min_weight = node_info.weight;
-            } else if (node_info.weight > max_weight) {
-                max_weight = node_info.weight;
-            }
-
             assert(node_info.weight > 0.0);
             node_info.weight = log(double(node_info.weight) / sum);
+            min_weight = std::min(min_weight, node_info.weight);
+            max_weight = std::max(max_weight, node_info.weight);
         }
         return {sum, min_weight, max_weight};
     }
@@ -276,11 +582,16 @@ private:
 private:
     vector<DatElement> static_node_infos_;
     size_t total_dict_size_ = 0;
-    DatTrie dat_;
-
-    double freq_sum_;
-    double user_word_default_weight_;
-    unordered_set<Rune> user_dict_single_chinese_word_;
+    string md5_;
+    // the base dict, then the user dicts, shared with the overlays
+    vector<std::shared_ptr<DatTrie> > layers_;
+    // of layers_, the ones of the base of an overlay
+    size_t shared_layer_num_ = 0;
+
+    double freq_sum_ = 0;
+    double user_word_default_weight_ = 0;
+    RuneBitmap user_dict_single_chinese_word_;
+    vector<Rune> user_dict_single_runes_;
 };
 }
 
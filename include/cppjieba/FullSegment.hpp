@@ -30,22 +30,38 @@ public:
     void Cut(RuneStrArray::const_iterator begin,
              RuneStrArray::const_iterator end,
              vector<WordRange>& res, bool, size_t) const override {
+        CutStream(begin, end, [&res](const WordRange & wr) {
+            res.push_back(wr);
+        });
+    }
+
+    /*
+     * emit(const WordRange&) is called for every word straight from the trie matches at each position,
+     * in the order of Cut, without building the DAG of the whole range.
+     * */
+    template <class Emit>
+    void CutStream(RuneStrArray::const_iterator begin,
+                   RuneStrArray::const_iterator end,
+                   Emit emit) const {
         assert(dictTrie_);
-        vector<struct DatDag> dags;
-        dictTrie_->Find(begin, end, dags);
+        const string text = EncodeRunesToString(begin, end);
+        DatDag dag;
         size_t max_word_end_pos = 0;
 
-        for (size_t i = 0; i < dags.size(); i++) {
-            for (const auto & kv : dags[i].nexts) {
+        for (size_t i = 0, begin_pos = 0; begin + i != end; i++) {
+            dag.nexts.clear();
+            dictTrie_->Find(&text[begin_pos], text.size() - begin_pos, i, dag);
+            begin_pos += limonp::UnicodeToUtf8Bytes((begin + i)->rune);
+
+            for (const auto & kv : dag.nexts) {
                 const size_t nextoffset = kv.first - 1;
-                assert(nextoffset < dags.size());
+                assert(begin + nextoffset < end);
                 const auto wordLen = nextoffset - i + 1;
-                const bool is_not_covered_single_word = ((dags[i].nexts.size() == 1) && (max_word_end_pos <= i));
+                const bool is_not_covered_single_word = ((dag.nexts.size() == 1) && (max_word_end_pos <= i));
                 const bool is_oov = (nullptr == kv.second); //Out-of-Vocabulary
 
                 if ((is_not_covered_single_word) || ((not is_oov) && (wordLen >= 2))) {
-                    WordRange wr(begin + i, begin + nextoffset);
-                    res.push_back(wr);
+                    emit(WordRange(begin + i, begin + nextoffset, kv.second));
                 }
 
                 max_word_end_pos = max(max_word_end_pos, nextoffset + 1);
@@ -39,6 +39,17 @@ struct HMMModel {
         return Error::Ok;
     }
 
+    // the emission tables of the copy are its own, see NumaReplicas
+    HMMModel(const HMMModel& other)
+        : emitProbB(other.emitProbB), emitProbE(other.emitProbE), emitProbM(other.emitProbM),
+          emitProbS(other.emitProbS), emitProbVec({&emitProbB, &emitProbE, &emitProbM, &emitProbS}) {
+        memcpy(statMap, other.statMap, sizeof(statMap));
+        memcpy(startProb, other.startProb, sizeof(startProb));
+        memcpy(transProb, other.transProb, sizeof(transProb));
+    }
+
+    HMMModel& operator=(const HMMModel&) = delete;
+
     ~HMMModel() = default;
 
     Error LoadModel(const string& filePath) {
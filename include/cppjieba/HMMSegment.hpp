@@ -6,6 +6,7 @@
 #include <cassert>
 #include "HMMModel.hpp"
 #include "SegmentBase.hpp"
+#include "ScoreTraits.hpp"
 
 namespace cppjieba {
 class HMMSegment: public SegmentBase {
@@ -26,6 +27,10 @@ public:
 
     ~HMMSegment() override = default;
 
+    void SetScoreType(ScoreType type) {
+        scoreType_ = type;
+    }
+
     void Cut(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end, vector<WordRange>& res, bool,
                      size_t) const override {
         RuneStrArray::const_iterator left = begin;
@@ -67,7 +72,7 @@ public:
             InternalCut(left, right, res);
         }
     }
-private:
+
     // sequential letters rule
     static RuneStrArray::const_iterator SequentialLetterRule(RuneStrArray::const_iterator begin,
                                                       RuneStrArray::const_iterator end) {
@@ -113,6 +118,8 @@ private:
 
         return begin;
     }
+
+private:
     void InternalCut(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end, vector<WordRange>& res) const {
         vector<size_t> status;
         Viterbi(begin, end, status);
@@ -133,38 +140,110 @@ private:
     void Viterbi(RuneStrArray::const_iterator begin,
                  RuneStrArray::const_iterator end,
                  vector<size_t>& status) const {
-        size_t Y = HMMModel::STATUS_SUM;
+        // a reduced precision run whose path goes through a near tie is decided again in double
+        switch (scoreType_) {
+            case ScoreFloat:
+                if (Viterbi<float>(begin, end, status)) {
+                    return;
+                }
+                break;
+
+            case ScoreFixed32:
+                if (Viterbi<int32_t>(begin, end, status)) {
+                    return;
+                }
+                break;
+
+            default:
+                break;
+        }
+
+        Viterbi<double>(begin, end, status);
+    }
+
+    // returns false if the best path goes through a near tie, see ScoreTraits
+    template <typename Score>
+    bool Viterbi(RuneStrArray::const_iterator begin,
+                 RuneStrArray::const_iterator end,
+                 vector<size_t>& status) const {
+        typedef ScoreTraits<Score> Traits;
+        const size_t Y = HMMModel::STATUS_SUM;
+        const bool checkTies = Traits::CHECK_TIES;
         size_t X = end - begin;
 
         size_t XYSize = X * Y;
         size_t now, old, stat;
-        double tmp, endE, endS;
+        Score tmp, endE, endS, second;
 
         vector<int> path(XYSize);
-        vector<double> weight(XYSize);
+        vector<Score> weight(XYSize);
+        vector<uint8_t> nearTie(checkTies ? XYSize : 0);
+        // bounds the terms and the partial sums of the scores compared so far, all of them <= 0
+        double magnitude = 0;
+
+        Score transProb[Y][Y];
+
+        for (size_t preY = 0; preY < Y; preY++) {
+            for (size_t y = 0; y < Y; y++) {
+                transProb[preY][y] = Traits::FromLogProb(model_->transProb[preY][y]);
+            }
+        }
 
         //start
         for (size_t y = 0; y < Y; y++) {
-            weight[0 + y * X] = model_->startProb[y] + model_->GetEmitProb(model_->emitProbVec[y], begin->rune, MIN_DOUBLE);
+            weight[0 + y * X] = Traits::Add(Traits::FromLogProb(model_->startProb[y]),
+                                            EmitProb<Score>(y, begin->rune));
             path[0 + y * X] = -1;
+
+            if (checkTies && weight[0 + y * X] > Traits::Min() / 2) {
+                magnitude = std::max(magnitude, -double(weight[0 + y * X]));
+            }
         }
 
-        double emitProb;
+        Score emitProb;
 
         for (size_t x = 1; x < X; x++) {
             for (size_t y = 0; y < Y; y++) {
                 now = x + y * X;
-                weight[now] = MIN_DOUBLE;
+                weight[now] = Traits::Min();
+                second = Traits::Min();
                 path[now] = HMMModel::E; // warning
-                emitProb = model_->GetEmitProb(model_->emitProbVec[y], (begin + x)->rune, MIN_DOUBLE);
+                emitProb = EmitProb<Score>(y, (begin + x)->rune);
 
                 for (size_t preY = 0; preY < Y; preY++) {
                     old = x - 1 + preY * X;
-                    tmp = weight[old] + model_->transProb[preY][y] + emitProb;
+                    tmp = Traits::Add(Traits::Add(weight[old], transProb[preY][y]), emitProb);
 
                     if (tmp > weight[now]) {
+                        second = weight[now];
                         weight[now] = tmp;
                         path[now] = preY;
+                    } else if (tmp > second) {
+                        second = tmp;
+                    }
+                }
+
+                if (checkTies) {
+                    if (weight[now] > Traits::Min() / 2) {
+                        magnitude = std::max(magnitude, -double(weight[now]));
+                    }
+
+                    // start, then for each column the transition, the emission and the renormalization
+                    nearTie[now] = Traits::IsNearTie(weight[now], second, 3 * (x + 1), magnitude);
+                }
+            }
+
+            if (Traits::RENORMALIZE) {
+                // keep the scores of the column close to 0, where the reduced precision types are the most precise
+                Score colMax = weight[x];
+
+                for (size_t y = 1; y < Y; y++) {
+                    colMax = std::max(colMax, weight[x + y * X]);
+                }
+
+                if (colMax > Traits::Min()) {
+                    for (size_t y = 0; y < Y; y++) {
+                        weight[x + y * X] = Traits::Add(weight[x + y * X], -colMax);
                     }
                 }
             }
@@ -180,15 +259,31 @@ private:
             stat = HMMModel::S;
         }
 
+        if (checkTies && Traits::IsNearTie(std::max(endE, endS), std::min(endE, endS), 3 * X, magnitude)) {
+            return false;
+        }
+
         status.resize(X);
 
         for (int x = X - 1 ; x >= 0; x--) {
+            if (checkTies && nearTie[x + stat * X]) {
+                return false;
+            }
+
             status[x] = stat;
             stat = path[x + stat * X];
         }
+
+        return true;
+    }
+
+    template <typename Score>
+    Score EmitProb(size_t y, Rune rune) const {
+        return ScoreTraits<Score>::FromLogProb(model_->GetEmitProb(model_->emitProbVec[y], rune, MIN_DOUBLE));
     }
 
     const HMMModel* model_;
+    ScoreType scoreType_ = ScoreDouble;
 }; // class HMMSegment
 
 } // namespace cppjieba
@@ -0,0 +1,806 @@
+#pragma once
+
+#ifndef __linux__
+#error "HttpServer needs epoll and SO_REUSEPORT"
+#endif
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "Jieba.hpp"
+
+namespace cppjieba {
+
+struct HttpServerOptions {
+    string host = "127.0.0.1";
+    int port = 11200;                  // 0 for any free port, see GetPort
+    size_t thread_num = 0;             // reactors, 0 for all the cores
+    int backlog = 4096;                // of each listening socket
+    size_t max_header_size = 1 << 16;
+    size_t max_body_size = 1 << 24;
+};
+
+/*
+ * HTTP/1.1 segmentation server over a shared Jieba. Each of the thread_num reactors owns a listening socket bound with
+ * SO_REUSEPORT, so that the kernel spreads the connections, and an edge-triggered epoll instance for them; a
+ * connection stays on its reactor, whose buffers are reused from one request to the next.
+ *
+ *   GET  /?key=<sentence>[&method=MIX|MP|HMM|FULL|QUERY]  -> ["word", ...]
+ *   POST /[?method=...]       body: the sentence          -> ["word", ...]
+ *   POST /batch[?method=...]  body: ["sentence", ...]     -> [["word", ...], ...]
+ *
+ * Connections are kept alive unless the client asks otherwise (or speaks HTTP/1.0 without keep-alive), and pipelined
+ * requests are answered in order, the ones of a read together.
+ * */
+class HttpServer {
+public:
+    HttpServer(const Jieba* jieba, const HttpServerOptions& options = HttpServerOptions())
+        : jieba_(jieba), options_(options), port_(options.port), stop_(false) {
+    }
+
+    ~HttpServer() {
+        Stop();
+    }
+
+    HttpServer(const HttpServer &) = delete;
+    HttpServer &operator=(const HttpServer &) = delete;
+
+    // binds the listening sockets and starts the reactors
+    Error Start() {
+        if (nullptr == jieba_) {
+            XLOG(ERROR) << "Got NULL Jieba pointer ";
+            return Error::ValueError;
+        }
+
+        size_t threadNum = options_.thread_num;
+
+        if (threadNum == 0) {
+            threadNum = std::max(1u, std::thread::hardware_concurrency());
+        }
+
+        stop_.store(false);
+
+        for (size_t i = 0; i < threadNum; i++) {
+            unique_ptr<Reactor> reactor(new Reactor(this));
+            Error status = reactor->Open();
+
+            if (status != Error::Ok) {
+                Stop();
+                return status;
+            }
+
+            reactors_.push_back(std::move(reactor));
+        }
+
+        for (auto & reactor : reactors_) {
+            threads_.emplace_back(&Reactor::Loop, reactor.get());
+        }
+
+        return Error::Ok;
+    }
+
+    // closes the sockets once the reactors are done with their current events
+    void Stop() {
+        stop_.store(true);
+
+        for (auto & reactor : reactors_) {
+            reactor->Wake();
+        }
+
+        for (auto & thread : threads_) {
+            thread.join();
+        }
+
+        threads_.clear();
+        reactors_.clear();
+    }
+
+    // the bound port, once started
+    int GetPort() const {
+        return port_;
+    }
+
+private:
+    struct Connection {
+        int fd = -1;
+        string in;
+        size_t inPos = 0;    // first byte of the next request
+        string out;
+        size_t outPos = 0;   // first byte not written yet
+        bool closing = false; // once out is written
+    };
+
+    struct Request {
+        string method;
+        string path;
+        string query;
+        const char* body = nullptr;
+        size_t bodySize = 0;
+        bool keepAlive = true;
+    };
+
+    class Reactor {
+    public:
+        explicit Reactor(HttpServer* server)
+            : server_(server) {
+        }
+
+        ~Reactor() {
+            for (auto & kv : connections_) {
+                close(kv.first);
+            }
+
+            for (int fd : {listenFd_, epollFd_, eventFd_}) {
+                if (fd >= 0) {
+                    close(fd);
+                }
+            }
+        }
+
+        Error Open() {
+            const HttpServerOptions& options = server_->options_;
+            sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            // the first reactor may have been given a free port, the others join it
+            addr.sin_port = htons(server_->port_);
+
+            if (inet_pton(AF_INET, options.host.c_str(), &addr.sin_addr) != 1) {
+                XLOG(ERROR) << "bad host " << options.host;
+                return Error::ValueError;
+            }
+
+            const int on = 1;
+            listenFd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+            if (listenFd_ < 0
+                    || setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0
+                    || setsockopt(listenFd_, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0
+                    || bind(listenFd_, (const sockaddr*)&addr, sizeof(addr)) != 0
+                    || listen(listenFd_, options.backlog) != 0) {
+                XLOG(ERROR) << "listen on " << options.host << ":" << server_->port_ << " failed: " << strerror(errno);
+                return Error::FileOperationError;
+            }
+
+            socklen_t len = sizeof(addr);
+
+            if (getsockname(listenFd_, (sockaddr*)&addr, &len) != 0) {
+                XLOG(ERROR) << "getsockname failed: " << strerror(errno);
+                return Error::FileOperationError;
+            }
+
+            server_->port_ = ntohs(addr.sin_port);
+            epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+            eventFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+            if (epollFd_ < 0 || eventFd_ < 0 || !Add(listenFd_, EPOLLIN | EPOLLET) || !Add(eventFd_, EPOLLIN)) {
+                XLOG(ERROR) << "epoll failed: " << strerror(errno);
+                return Error::FileOperationError;
+            }
+
+            return Error::Ok;
+        }
+
+        void Wake() {
+            const uint64_t one = 1;
+            ssize_t ret = write(eventFd_, &one, sizeof(one));
+            (void)ret;
+        }
+
+        void Loop() {
+            epoll_event events[256];
+
+            while (!server_->stop_.load(std::memory_order_relaxed)) {
+                const int n = epoll_wait(epollFd_, events, 256, -1);
+
+                for (int i = 0; i < n; i++) {
+                    const int fd = events[i].data.fd;
+
+                    if (fd == listenFd_) {
+                        Accept();
+                    } else if (fd != eventFd_) {
+                        Handle(fd, events[i].events);
+                    }
+                }
+            }
+        }
+
+    private:
+        bool Add(int fd, uint32_t events) {
+            epoll_event event;
+            event.events = events;
+            event.data.fd = fd;
+            return epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &event) == 0;
+        }
+
+        void Accept() {
+            for (;;) {
+                const int fd = accept4(listenFd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+                if (fd < 0) {
+                    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED) {
+                        XLOG_RATE(ERROR, 10) << "accept failed: " << strerror(errno);
+                    }
+
+                    if (errno == EINTR || errno == ECONNABORTED) {
+                        continue;
+                    }
+
+                    return;
+                }
+
+                const int on = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+                if (!Add(fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET)) {
+                    close(fd);
+                    continue;
+                }
+
+                connections_[fd].fd = fd;
+            }
+        }
+
+        void Handle(int fd, uint32_t events) {
+            auto it = connections_.find(fd);
+
+            if (it == connections_.end()) {
+                return;
+            }
+
+            Connection& conn = it->second;
+            bool eof = (events & (EPOLLERR | EPOLLHUP)) != 0;
+
+            /*
+             * The requests are read once the previous answers are written, so that a client sending faster than it
+             * reads is held back by TCP rather than by conn.in growing. Being edge-triggered, the ones already in the
+             * socket raise no further EPOLLIN, so they are read here whatever the event, until the answers block.
+             * */
+            for (;;) {
+                if (conn.outPos == conn.out.size()) {
+                    conn.out.clear();
+                    conn.outPos = 0;
+
+                    if (!conn.closing && !eof) {
+                        Read(conn, eof);
+                    }
+
+                    Process(conn);
+                }
+
+                if (!Flush(conn)) {
+                    Close(fd);
+                    return;
+                }
+
+                if (conn.outPos < conn.out.size()) {
+                    return; // EPOLLOUT comes back once the socket drained
+                }
+
+                if (conn.closing || eof) {
+                    Close(fd);
+                    return;
+                }
+
+                if (conn.out.empty()) {
+                    return; // no complete request left, EPOLLIN comes with the rest
+                }
+            }
+        }
+
+        // reads until the socket is drained, or conn.in holds the largest request there can be
+        void Read(Connection& conn, bool& eof) {
+            const HttpServerOptions& options = server_->options_;
+            const size_t limit = options.max_header_size + 4 + options.max_body_size;
+            char buf[1 << 16];
+
+            while (conn.in.size() - conn.inPos < limit) {
+                const ssize_t n = read(conn.fd, buf, sizeof(buf));
+
+                if (n > 0) {
+                    conn.in.append(buf, n);
+                } else if (n == 0) {
+                    eof = true;
+                    return;
+                } else if (errno != EINTR) {
+                    eof = errno != EAGAIN && errno != EWOULDBLOCK;
+                    return;
+                }
+            }
+        }
+
+        bool Flush(Connection& conn) {
+            while (conn.outPos < conn.out.size()) {
+                const ssize_t n = send(conn.fd, conn.out.data() + conn.outPos, conn.out.size() - conn.outPos,
+                                       MSG_NOSIGNAL);
+
+                if (n > 0) {
+                    conn.outPos += n;
+                } else if (n < 0 && errno == EINTR) {
+                    continue;
+                } else {
+                    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+                }
+            }
+
+            return true;
+        }
+
+        void Close(int fd) {
+            close(fd);
+            connections_.erase(fd);
+        }
+
+        /*
+         * Parses the request at conn.inPos into `request`, `size` being its bytes, 0 if incomplete.
+         * Returns 0 on success (or incomplete), else the status of the error response.
+         * */
+        int Parse(const Connection& conn, Request& request, size_t& size) const {
+            const HttpServerOptions& options = server_->options_;
+            size = 0;
+
+            const size_t headerEnd = conn.in.find("\r\n\r\n", conn.inPos);
+
+            if (headerEnd == string::npos) {
+                return conn.in.size() - conn.inPos > options.max_header_size ? 431 : 0;
+            }
+
+            const char* p = conn.in.data() + conn.inPos;
+            const char* end = conn.in.data() + headerEnd;
+            const char* eol = std::search(p, end + 2, "\r\n", "\r\n" + 2);
+
+            // request line
+            const char* sp1 = std::find(p, eol, ' ');
+            const char* sp2 = std::find(sp1 == eol ? eol : sp1 + 1, eol, ' ');
+
+            if (sp1 == eol || sp2 == eol) {
+                return 400;
+            }
+
+            request.method.assign(p, sp1);
+            const char* target = sp1 + 1;
+            const char* question = std::find(target, sp2, '?');
+            request.path.assign(target, question);
+            request.query.assign(question == sp2 ? sp2 : question + 1, sp2);
+            const string version(sp2 + 1, eol);
+            request.keepAlive = version == "HTTP/1.1";
+
+            if (version != "HTTP/1.1" && version != "HTTP/1.0") {
+                return 400;
+            }
+
+            size_t contentLength = 0;
+
+            for (p = eol + 2; p < end; p = eol + 2) {
+                eol = std::search(p, end + 2, "\r\n", "\r\n" + 2);
+                const char* colon = std::find(p, eol, ':');
+
+                if (colon == eol) {
+                    return 400;
+                }
+
+                const string name = Lower(string(p, colon));
+                string value(colon + 1, eol);
+                Trim(value);
+
+                if (name == "content-length") {
+                    if (value.empty() || value.find_first_not_of("0123456789") != string::npos || value.size() > 18) {
+                        return 400;
+                    }
+
+                    contentLength = strtoull(value.c_str(), nullptr, 10);
+                } else if (name == "connection") {
+                    value = Lower(value);
+                    request.keepAlive = value == "keep-alive" || (request.keepAlive && value != "close");
+                } else if (name == "transfer-encoding") {
+                    return 501;
+                }
+            }
+
+            if (contentLength > options.max_body_size) {
+                return 413;
+            }
+
+            const size_t bodyBegin = headerEnd + 4;
+
+            if (conn.in.size() - bodyBegin < contentLength) {
+                return 0;
+            }
+
+            request.body = conn.in.data() + bodyBegin;
+            request.bodySize = contentLength;
+            size = bodyBegin + contentLength - conn.inPos;
+            return 0;
+        }
+
+        // answers the buffered requests into conn.out
+        void Process(Connection& conn) {
+            while (!conn.closing) {
+                Request request;
+                size_t size = 0;
+                const int error = Parse(conn, request, size);
+
+                if (error != 0) {
+                    Respond(conn, error, "{\"error\": \"" + string(Reason(error)) + "\"}", false);
+                    break;
+                }
+
+                if (size == 0) {
+                    break;
+                }
+
+                const int status = Serve(request, body_);
+                Respond(conn, status, body_, request.keepAlive);
+                conn.inPos += size;
+            }
+
+            // the consumed requests, once most of the buffer
+            if (conn.inPos == conn.in.size()) {
+                conn.in.clear();
+                conn.inPos = 0;
+            } else if (conn.inPos > conn.in.size() / 2) {
+                conn.in.erase(0, conn.inPos);
+                conn.inPos = 0;
+            }
+        }
+
+        void Respond(Connection& conn, int status, const string& body, bool keepAlive) {
+            conn.out += "HTTP/1.1 ";
+            conn.out += std::to_string(status);
+            conn.out += ' ';
+            conn.out += Reason(status);
+            conn.out += "\r\nContent-Type: application/json; charset=utf-8\r\nContent-Length: ";
+            conn.out += std::to_string(body.size());
+            conn.out += keepAlive ? "\r\n\r\n" : "\r\nConnection: close\r\n\r\n";
+            conn.out += body;
+            conn.closing = !keepAlive;
+        }
+
+        int Serve(const Request& request, string& body) {
+            body.clear();
+            string method = "MIX";
+            string key;
+            bool hasKey = false;
+            size_t begin = 0;
+
+            while (begin <= request.query.size()) {
+                size_t end = request.query.find('&', begin);
+                end = end == string::npos ? request.query.size() : end;
+                const size_t eq = request.query.find('=', begin);
+
+                if (eq < end) {
+                    const string name = request.query.substr(begin, eq - begin);
+
+                    if (name == "key") {
+                        hasKey = UrlDecode(request.query.substr(eq + 1, end - eq - 1), key);
+                    } else if (name == "method") {
+                        UrlDecode(request.query.substr(eq + 1, end - eq - 1), method);
+                    }
+                }
+
+                begin = end + 1;
+            }
+
+            if (request.path == "/batch") {
+                if (request.method != "POST") {
+                    return ErrorBody(405, body);
+                }
+
+                if (!ParseStringArray(request.body, request.body + request.bodySize, docs_)) {
+                    return ErrorBody(400, body);
+                }
+
+                body += '[';
+
+                for (size_t i = 0; i < docs_.size(); i++) {
+                    if (i > 0) {
+                        body += ", ";
+                    }
+
+                    if (!Cut(method, docs_[i], body)) {
+                        return ErrorBody(400, body);
+                    }
+                }
+
+                body += ']';
+                return 200;
+            }
+
+            if (request.path != "/") {
+                return ErrorBody(404, body);
+            }
+
+            if (request.method == "POST") {
+                key.assign(request.body, request.bodySize);
+            } else if (request.method != "GET") {
+                return ErrorBody(405, body);
+            } else if (!hasKey) {
+                return ErrorBody(400, body);
+            }
+
+            return Cut(method, key, body) ? 200 : ErrorBody(400, body);
+        }
+
+        int ErrorBody(int status, string& body) const {
+            body = "{\"error\": \"" + string(Reason(status)) + "\"}";
+            return status;
+        }
+
+        // appends the words of `sentence` to `body` as a JSON array
+        bool Cut(const string& method, const string& sentence, string& body) {
+            const Jieba* jieba = server_->jieba_;
+
+            if (method == "MIX") {
+                jieba->Cut(sentence, words_, true);
+            } else if (method == "MP") {
+                jieba->Cut(sentence, words_, false);
+            } else if (method == "HMM") {
+                jieba->CutHMM(sentence, words_);
+            } else if (method == "FULL") {
+                jieba->CutAll(sentence, words_);
+            } else if (method == "QUERY") {
+                jieba->CutForSearch(sentence, words_);
+            } else {
+                return false;
+            }
+
+            body += '[';
+
+            for (size_t i = 0; i < words_.size(); i++) {
+                if (i > 0) {
+                    body += ", ";
+                }
+
+                AppendJsonString(words_[i].word, body);
+            }
+
+            body += ']';
+            return true;
+        }
+
+        HttpServer* server_;
+        int listenFd_ = -1;
+        int epollFd_ = -1;
+        int eventFd_ = -1;
+        unordered_map<int, Connection> connections_;
+
+        // reused from one request to the next
+        vector<Word> words_;
+        vector<string> docs_;
+        string body_;
+    }; // class Reactor
+
+    static const char* Reason(int status) {
+        switch (status) {
+        case 200:
+            return "OK";
+        case 400:
+            return "Bad Request";
+        case 404:
+            return "Not Found";
+        case 405:
+            return "Method Not Allowed";
+        case 413:
+            return "Payload Too Large";
+        case 431:
+            return "Request Header Fields Too Large";
+        default:
+            return "Not Implemented";
+        }
+    }
+
+    static string Lower(string s) {
+        for (auto & c : s) {
+            c = tolower((unsigned char)c);
+        }
+
+        return s;
+    }
+
+    static int HexValue(char c) {
+        if (c >= '0' && c <= '9') {
+            return c - '0';
+        }
+
+        c = tolower((unsigned char)c);
+        return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+    }
+
+    // %XX and '+', the raw UTF-8 of load_test.urls passes through
+    static bool UrlDecode(const string& s, string& res) {
+        res.clear();
+
+        for (size_t i = 0; i < s.size(); i++) {
+            if (s[i] == '+') {
+                res += ' ';
+            } else if (s[i] != '%') {
+                res += s[i];
+            } else if (i + 2 < s.size() && HexValue(s[i + 1]) >= 0 && HexValue(s[i + 2]) >= 0) {
+                res += (char)(HexValue(s[i + 1]) * 16 + HexValue(s[i + 2]));
+                i += 2;
+            } else {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    static void AppendJsonString(const string& s, string& out) {
+        static const char HEX[] = "0123456789abcdef";
+        out += '"';
+
+        for (unsigned char c : s) {
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += c;
+            } else if (c < 0x20) {
+                out += "\\u00";
+                out += HEX[c >> 4];
+                out += HEX[c & 15];
+            } else {
+                out += c;
+            }
+        }
+
+        out += '"';
+    }
+
+    static void SkipSpaces(const char*& p, const char* end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+            p++;
+        }
+    }
+
+    static bool ParseHex4(const char*& p, const char* end, uint32_t& code) {
+        code = 0;
+
+        for (size_t i = 0; i < 4; i++, p++) {
+            if (p == end || HexValue(*p) < 0) {
+                return false;
+            }
+
+            code = code * 16 + HexValue(*p);
+        }
+
+        return true;
+    }
+
+    static bool ParseJsonString(const char*& p, const char* end, string& s) {
+        s.clear();
+
+        if (p == end || *p++ != '"') {
+            return false;
+        }
+
+        while (p < end && *p != '"') {
+            if (*p != '\\') {
+                s += *p++;
+                continue;
+            }
+
+            if (++p == end) {
+                return false;
+            }
+
+            const char c = *p++;
+            uint32_t code = 0;
+            string utf8;
+
+            switch (c) {
+            case '"':
+            case '\\':
+            case '/':
+                s += c;
+                continue;
+            case 'b':
+                s += '\b';
+                continue;
+            case 'f':
+                s += '\f';
+                continue;
+            case 'n':
+                s += '\n';
+                continue;
+            case 'r':
+                s += '\r';
+                continue;
+            case 't':
+                s += '\t';
+                continue;
+            case 'u':
+                if (!ParseHex4(p, end, code)) {
+                    return false;
+                }
+
+                // a surrogate pair
+                if (code >= 0xD800 && code < 0xDC00) {
+                    uint32_t low = 0;
+
+                    if (end - p < 6 || p[0] != '\\' || p[1] != 'u') {
+                        return false;
+                    }
+
+                    p += 2;
+
+                    if (!ParseHex4(p, end, low) || low < 0xDC00 || low >= 0xE000) {
+                        return false;
+                    }
+
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                }
+
+                limonp::Unicode32ToUtf8(&code, &code + 1, utf8);
+                s += utf8;
+                continue;
+            default:
+                return false;
+            }
+        }
+
+        return p++ < end;
+    }
+
+    // ["...", ...]
+    static bool ParseStringArray(const char* p, const char* end, vector<string>& strs) {
+        strs.clear();
+        SkipSpaces(p, end);
+
+        if (p == end || *p++ != '[') {
+            return false;
+        }
+
+        SkipSpaces(p, end);
+
+        if (p < end && *p == ']') {
+            p++;
+        } else {
+            for (;;) {
+                strs.emplace_back();
+
+                if (!ParseJsonString(p, end, strs.back())) {
+                    return false;
+                }
+
+                SkipSpaces(p, end);
+
+                if (p == end) {
+                    return false;
+                }
+
+                if (*p == ']') {
+                    p++;
+                    break;
+                }
+
+                if (*p++ != ',') {
+                    return false;
+                }
+
+                SkipSpaces(p, end);
+            }
+        }
+
+        SkipSpaces(p, end);
+        return p == end;
+    }
+
+    const Jieba* jieba_;
+    HttpServerOptions options_;
+    int port_;
+    std::atomic<bool> stop_;
+    vector<unique_ptr<Reactor> > reactors_;
+    vector<std::thread> threads_;
+}; // class HttpServer
+
+} // namespace cppjieba
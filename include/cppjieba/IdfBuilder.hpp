@@ -0,0 +1,353 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <unordered_map>
+#include <unordered_set>
+#include "MixSegment.hpp"
+#include "IdfTrie.hpp"
+#include "TaskScheduler.hpp"
+
+namespace cppjieba {
+
+struct IdfBuilderOptions {
+    size_t thread_num = 0;          // 0 for all the cores
+    size_t batch_lines = 1 << 16;   // documents read before they are counted in parallel
+    size_t top_k = 1 << 20;         // words missing in the dict trie that are kept
+    size_t sketch_width = 1 << 20;  // counters per row of the count-min sketch, rounded up to a power of 2
+    size_t sketch_depth = 4;
+    size_t min_df = 1;              // words found in fewer documents are not written
+    bool hmm = true;
+};
+
+/*
+ * Document frequencies of a corpus, one document per line, counted by the workers of a TaskScheduler into their own
+ * shards:
+ *   the words of the dict trie are counted exactly, in an array indexed by element id
+ *   the other words (HMM) go to a count-min sketch, and only the top_k of them by estimated frequency are kept
+ * so the memory does not depend on the size of the corpus. Write merges the shards into "word idf" lines,
+ * idf = log(documents / df), and builds the IdfTrie cache of the file that KeywordExtractor attaches.
+ * */
+class IdfBuilder {
+public:
+    IdfBuilder(const DictTrie* dictTrie, const HMMModel* model, const IdfBuilderOptions& options = IdfBuilderOptions())
+        : dictTrie_(dictTrie), segment_(dictTrie, model), options_(options), scheduler_(options.thread_num) {
+        options_.thread_num = scheduler_.GetThreadNum();
+        options_.batch_lines = std::max<size_t>(options_.batch_lines, 1);
+        options_.sketch_depth = std::max<size_t>(options_.sketch_depth, 1);
+        size_t width = 1;
+
+        while (width < options_.sketch_width) {
+            width <<= 1;
+        }
+
+        options_.sketch_width = width;
+
+        for (size_t i = 0; i < options_.thread_num; i++) {
+            shards_.emplace_back(dictTrie_->GetElementsNum(), options_);
+        }
+    }
+
+    ~IdfBuilder() = default;
+
+    IdfBuilder(const IdfBuilder &) = delete;
+    IdfBuilder &operator=(const IdfBuilder &) = delete;
+
+    // counts the documents of `is` until EOF, may be called once per file of the corpus
+    void Process(istream& is) {
+        vector<string> batch(options_.batch_lines);
+        size_t size = 0;
+        string line;
+
+        while (getline(is, line)) {
+            if (line.empty()) {
+                continue;
+            }
+
+            batch[size++].swap(line);
+
+            if (size == batch.size()) {
+                AddDocuments(batch, size);
+                size = 0;
+            }
+        }
+
+        AddDocuments(batch, size);
+    }
+
+    size_t GetDocumentsNum() const {
+        size_t num = 0;
+
+        for (const auto & shard : shards_) {
+            num += shard.docs;
+        }
+
+        return num;
+    }
+
+    // merged document frequencies of the words reaching min_df, sorted by word
+    void GetDocumentFrequencies(vector<pair<string, size_t> >& dfs) const {
+        dfs.clear();
+
+        vector<size_t> counts(dictTrie_->GetElementsNum(), 0);
+        vector<const string*> words(counts.size(), nullptr);
+
+        for (const auto & shard : shards_) {
+            for (size_t id = 0; id < counts.size(); id++) {
+                counts[id] += shard.counts[id];
+            }
+
+            for (const auto & kv : shard.words) {
+                words[kv.first] = &kv.second;
+            }
+        }
+
+        for (size_t id = 0; id < counts.size(); id++) {
+            if (counts[id] >= options_.min_df && counts[id] > 0) {
+                dfs.emplace_back(*words[id], counts[id]);
+            }
+        }
+
+        // the sketches share their hashes, their sum estimates the whole corpus
+        vector<uint32_t> sketch(options_.sketch_width * options_.sketch_depth, 0);
+
+        for (const auto & shard : shards_) {
+            for (size_t i = 0; i < sketch.size(); i++) {
+                sketch[i] += shard.sketch[i];
+            }
+        }
+
+        vector<pair<string, size_t> > others;
+
+        for (const auto & shard : shards_) {
+            for (const auto & kv : shard.candidates) {
+                others.emplace_back(kv.first, 0);
+            }
+        }
+
+        sort(others.begin(), others.end());
+        others.erase(unique(others.begin(), others.end()), others.end());
+
+        for (auto & other : others) {
+            other.second = Estimate(sketch, other.first);
+        }
+
+        KeepTop(others, options_.top_k);
+
+        for (const auto & other : others) {
+            if (other.second >= options_.min_df) {
+                dfs.push_back(other);
+            }
+        }
+
+        sort(dfs.begin(), dfs.end());
+    }
+
+    // writes the idf file, then builds its cache against the dict trie
+    Error Write(const string& idfPath) const {
+        const size_t docs = GetDocumentsNum();
+
+        if (docs == 0) {
+            XLOG(ERROR) << "no document";
+            return Error::ValueError;
+        }
+
+        vector<pair<string, size_t> > dfs;
+        GetDocumentFrequencies(dfs);
+
+        if (dfs.empty()) {
+            XLOG(ERROR) << "no word reaches min_df " << options_.min_df;
+            return Error::ValueError;
+        }
+
+        ofstream ofs(idfPath.c_str());
+
+        if (!ofs.is_open()) {
+            XLOG(ERROR) << "open " << idfPath << " failed";
+            return Error::OpenFileFailed;
+        }
+
+        ofs << std::setprecision(10);
+
+        for (const auto & df : dfs) {
+            ofs << df.first << ' ' << log((double)docs / (double)df.second) << '\n';
+        }
+
+        ofs.close();
+
+        if (!ofs) {
+            XLOG(ERROR) << "write " << idfPath << " failed";
+            return Error::FileOperationError;
+        }
+
+        IdfTrie idfTrie;
+        return idfTrie.Create(idfPath, dictTrie_);
+    }
+
+private:
+    enum : size_t { DOCUMENT_GRAIN = 64 }; // documents of a task
+
+    struct Shard {
+        Shard(size_t elementsNum, const IdfBuilderOptions& options)
+            : counts(elementsNum, 0), stamps(elementsNum, 0),
+              sketch(options.sketch_width * options.sketch_depth, 0) {
+        }
+
+        size_t docs = 0;
+        vector<uint32_t> counts;             // per element id
+        vector<uint32_t> stamps;             // last document an element was counted for, from 1
+        unordered_map<uint32_t, string> words; // element ids counted so far
+        vector<uint32_t> sketch;
+        unordered_map<string, size_t> candidates; // the words missing in the dict trie with the best estimates
+        size_t threshold = 0;                // estimate a new candidate needs once the candidates were pruned
+        unordered_set<string> others;        // the words missing in the dict trie of the current document
+    };
+
+    void AddDocuments(const vector<string>& docs, size_t size) {
+        scheduler_.ParallelFor(0, size, DOCUMENT_GRAIN, [&](size_t begin, size_t end, size_t worker) {
+            for (size_t i = begin; i < end; i++) {
+                AddDocument(shards_[worker], docs[i]);
+            }
+        });
+    }
+
+    void AddDocument(Shard& shard, const string& doc) const {
+        RuneStrArray runes;
+
+        if (!DecodeRunesInString(doc, runes)) {
+            return;
+        }
+
+        vector<WordRange> wrs;
+        segment_.CutToRanges(runes.begin(), runes.end(), wrs, options_.hmm);
+
+        const uint32_t stamp = ++shard.docs;
+        shard.others.clear();
+
+        for (const auto & wr : wrs) {
+            const char* word = doc.data() + wr.left->offset;
+            const size_t len = wr.right->offset + wr.right->len - wr.left->offset;
+
+            // the idf file is split by spaces
+            if (std::find_if(word, word + len, [](char c) {
+                return c == ' ' || c == '\t' || c == '\r';
+            }) != word + len) {
+                continue;
+            }
+
+            const DatMemElem* elem = wr.elem;
+
+            if (elem == nullptr) {
+                // hmm words, which may still be in the dictionary
+                elem = dictTrie_->Find(string(word, len));
+            }
+
+            if (elem == nullptr) {
+                shard.others.insert(string(word, len));
+                continue;
+            }
+
+            const uint32_t id = dictTrie_->GetElementIndex(elem);
+
+            if (shard.stamps[id] != stamp) {
+                shard.stamps[id] = stamp;
+
+                if (shard.counts[id]++ == 0) {
+                    shard.words.emplace(id, string(word, len));
+                }
+            }
+        }
+
+        for (const auto & word : shard.others) {
+            AddOther(shard, word);
+        }
+    }
+
+    // conservative update of the sketch, then of the candidates
+    void AddOther(Shard& shard, const string& word) const {
+        const size_t estimate = Increment(shard.sketch, word);
+        auto it = shard.candidates.find(word);
+
+        if (it != shard.candidates.end()) {
+            it->second = estimate;
+            return;
+        }
+
+        if (estimate <= shard.threshold) {
+            return;
+        }
+
+        shard.candidates.emplace(word, estimate);
+
+        if (shard.candidates.size() >= 2 * options_.top_k) {
+            vector<pair<string, size_t> > top(shard.candidates.begin(), shard.candidates.end());
+            KeepTop(top, options_.top_k);
+            shard.threshold = top.empty() ? 0 : top.back().second;
+            shard.candidates.clear();
+            shard.candidates.insert(top.begin(), top.end());
+        }
+    }
+
+    static void KeepTop(vector<pair<string, size_t> >& words, size_t k) {
+        auto greater = [](const pair<string, size_t>& lhs, const pair<string, size_t>& rhs) {
+            return lhs.second != rhs.second ? lhs.second > rhs.second : lhs.first < rhs.first;
+        };
+
+        if (words.size() > k) {
+            nth_element(words.begin(), words.begin() + k, words.end(), greater);
+            words.resize(k);
+        }
+
+        sort(words.begin(), words.end(), greater);
+    }
+
+    // the counters of `word`, one per row, by double hashing of FNV-1a
+    template <class Visit>
+    void ForEachCounter(const string& word, Visit visit) const {
+        uint64_t h = 0xCBF29CE484222325ULL;
+
+        for (unsigned char c : word) {
+            h = (h ^ c) * 0x100000001B3ULL;
+        }
+
+        const uint64_t h1 = h;
+        const uint64_t h2 = ((h >> 32) | (h << 32)) * 0x9E3779B97F4A7C15ULL | 1;
+        const size_t mask = options_.sketch_width - 1;
+
+        for (size_t row = 0; row < options_.sketch_depth; row++) {
+            visit(row * options_.sketch_width + ((h1 + row * h2) & mask));
+        }
+    }
+
+    size_t Increment(vector<uint32_t>& sketch, const string& word) const {
+        const size_t estimate = Estimate(sketch, word) + 1;
+
+        ForEachCounter(word, [&](size_t i) {
+            if (sketch[i] < estimate) {
+                sketch[i] = estimate;
+            }
+        });
+
+        return estimate;
+    }
+
+    size_t Estimate(const vector<uint32_t>& sketch, const string& word) const {
+        size_t estimate = SIZE_MAX;
+
+        ForEachCounter(word, [&](size_t i) {
+            estimate = std::min<size_t>(estimate, sketch[i]);
+        });
+
+        return estimate;
+    }
+
+    const DictTrie* dictTrie_;
+    MixSegment segment_;
+    IdfBuilderOptions options_;
+    vector<Shard> shards_;  // per worker
+    TaskScheduler scheduler_; // stopped before the shards are destroyed
+}; // class IdfBuilder
+
+} // namespace cppjieba
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <cmath>
+#include <limits>
+#include <map>
+#include "limonp/Md5.hpp"
+#include "limonp/StringUtil.hpp"
+#include "limonp/Logging.hpp"
+#include "DictTrie.hpp"
+#include "Error.hpp"
+
+namespace cppjieba {
+
+using namespace limonp;
+
+/*
+ * IDF dictionary as a mmap'ed DAT cache, <idf_path>.<md5>.idf_cache by default:
+ *   DatMemElem::weight  idf of every word of the file
+ *   column              idf of every element of the dict trie, NaN for the words missing in the file
+ *   mean weight         idf of the unknown words
+ * The words matched by the segmentation get their idf by element id, the other ones by a trie lookup.
+ * The md5 covers both the idf file and the dict trie, whose element ids the column depends on.
+ * */
+class IdfTrie {
+public:
+    IdfTrie() {}
+    ~IdfTrie() = default;
+
+    IdfTrie(const IdfTrie &) = delete;
+    IdfTrie &operator=(const IdfTrie &) = delete;
+
+    Error Create(const string& idf_path, const DictTrie* dict_trie, string cache_path = "") {
+        if (nullptr == dict_trie) {
+            XLOG(ERROR) << "Got NULL DictTrie pointer ";
+            return Error::ValueError;
+        }
+        dict_trie_ = dict_trie;
+
+        size_t file_size_sum = 0;
+        string idf_md5;
+        Error status = CalcFileListMD5({idf_path}, file_size_sum, idf_md5);
+        if (status != Error::Ok) {
+            return status;
+        }
+
+        string md5;
+        md5String((idf_md5 + dict_trie->GetMd5()).c_str(), md5);
+
+        if (cache_path.empty()) {
+            cache_path = idf_path + "." + md5 + ".idf_cache";
+        }
+
+        if (Error::Ok == dat_.InitAttachDat(cache_path, md5)) {
+            return Error::Ok;
+        }
+
+        vector<DatElement> elements;
+        double mean = 0;
+        status = LoadIdfDict(idf_path, elements, mean);
+        if (status != Error::Ok) {
+            return status;
+        }
+
+        vector<double> column(dict_trie->GetElementsNum(), std::numeric_limits<double>::quiet_NaN());
+
+        for (const auto & element : elements) {
+            const DatMemElem* elem = dict_trie->Find(element.word);
+
+            if (elem != nullptr) {
+                column[dict_trie->GetElementIndex(elem)] = element.weight;
+            }
+        }
+
+        dat_.SetMeanWeight(mean);
+        return dat_.InitBuildDat(elements, cache_path, md5, column);
+    }
+
+    // idf of `word`, `elem` being its entry in the dict trie if the segmentation matched it
+    double Find(const DatMemElem* elem, const string& word) const {
+        if (elem != nullptr && dat_.GetColumnSize() > 0) {
+            const double idf = dat_.GetColumn()[dict_trie_->GetElementIndex(elem)];
+            return std::isnan(idf) ? dat_.GetMeanWeight() : idf;
+        }
+
+        const DatMemElem* found = dat_.Find(word);
+        return found != nullptr ? found->weight : dat_.GetMeanWeight();
+    }
+
+    double GetMeanIdf() const {
+        return dat_.GetMeanWeight();
+    }
+
+private:
+    // "word idf" lines, the last one wins for a word; the mean is taken over all the lines like it always was
+    static Error LoadIdfDict(const string& idfPath, vector<DatElement>& elements, double& mean) {
+        ifstream ifs(idfPath.c_str());
+
+        if (!ifs.is_open()) {
+            XLOG(ERROR) << "open " << idfPath << " failed";
+            return Error::OpenFileFailed;
+        }
+
+        std::map<string, double> idfs;
+        string line;
+        vector<string> buf;
+        double idf = 0.0;
+        double idfSum = 0.0;
+        size_t lineno = 0;
+
+        for (; getline(ifs, line); lineno++) {
+            buf.clear();
+
+            if (line.empty()) {
+                XLOG(WARNING) << "lineno: " << lineno << " empty. skipped.";
+                continue;
+            }
+
+            Split(line, buf, " ");
+
+            if (buf.size() != 2 || buf[0].empty()) {
+                XLOG(ERROR) << "line: " << line << ", lineno: " << lineno << " bad format. skipped.";
+                continue;
+            }
+
+            idf = stod(buf[1], nullptr);
+            if (errno == ERANGE) {
+                XLOG(WARNING) << "failed to parse idf value from: " << lineno << ": " << buf[1];
+                return Error::ValueError;
+            }
+            idfs[buf[0]] = idf;
+            idfSum += idf;
+        }
+
+        if (lineno == 0) {
+            XLOG(ERROR) << "empty file.";
+            return Error::ValueError;
+        }
+
+        elements.reserve(idfs.size());
+
+        for (const auto & kv : idfs) {
+            elements.emplace_back();
+            elements.back().word = kv.first;
+            elements.back().weight = kv.second;
+        }
+
+        mean = idfSum / (double)lineno;
+        return Error::Ok;
+    }
+
+    const DictTrie* dict_trie_ = nullptr;
+    DatTrie dat_;
+}; // class IdfTrie
+
+} // namespace cppjieba
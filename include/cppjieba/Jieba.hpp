@@ -1,19 +1,59 @@
 #pragma once
 
+#include <algorithm>
 #include <memory>
+#include <mutex>
 #include "QuerySegment.hpp"
 #include "KeywordExtractor.hpp"
+#include "PosHMMSegment.hpp"
 
 namespace cppjieba {
 
 class Jieba {
 public:
+    /*
+     * The user dicts of one tenant (customer) over the dictionary and the model of a Jieba: an overlay of the dict
+     * trie sharing its layers, and the segments cutting with it, copies of the ones of the Jieba with the settings they
+     * had when the tenant was added. A tenant takes the memory of its own dicts, see AddTenant.
+     * */
+    class Tenant {
+    public:
+        Tenant(const Tenant&) = delete;
+        Tenant& operator=(const Tenant&) = delete;
+
+        const DictTrie* GetDictTrie() const {
+            return &dict_trie_;
+        }
+
+    private:
+        friend class Jieba;
+
+        explicit Tenant(const Jieba& jieba)
+            : dict_trie_(jieba.dict_trie_, DictTrie::ShareLayers), mp_seg_(jieba.mp_seg_), mix_seg_(jieba.mix_seg_),
+              full_seg_(jieba.full_seg_), query_seg_(jieba.query_seg_) {
+            mp_seg_.Create(&dict_trie_);
+            mix_seg_.Create(&dict_trie_, &jieba.model_);
+            full_seg_.Create(&dict_trie_);
+            query_seg_.Create(&dict_trie_, &jieba.model_);
+        }
+
+        DictTrie dict_trie_;
+        MPSegment mp_seg_;
+        MixSegment mix_seg_;
+        FullSegment full_seg_;
+        QuerySegment query_seg_;
+    }; // class Tenant
+
+    // valid until RemoveTenant, or the Jieba is destroyed
+    typedef const Tenant* TenantHandle;
+
     Jieba(const string& dict_path,
           const string& model_path,
           const string& user_dict_path,
           const string& idfPath = "",
           const string& stopWordPath = "",
-          const string& dat_cache_path = "")
+          const string& dat_cache_path = "",
+          const string& pos_model_dir = "")
         : dict_trie_(dict_path, user_dict_path, dat_cache_path),
           model_(model_path),
           mp_seg_(&dict_trie_),
@@ -21,7 +61,13 @@ public:
           mix_seg_(&dict_trie_, &model_),
           full_seg_(&dict_trie_),
           query_seg_(&dict_trie_, &model_),
-          extractor(&dict_trie_, &model_, idfPath, stopWordPath){ }
+          pos_hmm_seg_(&pos_model_),
+          extractor(&mix_seg_, idfPath, stopWordPath) {
+        // dict/pos_dict, only needed by TagHMM, which fails without it
+        if (!pos_model_dir.empty() && Error::Ok != pos_model_.Create(pos_model_dir)) {
+            XLOG(ERROR) << "POS HMM model of " << pos_model_dir << " not loaded, TagHMM will fail";
+        }
+    }
     ~Jieba() = default;
 
     void Cut(const string& sentence, vector<string>& words, bool hmm = true) const {
@@ -42,6 +88,10 @@ public:
     void CutForSearch(const string& sentence, vector<Word>& words, bool hmm = true) const {
         query_seg_.CutToWord(sentence, words, hmm);
     }
+    // see QuerySegment::SetMaxSubWordLength
+    void SetSearchGranularity(size_t max_sub_word_len) {
+        query_seg_.SetMaxSubWordLength(max_sub_word_len);
+    }
     void CutHMM(const string& sentence, vector<string>& words) const {
         hmm_seg_.CutToStr(sentence, words);
     }
@@ -58,6 +108,10 @@ public:
     void Tag(const string& sentence, vector<pair<string, string> >& words) const {
         mix_seg_.Tag(sentence, words);
     }
+    // joint segmentation and POS tagging with the HMM of pos_model_dir, see PosHMMSegment. False without the model
+    bool TagHMM(const string& sentence, vector<pair<string, string> >& words) const {
+        return pos_hmm_seg_.Tag(sentence, words);
+    }
     string LookupTag(const string &str) const {
         return mix_seg_.LookupTag(str);
     }
@@ -72,6 +126,91 @@ public:
         mix_seg_.ResetSeparators(s);
         full_seg_.ResetSeparators(s);
         query_seg_.ResetSeparators(s);
+        pos_hmm_seg_.ResetSeparators(s);
+    }
+
+    // numeric type of the MP dynamic programming and HMM Viterbi scores, see ScoreTraits.hpp
+    void SetScoreType(ScoreType type) {
+        mp_seg_.SetScoreType(type);
+        hmm_seg_.SetScoreType(type);
+        mix_seg_.SetScoreType(type);
+        query_seg_.SetScoreType(type);
+    }
+
+    // prefaults, moves to huge pages or locks the DAT of the dictionary, before the first cut, see DatTrie::Remap
+    Error SetDictMapOptions(const DatMapOptions& options) {
+        return dict_trie_.SetMapOptions(options);
+    }
+
+    // cuts `sentences` and drops the words, so that the parts of the dictionary and the models they reach are in
+    // memory, the page tables and the caches before the first request
+    void WarmUp(const vector<string>& sentences) const {
+        vector<Word> words;
+
+        for (const auto & sentence : sentences) {
+            mix_seg_.CutToWord(sentence, words, true);
+            query_seg_.CutToWord(sentence, words, true);
+        }
+    }
+
+    /*
+     * Adds a tenant cutting with the user dicts `user_dict_paths` (separated by ';' or '|') on top of the ones of the
+     * Jieba, nullptr if one of them cannot be loaded. Their caches are named as the ones of DictTrie::Create. Other
+     * threads may keep cutting meanwhile, with the Jieba or the other tenants.
+     * */
+    TenantHandle AddTenant(const string& user_dict_paths, const string& dat_cache_path = "") {
+        std::unique_ptr<Tenant> tenant(new Tenant(*this));
+
+        if (Error::Ok != tenant->dict_trie_.AddUserDicts(user_dict_paths, dat_cache_path)) {
+            return nullptr;
+        }
+
+        std::lock_guard<std::mutex> lock(tenants_mutex_);
+        tenants_.push_back(std::move(tenant));
+        return tenants_.back().get();
+    }
+
+    // no thread may be cutting with `tenant` any more
+    void RemoveTenant(TenantHandle tenant) {
+        std::lock_guard<std::mutex> lock(tenants_mutex_);
+        auto it = std::find_if(tenants_.begin(), tenants_.end(), [tenant](const std::unique_ptr<Tenant>& t) {
+            return t.get() == tenant;
+        });
+
+        if (it != tenants_.end()) {
+            tenants_.erase(it);
+        }
+    }
+
+    size_t GetTenantNum() const {
+        std::lock_guard<std::mutex> lock(tenants_mutex_);
+        return tenants_.size();
+    }
+
+    // as the ones without a tenant, with the user dicts of `tenant` too
+    void Cut(TenantHandle tenant, const string& sentence, vector<string>& words, bool hmm = true) const {
+        tenant->mix_seg_.CutToStr(sentence, words, hmm);
+    }
+    void Cut(TenantHandle tenant, const string& sentence, vector<Word>& words, bool hmm = true) const {
+        tenant->mix_seg_.CutToWord(sentence, words, hmm);
+    }
+    void CutAll(TenantHandle tenant, const string& sentence, vector<string>& words) const {
+        tenant->full_seg_.CutToStr(sentence, words);
+    }
+    void CutAll(TenantHandle tenant, const string& sentence, vector<Word>& words) const {
+        tenant->full_seg_.CutToWord(sentence, words);
+    }
+    void CutForSearch(TenantHandle tenant, const string& sentence, vector<string>& words, bool hmm = true) const {
+        tenant->query_seg_.CutToStr(sentence, words, hmm);
+    }
+    void CutForSearch(TenantHandle tenant, const string& sentence, vector<Word>& words, bool hmm = true) const {
+        tenant->query_seg_.CutToWord(sentence, words, hmm);
+    }
+    void CutSmall(TenantHandle tenant, const string& sentence, vector<string>& words, size_t max_word_len) const {
+        tenant->mp_seg_.CutToStr(sentence, words, false, max_word_len);
+    }
+    void Tag(TenantHandle tenant, const string& sentence, vector<pair<string, string> >& words) const {
+        tenant->mix_seg_.Tag(sentence, words);
     }
 
     const DictTrie* GetDictTrie() const {
@@ -82,9 +221,28 @@ public:
         return &model_;
     }
 
+    // the segment of Cut, which the extractors can share
+    const MixSegment* GetMixSegment() const {
+        return &mix_seg_;
+    }
+
+    // the segments of CutHMM, CutAll and CutForSearch, to cut into WordRanges with SegmentBase::CutToRanges
+    const HMMSegment* GetHMMSegment() const {
+        return &hmm_seg_;
+    }
+
+    const FullSegment* GetFullSegment() const {
+        return &full_seg_;
+    }
+
+    const QuerySegment* GetQuerySegment() const {
+        return &query_seg_;
+    }
+
 private:
     DictTrie dict_trie_;
     HMMModel model_;
+    PosHMMModel pos_model_;
 
     // They share the same dict trie and model
     MPSegment mp_seg_;
@@ -92,6 +250,10 @@ private:
     MixSegment mix_seg_;
     FullSegment full_seg_;
     QuerySegment query_seg_;
+    PosHMMSegment pos_hmm_seg_;
+
+    vector<std::unique_ptr<Tenant> > tenants_;
+    mutable std::mutex tenants_mutex_;
 
 public:
     KeywordExtractor extractor;
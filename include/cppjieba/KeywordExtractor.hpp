@@ -1,8 +1,14 @@
 #pragma once
 
 #include <cmath>
+#include <memory>
+#include <mutex>
 #include <set>
+#include <thread>
 #include "MixSegment.hpp"
+#include "IdfTrie.hpp"
+#include "StopWords.hpp"
+#include "TaskScheduler.hpp"
 
 namespace cppjieba {
 
@@ -21,27 +27,62 @@ public:
     KeywordExtractor(const DictTrie* dictTrie,
                      const HMMModel* model,
                      const string& idfPath,
-                     const string& stopWordPath)
-        : segment_(dictTrie, model) {
-        LoadIdfDict(idfPath);
-        LoadStopWordDict(stopWordPath);
+                     const string& stopWordPath) {
+        Create(dictTrie, model, idfPath, stopWordPath);
+    }
+
+    // shares `segment`, e.g. the one of Jieba, which must outlive the extractor
+    KeywordExtractor(const MixSegment* segment,
+                     const string& idfPath,
+                     const string& stopWordPath) {
+        Create(segment, idfPath, stopWordPath);
+    }
+
+    // shares `segment` and `stopWords` too, which must have been created with the dict trie of `segment`
+    KeywordExtractor(const MixSegment* segment,
+                     const string& idfPath,
+                     const StopWords* stopWords) {
+        Create(segment, idfPath, stopWords);
     }
 
     Error Create(const DictTrie* dictTrie,
                  const HMMModel* model,
                  const string& idfPath,
                  const string& stopWordPath) {
-        this->segment_.Create(dictTrie, model);
-        auto status = LoadIdfDict(idfPath);
+        ownSegment_.reset(new MixSegment(dictTrie, model));
+        return Create(ownSegment_.get(), idfPath, stopWordPath);
+    }
+
+    Error Create(const MixSegment* segment,
+                 const string& idfPath,
+                 const string& stopWordPath) {
+        if (nullptr == segment) {
+            XLOG(ERROR) << "Got NULL MixSegment pointer ";
+            return Error::ValueError;
+        }
+        auto status = ownStopWords_.Create(stopWordPath, segment->GetDictTrie());
         if (Error::Ok != status) {
-            XLOG(ERROR) << "failed to load IDF dict";
+            XLOG(ERROR) << "failed to load stop words dict";
             return status;
         }
-        status = LoadStopWordDict(stopWordPath);
+        return Create(segment, idfPath, &ownStopWords_);
+    }
+
+    Error Create(const MixSegment* segment,
+                 const string& idfPath,
+                 const StopWords* stopWords) {
+        if (nullptr == segment || nullptr == stopWords) {
+            XLOG(ERROR) << "Got NULL MixSegment or StopWords pointer ";
+            return Error::ValueError;
+        }
+        this->segment_ = segment;
+        auto status = idfTrie_.Create(idfPath, segment->GetDictTrie());
         if (Error::Ok != status) {
-            XLOG(ERROR) << "failed to load stop words dict";
+            XLOG(ERROR) << "failed to load IDF dict";
             return status;
         }
+        this->stopWords_ = stopWords;
+        return Error::Ok;
     }
 
     ~KeywordExtractor() = default;
@@ -65,124 +106,388 @@ public:
     }
 
     void Extract(const string& sentence, vector<Word>& keywords, size_t topN) const {
-        vector<string> words;
-        segment_.CutToStr(sentence, words);
+        Workspace ws;
+        Extract(sentence, ws, keywords, topN, nullptr);
+    }
 
-        map<string, Word> wordmap;
-        size_t offset = 0;
+    // `words` cut from the runes of `sentence` by a segment sharing the dict trie, their dict entries are reused
+    void Extract(const string& sentence, const vector<WordRange>& words, vector<Word>& keywords, size_t topN) const {
+        Workspace ws;
+        ToSpans(words, ws.spans);
+        ExtractSpans(sentence, ws, keywords, topN, nullptr);
+    }
 
-        for (auto & word : words) {
-            size_t t = offset;
-            offset += word.size();
+    // `words` already cut from `sentence`, e.g. by Jieba::Cut when indexing it
+    void Extract(const string& sentence, const vector<cppjieba::Word>& words, vector<Word>& keywords,
+                 size_t topN) const {
+        Workspace ws;
+        ws.spans.reserve(words.size());
+
+        for (const auto & word : words) {
+            if (word.offset + word.word.size() > sentence.size()) {
+                XLOG(ERROR) << "word " << word.word << " out of the sentence";
+                keywords.clear();
+                return;
+            }
 
-            if (IsSingleWord(word) || stopWords_.find(word) != stopWords_.end()) {
-                continue;
+            if (word.unicode_length > 1) {
+                ws.spans.push_back({word.offset, (uint32_t)word.word.size(), nullptr});
+            }
+        }
+
+        ExtractSpans(sentence, ws, keywords, topN, nullptr);
+    }
+
+    /*
+     * Keywords of every document into out[i], extracted on threadNum threads (0 for all the cores) which take chunks of
+     * documents and reuse their buffers from one document to the next. If `corpus` is not null, it gets the topN words
+     * of the whole batch by the sum of their weights over the documents. The threads are the ones of a scheduler the
+     * extractor keeps for the next batches, until one asks for another number of threads.
+     * */
+    void ExtractBatch(const vector<string>& docs, size_t topN, vector<vector<Word> >& out,
+                      vector<pair<string, double> >* corpus = nullptr, size_t threadNum = 0) const {
+        const std::shared_ptr<TaskScheduler> scheduler = GetScheduler(threadNum);
+        ExtractBatch(*scheduler, docs, topN, out, corpus);
+    }
+
+    // same as above on the workers of `scheduler`, which the batches of a server or a tool may share
+    void ExtractBatch(TaskScheduler& scheduler, const vector<string>& docs, size_t topN, vector<vector<Word> >& out,
+                      vector<pair<string, double> >* corpus = nullptr) const {
+        out.clear();
+        out.resize(docs.size());
+
+        vector<Workspace> workspaces(scheduler.GetThreadNum());
+        vector<CorpusScores> scores(corpus != nullptr ? scheduler.GetThreadNum() : 0);
+
+        scheduler.ParallelFor(0, docs.size(), BATCH_GRAIN, [&](size_t begin, size_t end, size_t worker) {
+            for (size_t i = begin; i < end; i++) {
+                Extract(docs[i], workspaces[worker], out[i], topN, corpus != nullptr ? &scores[worker] : nullptr);
+            }
+        });
+
+        if (corpus != nullptr) {
+            MergeCorpusScores(scores, topN, *corpus);
+        }
+    }
+
+private:
+    enum : uint32_t { NONE = UINT32_MAX };
+    enum : size_t { BATCH_GRAIN = 64 }; // documents of a task of ExtractBatch
+
+    // bytes of a word of the sentence, `elem` being its dict entry if the segment matched it
+    struct Span {
+        uint32_t offset;
+        uint32_t len;
+        const DatMemElem* elem;
+    };
+
+    // a distinct word of the sentence, the first occurrence gives its bytes
+    struct Candidate {
+        const DatMemElem* elem = nullptr; // nullptr for the words missing in the dictionary
+        uint32_t offset = 0;
+        uint32_t len = 0;
+        uint32_t first = NONE;
+        uint32_t last = NONE;
+        uint32_t count = 0;
+        double weight = 0;
+    };
+
+    // open addressing over candidate indexes, sized for at most `n` words by Reset
+    class CandidateTable {
+    public:
+        void Reset(size_t n) {
+            size_t capacity = 16;
+
+            while (capacity < 2 * n) {
+                capacity <<= 1;
             }
 
-            wordmap[word].offsets.push_back(t);
-            wordmap[word].weight += 1.0;
+            slots_.assign(capacity, Slot());
         }
 
-        if (offset != sentence.size()) {
-            XLOG(ERROR) << "words illegal";
+        // index of the candidate with `hash` matching `equal`, or a NONE slot to store a new one into
+        template <class Equal>
+        uint32_t& Find(size_t hash, Equal equal, const vector<Candidate>& candidates) {
+            const size_t mask = slots_.size() - 1;
+
+            for (size_t i = hash & mask;; i = (i + 1) & mask) {
+                Slot& slot = slots_[i];
+
+                if (slot.index == NONE) {
+                    slot.hash = hash;
+                    return slot.index;
+                }
+
+                if (slot.hash == hash && equal(candidates[slot.index])) {
+                    return slot.index;
+                }
+            }
+        }
+
+    private:
+        struct Slot {
+            size_t hash = 0;
+            uint32_t index = NONE;
+        };
+
+        vector<Slot> slots_;
+    }; // class CandidateTable
+
+    // the buffers of an extraction, kept by ExtractBatch from one document to the next
+    struct Workspace {
+        RuneStrArray runes;
+        vector<WordRange> wrs;
+        vector<Span> spans;
+        vector<Candidate> candidates;
+        vector<uint32_t> nextSame; // next occurrence of the same word
+        CandidateTable table;
+        vector<uint32_t> heap;
+    };
+
+    // summed weights of the words of a batch, by element id for the words of the dictionary
+    struct CorpusScores {
+        unordered_map<size_t, pair<string, double> > elems;
+        unordered_map<string, double> others;
+    };
+
+    static void ToSpans(const vector<WordRange>& words, vector<Span>& spans) {
+        spans.clear();
+        spans.reserve(words.size());
+
+        for (const auto & wr : words) {
+            // single chars are no keywords
+            if (wr.left != wr.right) {
+                spans.push_back({wr.left->offset, wr.right->offset + wr.right->len - wr.left->offset, wr.elem});
+            }
+        }
+    }
+
+    void Extract(const string& sentence, Workspace& ws, vector<Word>& keywords, size_t topN,
+                 CorpusScores* scores) const {
+        keywords.clear();
+
+        if (nullptr == segment_) {
+            XLOG(ERROR) << "extractor not created";
+            return;
+        }
+
+        if (!DecodeRunesInString(sentence, ws.runes)) {
+            XLOG_RATE(ERROR, 10) << "decode failed. " << sentence;
             return;
         }
 
+        ws.wrs.clear();
+        segment_->CutToRanges(ws.runes.begin(), ws.runes.end(), ws.wrs);
+        ToSpans(ws.wrs, ws.spans);
+        ExtractSpans(sentence, ws, keywords, topN, scores);
+    }
+
+    void ExtractSpans(const string& sentence, Workspace& ws, vector<Word>& keywords, size_t topN,
+                      CorpusScores* scores) const {
         keywords.clear();
-        keywords.reserve(wordmap.size());
 
-        for (auto & itr : wordmap) {
-            auto cit = idfMap_.find(itr.first);
+        if (nullptr == segment_ || nullptr == stopWords_) {
+            XLOG(ERROR) << "extractor not created";
+            return;
+        }
+
+        const vector<Span>& spans = ws.spans;
+        vector<Candidate>& candidates = ws.candidates;
+        vector<uint32_t>& nextSame = ws.nextSame;
+        candidates.clear();
+        nextSame.assign(spans.size(), NONE);
+        ws.table.Reset(spans.size());
+        const DictTrie* dictTrie = segment_->GetDictTrie();
+
+        for (uint32_t i = 0; i < spans.size(); i++) {
+            const char* word = sentence.data() + spans[i].offset;
+            const size_t len = spans[i].len;
+            const DatMemElem* elem = spans[i].elem;
+
+            if (elem == nullptr) {
+                // hmm words, which may still be in the dictionary
+                const string str(word, len);
+                elem = dictTrie->Find(str);
+
+                if (elem == nullptr && stopWords_->IsStopWord(str)) {
+                    continue;
+                }
+            }
+
+            if (elem != nullptr && stopWords_->IsStopWord(elem)) {
+                continue;
+            }
 
-            if (cit != idfMap_.end()) {
-                itr.second.weight *= cit->second;
+            uint32_t& slot = elem != nullptr
+                             ? ws.table.Find(HashId(dictTrie->GetElementIndex(elem)), [&](const Candidate & c) {
+                                 return c.elem == elem;
+                             }, candidates)
+                             : ws.table.Find(HashBytes(word, len), [&](const Candidate & c) {
+                                 return c.elem == nullptr && c.len == len && 0 == memcmp(sentence.data() + c.offset, word, len);
+                             }, candidates);
+
+            if (slot == NONE) {
+                slot = candidates.size();
+                candidates.emplace_back();
+                Candidate& c = candidates.back();
+                c.elem = elem;
+                c.offset = spans[i].offset;
+                c.len = len;
+                c.first = i;
             } else {
-                itr.second.weight *= idfAverage_;
+                nextSame[candidates[slot].last] = i;
             }
 
-            itr.second.word = itr.first;
-            keywords.push_back(itr.second);
+            candidates[slot].last = i;
+            candidates[slot].count++;
         }
 
-        topN = min(topN, keywords.size());
-        partial_sort(keywords.begin(), keywords.begin() + topN, keywords.end(), Compare);
-        keywords.resize(topN);
-    }
-private:
-    Error LoadIdfDict(const string& idfPath) {
-        ifstream ifs(idfPath.c_str());
+        for (auto & c : candidates) {
+            c.weight = c.count * idfTrie_.Find(c.elem, c.elem != nullptr ? string() : sentence.substr(c.offset, c.len));
+        }
 
-        if (!ifs.is_open()){
-            XLOG(ERROR) << "open " << idfPath << " failed";
-            return Error::OpenFileFailed;
+        if (scores != nullptr) {
+            AddCorpusScores(sentence, candidates, *scores);
         }
 
-        string line ;
-        vector<string> buf;
-        double idf = 0.0;
-        double idfSum = 0.0;
-        size_t lineno = 0;
+        // bounded heap of the best topN, the worst on top
+        auto better = [&](uint32_t lhs, uint32_t rhs) {
+            return Better(candidates[lhs], candidates[rhs], sentence);
+        };
+        vector<uint32_t>& heap = ws.heap;
+        heap.clear();
+
+        for (uint32_t i = 0; i < candidates.size() && topN > 0; i++) {
+            if (heap.size() < topN) {
+                heap.push_back(i);
+                push_heap(heap.begin(), heap.end(), better);
+            } else if (better(i, heap.front())) {
+                pop_heap(heap.begin(), heap.end(), better);
+                heap.back() = i;
+                push_heap(heap.begin(), heap.end(), better);
+            }
+        }
 
-        for (; getline(ifs, line); lineno++) {
-            buf.clear();
+        sort_heap(heap.begin(), heap.end(), better);
+        keywords.resize(heap.size());
 
-            if (line.empty()) {
-                XLOG(WARNING) << "lineno: " << lineno << " empty. skipped.";
-                continue;
+        for (size_t k = 0; k < heap.size(); k++) {
+            const Candidate& c = candidates[heap[k]];
+            keywords[k].word = sentence.substr(c.offset, c.len);
+            keywords[k].weight = c.weight;
+
+            for (uint32_t i = c.first; i != NONE; i = nextSame[i]) {
+                keywords[k].offsets.push_back(spans[i].offset);
             }
+        }
+    }
 
-            Split(line, buf, " ");
+    void AddCorpusScores(const string& sentence, const vector<Candidate>& candidates, CorpusScores& scores) const {
+        const DictTrie* dictTrie = segment_->GetDictTrie();
 
-            if (buf.size() != 2) {
-                XLOG(ERROR) << "line: " << line << ", lineno: " << lineno << " bad format. skipped.";
-                continue;
+        for (const auto & c : candidates) {
+            if (c.elem != nullptr) {
+                auto it = scores.elems.find(dictTrie->GetElementIndex(c.elem));
+
+                if (it == scores.elems.end()) {
+                    scores.elems.emplace(dictTrie->GetElementIndex(c.elem), make_pair(sentence.substr(c.offset, c.len), c.weight));
+                } else {
+                    it->second.second += c.weight;
+                }
+            } else {
+                scores.others[sentence.substr(c.offset, c.len)] += c.weight;
             }
+        }
+    }
+
+    // the words of the dictionary and the other ones do not overlap, the latter being missing in it
+    static void MergeCorpusScores(vector<CorpusScores>& scores, size_t topN, vector<pair<string, double> >& corpus) {
+        corpus.clear();
 
-            idf = stod(buf[1], nullptr);
-            if (errno == ERANGE) {
-                XLOG(WARNING) << "failed to parse idf value from: " << lineno << ": " << buf[1];
-                return Error::ValueError;
+        if (scores.empty()) {
+            return;
+        }
+
+        for (size_t t = 1; t < scores.size(); t++) {
+            for (auto & kv : scores[t].elems) {
+                auto it = scores[0].elems.find(kv.first);
+
+                if (it == scores[0].elems.end()) {
+                    scores[0].elems.insert(std::move(kv));
+                } else {
+                    it->second.second += kv.second.second;
+                }
+            }
+
+            for (auto & kv : scores[t].others) {
+                scores[0].others[kv.first] += kv.second;
             }
-            idfMap_[buf[0]] = idf;
-            idfSum += idf;
         }
 
-        if (lineno == 0) {
-            XLOG(ERROR) << "empty file.";
-            return Error::ValueError;
+        for (auto & kv : scores[0].elems) {
+            corpus.push_back(std::move(kv.second));
         }
-        idfAverage_ = idfSum / (double)lineno;
-        return Error::Ok;
+
+        for (auto & kv : scores[0].others) {
+            corpus.emplace_back(kv.first, kv.second);
+        }
+
+        auto better = [](const pair<string, double>& lhs, const pair<string, double>& rhs) {
+            return lhs.second != rhs.second ? lhs.second > rhs.second : lhs.first < rhs.first;
+        };
+        topN = min(topN, corpus.size());
+        partial_sort(corpus.begin(), corpus.begin() + topN, corpus.end(), better);
+        corpus.resize(topN);
     }
 
-    Error LoadStopWordDict(const string& filePath) {
-        ifstream ifs(filePath.c_str());
-        if(not ifs.is_open()){
-            XLOG(ERROR) << "open " << filePath << " failed";
-            return Error::OpenFileFailed;
+    static size_t HashId(size_t id) {
+        return (id + 1) * 0x9E3779B97F4A7C15ULL;
+    }
+
+    // FNV-1a
+    static size_t HashBytes(const char* s, size_t len) {
+        uint64_t h = 0xCBF29CE484222325ULL;
+
+        for (size_t i = 0; i < len; i++) {
+            h = (h ^ (unsigned char)s[i]) * 0x100000001B3ULL;
         }
 
-        string line ;
-        while (getline(ifs, line)) {
-            stopWords_.insert(line);
+        return h;
+    }
+
+    // replaced when a batch asks for another number of threads, the batches running on the former one keep it
+    std::shared_ptr<TaskScheduler> GetScheduler(size_t threadNum) const {
+        if (threadNum == 0) {
+            threadNum = std::max(1u, std::thread::hardware_concurrency());
         }
 
-        if (stopWords_.empty()) {
-            XLOG(ERROR) << "empty file";
-            return Error::ValueError;
+        std::lock_guard<std::mutex> lock(schedulerMutex_);
+
+        if (!scheduler_ || scheduler_->GetThreadNum() != threadNum) {
+            scheduler_ = std::make_shared<TaskScheduler>(threadNum);
         }
-        return Error::Ok;
-    }
 
-    static bool Compare(const Word& lhs, const Word& rhs) {
-        return lhs.weight > rhs.weight;
+        return scheduler_;
     }
 
-    MixSegment segment_;
-    unordered_map<string, double> idfMap_;
-    double idfAverage_;
+    // higher weight first, then the word bytes, so that the order does not depend on the table
+    static bool Better(const Candidate& lhs, const Candidate& rhs, const string& sentence) {
+        if (lhs.weight != rhs.weight) {
+            return lhs.weight > rhs.weight;
+        }
+
+        const int cmp = memcmp(sentence.data() + lhs.offset, sentence.data() + rhs.offset, min(lhs.len, rhs.len));
+        return cmp != 0 ? cmp < 0 : lhs.len < rhs.len;
+    }
 
-    unordered_set<string> stopWords_;
+    unique_ptr<MixSegment> ownSegment_;
+    const MixSegment* segment_ = nullptr;
+    IdfTrie idfTrie_;
+    StopWords ownStopWords_;
+    const StopWords* stopWords_ = nullptr;
+    // of ExtractBatch
+    mutable std::shared_ptr<TaskScheduler> scheduler_;
+    mutable std::mutex schedulerMutex_;
 }; // class KeywordExtractor
 
 inline ostream& operator << (ostream& os, const KeywordExtractor::Word& word) {
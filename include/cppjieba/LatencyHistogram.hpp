@@ -0,0 +1,121 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace cppjieba {
+
+/*
+ * HDR-style histogram of latencies in nanoseconds: log-linear buckets of 64 sub-buckets each, so that any value up to
+ * 2^63 is recorded in constant time and memory with a relative error below 1/64. Open-loop callers record the latency
+ * from the time a request was scheduled, not sent, so that a stall is counted against every request it delayed
+ * (coordinated omission).
+ * */
+class LatencyHistogram {
+public:
+    LatencyHistogram()
+        : counts_(BucketIndex(UINT64_MAX) + 1, 0) {
+    }
+
+    void Record(uint64_t value) {
+        counts_[BucketIndex(value)]++;
+        count_++;
+        sum_ += value;
+        min_ = std::min(min_, value);
+        max_ = std::max(max_, value);
+    }
+
+    void Merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < counts_.size(); i++) {
+            counts_[i] += other.counts_[i];
+        }
+
+        count_ += other.count_;
+        sum_ += other.sum_;
+        min_ = std::min(min_, other.min_);
+        max_ = std::max(max_, other.max_);
+    }
+
+    void Reset() {
+        std::fill(counts_.begin(), counts_.end(), 0);
+        count_ = 0;
+        sum_ = 0;
+        min_ = UINT64_MAX;
+        max_ = 0;
+    }
+
+    uint64_t GetCount() const {
+        return count_;
+    }
+
+    uint64_t GetMin() const {
+        return count_ == 0 ? 0 : min_;
+    }
+
+    uint64_t GetMax() const {
+        return max_;
+    }
+
+    double GetMean() const {
+        return count_ == 0 ? 0 : (double)sum_ / count_;
+    }
+
+    // the highest value equivalent to the one at `percentile` (0-100), as HdrHistogram reports it
+    uint64_t GetValueAtPercentile(double percentile) const {
+        if (count_ == 0) {
+            return 0;
+        }
+
+        const double rank = std::ceil(std::min(std::max(percentile, 0.0), 100.0) / 100 * count_);
+        const uint64_t target = std::max<uint64_t>(1, (uint64_t)rank);
+        uint64_t seen = 0;
+
+        for (size_t i = 0; i < counts_.size(); i++) {
+            seen += counts_[i];
+
+            if (seen >= target) {
+                return std::min(HighestEquivalentValue(i), max_);
+            }
+        }
+
+        return max_;
+    }
+
+private:
+    enum { SUB_BITS = 7, HALF = 1 << (SUB_BITS - 1) };
+
+    static size_t BucketIndex(uint64_t value) {
+        if (value < (1u << SUB_BITS)) {
+            return value;
+        }
+
+        size_t msb = 63;
+
+        while (!(value >> msb)) {
+            msb--;
+        }
+
+        const size_t shift = msb - SUB_BITS + 1;
+        return shift * HALF + (value >> shift);
+    }
+
+    static uint64_t HighestEquivalentValue(size_t index) {
+        if (index < (1u << SUB_BITS)) {
+            return index;
+        }
+
+        const size_t shift = index / HALF - 1;
+        const uint64_t low = (uint64_t)(index - shift * HALF) << shift;
+        return low + ((uint64_t)1 << shift) - 1;
+    }
+
+    std::vector<uint64_t> counts_;
+    uint64_t count_ = 0;
+    uint64_t sum_ = 0;
+    uint64_t min_ = UINT64_MAX;
+    uint64_t max_ = 0;
+}; // class LatencyHistogram
+
+} // namespace cppjieba
@@ -7,6 +7,7 @@
 #include "DictTrie.hpp"
 #include "SegmentTagged.hpp"
 #include "PosTagger.hpp"
+#include "ScoreTraits.hpp"
 #include "Error.hpp"
 
 namespace cppjieba {
@@ -34,9 +35,66 @@ public:
              vector<WordRange>& words,
              bool, size_t max_word_len) const override {
         vector<DatDag> dags;
+        CutWithDag(begin, end, words, max_word_len, dags);
+    }
+
+    // Same as Cut, but hands the DAG back so the caller can reuse its edges
+    void CutWithDag(RuneStrArray::const_iterator begin,
+                    RuneStrArray::const_iterator end,
+                    vector<WordRange>& words,
+                    size_t max_word_len,
+                    vector<DatDag>& dags) const {
+        BuildDag(begin, end, dags, max_word_len);
+        CutByDag(begin, end, dags, words);
+    }
+
+    // DAG of the dictionary matches, with DatDag::max_next pointing along the best path
+    void BuildDag(RuneStrArray::const_iterator begin,
+                  RuneStrArray::const_iterator end,
+                  vector<DatDag>& dags,
+                  size_t max_word_len = MAX_WORD_LENGTH) const {
         dictTrie_->Find(begin, end, dags, max_word_len);
         CalcDP(dags);
-        CutByDag(begin, end, dags, words);
+    }
+
+    /*
+     * Left-to-right variant of Cut for long unpunctuated input: emit(const WordRange&) is called for every word
+     * as soon as a commit point is reached, i.e. a position that no dictionary word crosses.
+     * Every path of the DAG goes through a commit point, and CalcDP solves the pieces between them
+     * independently, so the words are the ones of Cut.
+     * */
+    template <class Emit>
+    void CutStream(RuneStrArray::const_iterator begin,
+                   RuneStrArray::const_iterator end,
+                   Emit emit,
+                   size_t max_word_len = MAX_WORD_LENGTH) const {
+        const string text = EncodeRunesToString(begin, end);
+        vector<DatDag> dags; // rows since the last commit point
+        RuneStrArray::const_iterator chunk = begin;
+        size_t reach = 0;
+        size_t begin_pos = 0;
+
+        for (auto rune = begin; rune != end; ++rune) {
+            dags.resize(dags.size() + 1);
+            DatDag& dag = dags.back();
+            dictTrie_->Find(&text[begin_pos], text.size() - begin_pos, dags.size() - 1, dag, max_word_len);
+            begin_pos += limonp::UnicodeToUtf8Bytes(rune->rune);
+            reach = std::max(reach, dag.nexts[dag.nexts.size() - 1].first);
+
+            if (reach > dags.size()) {
+                continue;
+            }
+
+            CalcDP(dags);
+
+            for (size_t i = 0; i < dags.size(); i = dags[i].max_next) {
+                emit(WordRange(chunk + i, chunk + dags[i].max_next - 1, dags[i].max_elem));
+            }
+
+            chunk = rune + 1;
+            dags.clear();
+            reach = 0;
+        }
     }
 
     const DictTrie* GetDictTrie() const override {
@@ -47,33 +105,108 @@ public:
         return tagger_.Tag(src, res, *this);
     }
 
+    void SetScoreType(ScoreType type) {
+        scoreType_ = type;
+    }
+
     bool IsUserDictSingleChineseWord(const Rune& value) const {
         return dictTrie_->IsUserDictSingleChineseWord(value);
     }
 private:
     void CalcDP(vector<DatDag>& dags) const {
-        for (auto rit = dags.rbegin(); rit != dags.rend(); rit++) {
-            rit->max_next = -1;
-            rit->max_weight = MIN_DOUBLE;
+        // no path can skip a commit point, so the pieces between them are solved independently
+        size_t from = 0, reach = 0;
+
+        for (size_t i = 0; i < dags.size(); i++) {
+            reach = std::max(reach, dags[i].nexts[dags[i].nexts.size() - 1].first);
 
-            for (const auto & it : rit->nexts) {
+            if (reach <= i + 1) {
+                CalcDP(dags, from, i + 1);
+                from = i + 1;
+            }
+        }
+    }
+
+    void CalcDP(vector<DatDag>& dags, size_t from, size_t to) const {
+        // a reduced precision DP whose path goes through a near tie is decided again in double
+        switch (scoreType_) {
+            case ScoreFloat:
+                if (CalcDP<float>(dags, from, to)) {
+                    return;
+                }
+                break;
+
+            case ScoreFixed32:
+                if (CalcDP<int32_t>(dags, from, to)) {
+                    return;
+                }
+                break;
+
+            default:
+                break;
+        }
+
+        CalcDP<double>(dags, from, to);
+    }
+
+    // dags[from, to), no word crossing `to`. Returns false if the best path goes through a near tie, see ScoreTraits
+    template <typename Score>
+    bool CalcDP(vector<DatDag>& dags, size_t from, size_t to) const {
+        typedef ScoreTraits<Score> Traits;
+        const Score min_weight = Traits::FromLogProb(dictTrie_->GetMinWeight());
+        // max_weights[i - from]: best score of dags[i, to), the slot of `to` stays 0
+        vector<Score> max_weights(to - from + 1, Score(0));
+        vector<uint8_t> near_tie(Traits::CHECK_TIES ? to - from : 0);
+
+        for (size_t i = to; i-- > from;) {
+            DatDag& dag = dags[i];
+            Score max_weight = Traits::Min();
+            Score second = Traits::Min();
+            dag.max_next = -1;
+            dag.max_elem = nullptr;
+
+            for (const auto & it : dag.nexts) {
                 const auto nextPos = it.first;
-                double val = dictTrie_->GetMinWeight();
+
+                if (nextPos > to) {
+                    continue;
+                }
+
+                Score val = min_weight;
 
                 if (nullptr != it.second) {
-                    val = it.second->weight;
+                    val = Traits::FromLogProb(it.second->weight);
                 }
 
-                if (nextPos  < dags.size()) {
-                    val += dags[nextPos].max_weight;
+                val = Traits::Add(val, max_weights[nextPos - from]);
+
+                if (val > max_weight) {
+                    second = max_weight;
+                    max_weight = val;
+                    dag.max_next = nextPos;
+                    dag.max_elem = it.second;
+                } else if (val > second) {
+                    second = val;
                 }
+            }
+
+            max_weights[i - from] = max_weight;
 
-                if ((nextPos <= dags.size()) && (val > rit->max_weight)) {
-                    rit->max_weight = val;
-                    rit->max_next = nextPos;
+            if (Traits::CHECK_TIES) {
+                // a word of a rune at least, and the weights are <= 0: the sum bounds its terms and partial sums
+                near_tie[i - from] = Traits::IsNearTie(max_weight, second, to - i, -double(max_weight));
+            }
+        }
+
+        if (Traits::CHECK_TIES) {
+            for (size_t i = from; i < to; i = dags[i].max_next) {
+                if (near_tie[i - from]) {
+                    return false;
                 }
             }
         }
+
+        return true;
     }
 
     void CutByDag(RuneStrArray::const_iterator begin,
@@ -85,14 +218,14 @@ private:
             const auto next = dags[i].max_next;
             assert(next > i);
             assert(next <= dags.size());
-            WordRange wr(begin + i, begin + next - 1);
-            words.push_back(wr);
+            words.push_back(WordRange(begin + i, begin + next - 1, dags[i].max_elem));
             i = next;
         }
     }
 
     const DictTrie* dictTrie_;
     PosTagger tagger_;
+    ScoreType scoreType_ = ScoreDouble;
 
 }; // class MPSegment
 
@@ -29,53 +29,96 @@ public:
 
     ~MixSegment() override = default;
 
+    void SetScoreType(ScoreType type) {
+        mpSeg_.SetScoreType(type);
+        hmmSeg_.SetScoreType(type);
+    }
+
     virtual void Cut(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end, vector<WordRange>& res, bool hmm,
                      size_t) const override {
+        vector<DatDag> dags;
+        CutWithDag(begin, end, res, hmm, dags);
+    }
+
+    // Same as Cut, but hands the DAG of the MP pass back to the caller
+    void CutWithDag(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end, vector<WordRange>& res,
+                    bool hmm, vector<DatDag>& dags) const {
         if (!hmm) {
-            mpSeg_.CutRuneArray(begin, end, res);
+            mpSeg_.CutWithDag(begin, end, res, MAX_WORD_LENGTH, dags);
             return;
         }
 
-        vector<WordRange> words;
         assert(end >= begin);
-        words.reserve(end - begin);
-        mpSeg_.CutRuneArray(begin, end, words);
+        mpSeg_.BuildDag(begin, end, dags);
 
-        vector<WordRange> hmmRes;
-        hmmRes.reserve(end - begin);
+        // walk the best path of the DP, cutting the runs of single runes with hmm on the fly
+        for (size_t i = 0; i < dags.size();) {
+            const size_t next = dags[i].max_next;
+            assert(next > i);
 
-        for (size_t i = 0; i < words.size(); i++) {
             //if mp Get a word, it's ok, put it into result
-            if (words[i].left != words[i].right || (words[i].left == words[i].right &&
-                                                    mpSeg_.IsUserDictSingleChineseWord(words[i].left->rune))) {
-                res.push_back(words[i]);
+            if (next - i > 1 || mpSeg_.IsUserDictSingleChineseWord((begin + i)->rune)) {
+                res.push_back(WordRange(begin + i, begin + next - 1, dags[i].max_elem));
+                i = next;
                 continue;
             }
 
             // if mp Get a single one and it is not in userdict, collect it in sequence
-            size_t j = i;
+            size_t j = i + 1;
 
-            while (j < words.size() && words[j].left == words[j].right &&
-                   !mpSeg_.IsUserDictSingleChineseWord(words[j].left->rune)) {
+            while (j < dags.size() && size_t(dags[j].max_next) == j + 1 &&
+                   !mpSeg_.IsUserDictSingleChineseWord((begin + j)->rune)) {
                 j++;
             }
 
-            // Cut the sequence with hmm
-            assert(j - 1 >= i);
-            // TODO
-            hmmSeg_.CutRuneArray(words[i].left, words[j - 1].left + 1, hmmRes);
+            // Cut the sequence with hmm, straight into the result
+            hmmSeg_.CutRuneArray(begin + i, begin + j, res);
+
+            //let i jump over this piece
+            i = j;
+        }
+    }
 
-            //put hmm result to result
-            for (size_t k = 0; k < hmmRes.size(); k++) {
-                res.push_back(hmmRes[k]);
+    // Incremental variant of Cut, see MPSegment::CutStream. A run of single runes is held back until it ends.
+    template <class Emit>
+    void CutStream(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end, Emit emit,
+                   bool hmm = true) const {
+        if (!hmm) {
+            mpSeg_.CutStream(begin, end, emit);
+            return;
+        }
+
+        RuneStrArray::const_iterator run = end; // first rune of the pending run, end if none
+        vector<WordRange> hmmRes;
+
+        auto flush = [&](RuneStrArray::const_iterator stop) {
+            if (run == end) {
+                return;
             }
 
-            //clear tmp vars
             hmmRes.clear();
+            hmmSeg_.CutRuneArray(run, stop, hmmRes);
 
-            //let i jump over this piece
-            i = j - 1;
-        }
+            for (const auto & wr : hmmRes) {
+                emit(wr);
+            }
+
+            run = end;
+        };
+
+        mpSeg_.CutStream(begin, end, [&](const WordRange & wr) {
+            if (wr.left == wr.right && !mpSeg_.IsUserDictSingleChineseWord(wr.left->rune)) {
+                if (run == end) {
+                    run = wr.left;
+                }
+
+                return;
+            }
+
+            flush(wr.left);
+            emit(wr);
+        });
+        flush(end);
     }
 
     const DictTrie* GetDictTrie() const override {
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <memory>
+#include <thread>
+#include "Jieba.hpp"
+#include "NumaTopology.hpp"
+#include "TaskScheduler.hpp"
+
+namespace cppjieba {
+
+/*
+ * Copies of the read-only model of a Jieba, one per NUMA node: the DAT and the element array of the dictionary, the
+ * HMM tables, and the segments cutting with them. Each copy is made by a thread pinned to its node, so that the first
+ * touch places its pages there and the trie probes of the workers of the node stay local. The segments keep the
+ * settings (separators, score type, search granularity) the ones of the Jieba had when the replicas were made. On a
+ * machine of one node there is nothing to copy, the segments are the ones of the Jieba.
+ *
+ *   NumaTopology topology;
+ *   NumaReplicas replicas(&jieba, topology);
+ *   TaskScheduler scheduler(topology);
+ *   replicas.CutBatch(scheduler, docs, words); // each worker cuts with the replica of its node
+ * */
+class NumaReplicas {
+public:
+    struct Segments {
+        const MixSegment* mix;
+        const HMMSegment* hmm;
+        const FullSegment* full;
+        const QuerySegment* query;
+    };
+
+    NumaReplicas(const Jieba* jieba, const NumaTopology& topology = NumaTopology())
+        : topology_(topology) {
+        Create(jieba);
+    }
+
+    ~NumaReplicas() = default;
+
+    NumaReplicas(const NumaReplicas &) = delete;
+    NumaReplicas &operator=(const NumaReplicas &) = delete;
+
+    Error Create(const Jieba* jieba) {
+        if (nullptr == jieba) {
+            XLOG(ERROR) << "Got NULL Jieba pointer ";
+            return Error::ValueError;
+        }
+
+        replicas_.clear();
+        segments_.assign(topology_.GetNodeNum(), Segments());
+
+        if (topology_.GetNodeNum() == 1) {
+            segments_[0] = {jieba->GetMixSegment(), jieba->GetHMMSegment(), jieba->GetFullSegment(),
+                            jieba->GetQuerySegment()
+                           };
+            return Error::Ok;
+        }
+
+        replicas_.resize(topology_.GetNodeNum());
+        vector<std::thread> threads;
+
+        for (size_t node = 0; node < replicas_.size(); node++) {
+            threads.emplace_back([this, jieba, node]() {
+                topology_.PinCurrentThread(node);
+                replicas_[node].reset(new Replica(*jieba));
+            });
+        }
+
+        for (auto & thread : threads) {
+            thread.join();
+        }
+
+        for (size_t node = 0; node < replicas_.size(); node++) {
+            if (replicas_[node]->dictTrie.GetElementsNum() == 0) {
+                XLOG(ERROR) << "copy of the dict trie for node " << node << " failed";
+                replicas_.clear();
+                segments_.clear();
+                return Error::MmapError;
+            }
+
+            Replica& replica = *replicas_[node];
+            segments_[node] = {&replica.mixSeg, &replica.hmmSeg, &replica.fullSeg, &replica.querySeg};
+        }
+
+        return Error::Ok;
+    }
+
+    size_t GetNodeNum() const {
+        return segments_.size();
+    }
+
+    const Segments& GetSegments(size_t node) const {
+        return segments_[node % segments_.size()];
+    }
+
+    // the segments of the node the calling thread runs on, for threads not pinned by a TaskScheduler
+    const Segments& GetLocalSegments() const {
+        return GetSegments(topology_.GetCurrentNode());
+    }
+
+    const NumaTopology& GetTopology() const {
+        return topology_;
+    }
+
+    /*
+     * Jieba::Cut of each of `docs` into `words`, on the workers of `scheduler`. The workers of a scheduler made with a
+     * topology cut with the replica of the node they are pinned to, the other ones with the replica of the node they
+     * happen to run on.
+     * */
+    void CutBatch(TaskScheduler& scheduler, const vector<string>& docs, vector<vector<Word> >& words,
+                  bool hmm = true) const {
+        words.resize(docs.size());
+
+        scheduler.ParallelFor(0, docs.size(), BATCH_GRAIN, [&](size_t begin, size_t end, size_t worker) {
+            const size_t node = scheduler.GetWorkerNode(worker);
+            const MixSegment* segment = (node == NumaTopology::ANY_NODE ? GetLocalSegments() : GetSegments(node)).mix;
+
+            for (size_t i = begin; i < end; i++) {
+                segment->CutToWord(docs[i], words[i], hmm);
+            }
+        });
+    }
+
+private:
+    enum : size_t { BATCH_GRAIN = 16 };
+
+    // the segments are copied with their settings, then pointed at the copies of the dictionary and the model
+    struct Replica {
+        explicit Replica(const Jieba& jieba)
+            : dictTrie(*jieba.GetDictTrie()), model(*jieba.GetHMMModel()), mixSeg(*jieba.GetMixSegment()),
+              hmmSeg(*jieba.GetHMMSegment()), fullSeg(*jieba.GetFullSegment()), querySeg(*jieba.GetQuerySegment()) {
+            mixSeg.Create(&dictTrie, &model);
+            hmmSeg.Create(&model);
+            fullSeg.Create(&dictTrie);
+            querySeg.Create(&dictTrie, &model);
+        }
+
+        DictTrie dictTrie;
+        HMMModel model;
+        MixSegment mixSeg;
+        HMMSegment hmmSeg;
+        FullSegment fullSeg;
+        QuerySegment querySeg;
+    };
+
+    NumaTopology topology_;
+    vector<std::unique_ptr<Replica> > replicas_;
+    vector<Segments> segments_;
+}; // class NumaReplicas
+
+} // namespace cppjieba
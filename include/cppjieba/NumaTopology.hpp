@@ -0,0 +1,182 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace cppjieba {
+
+/*
+ * The NUMA nodes of the machine and their CPUs, read from /sys/devices/system/node so that no libnuma is needed. Where
+ * there is no such directory (not Linux, a container hiding it), the machine is one node of all the cores.
+ * */
+class NumaTopology {
+public:
+    enum : size_t { ANY_NODE = SIZE_MAX };
+
+    NumaTopology() {
+        Detect();
+    }
+
+    // `nodeCpus[n]` the CPUs of node n, for tests and for restricting to some nodes
+    explicit NumaTopology(const std::vector<std::vector<int> >& nodeCpus)
+        : nodeCpus_(nodeCpus) {
+        if (nodeCpus_.empty()) {
+            Detect();
+        }
+
+        IndexCpus();
+    }
+
+    size_t GetNodeNum() const {
+        return nodeCpus_.size();
+    }
+
+    const std::vector<int>& GetNodeCpus(size_t node) const {
+        return nodeCpus_[node];
+    }
+
+    // node of `cpu`, 0 for the CPUs not found
+    size_t GetCpuNode(int cpu) const {
+        return cpu >= 0 && (size_t)cpu < cpuNode_.size() && cpuNode_[cpu] != ANY_NODE ? cpuNode_[cpu] : 0;
+    }
+
+    // node of the CPU the calling thread runs on right now
+    size_t GetCurrentNode() const {
+#ifdef __linux__
+        return GetCpuNode(sched_getcpu());
+#else
+        return 0;
+#endif
+    }
+
+    // restricts the calling thread to the CPUs of `node`, so that the memory it touches first is allocated there
+    bool PinCurrentThread(size_t node) const {
+#ifdef __linux__
+        if (node >= nodeCpus_.size()) {
+            return false;
+        }
+
+        cpu_set_t set;
+        CPU_ZERO(&set);
+
+        for (int cpu : nodeCpus_[node]) {
+            if (cpu < CPU_SETSIZE) {
+                CPU_SET(cpu, &set);
+            }
+        }
+
+        return 0 == pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+        return false;
+#endif
+    }
+
+    // "0-3,8,10-11" of sysfs
+    static std::vector<int> ParseCpuList(const std::string& list) {
+        std::vector<int> cpus;
+        size_t pos = 0;
+
+        while (pos < list.size()) {
+            size_t end = list.find(',', pos);
+
+            if (end == std::string::npos) {
+                end = list.size();
+            }
+
+            int first = 0;
+            int last = 0;
+            const int n = sscanf(list.substr(pos, end - pos).c_str(), "%d-%d", &first, &last);
+
+            if (n >= 1 && first >= 0) {
+                for (int cpu = first; cpu <= (n == 2 ? last : first); cpu++) {
+                    cpus.push_back(cpu);
+                }
+            }
+
+            pos = end + 1;
+        }
+
+        return cpus;
+    }
+
+private:
+    static bool ReadLine(const std::string& path, std::string& line) {
+        FILE* f = fopen(path.c_str(), "r");
+
+        if (f == nullptr) {
+            return false;
+        }
+
+        char buf[4096];
+        const bool ok = fgets(buf, sizeof(buf), f) != nullptr;
+        fclose(f);
+        line = ok ? buf : "";
+
+        while (!line.empty() && (line.back() == '\n' || line.back() == ' ')) {
+            line.pop_back();
+        }
+
+        return ok;
+    }
+
+    void Detect() {
+        nodeCpus_.clear();
+        std::string line;
+
+        if (ReadLine("/sys/devices/system/node/online", line)) {
+            for (int node : ParseCpuList(line)) {
+                std::string list;
+
+                if (!ReadLine("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist", list)) {
+                    continue;
+                }
+
+                // nodes of memory only have no CPU to run a worker on
+                std::vector<int> cpus = ParseCpuList(list);
+
+                if (!cpus.empty()) {
+                    nodeCpus_.push_back(cpus);
+                }
+            }
+        }
+
+        if (nodeCpus_.empty()) {
+            nodeCpus_.resize(1);
+
+            for (unsigned cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); cpu++) {
+                nodeCpus_[0].push_back(cpu);
+            }
+        }
+
+        IndexCpus();
+    }
+
+    void IndexCpus() {
+        cpuNode_.clear();
+
+        for (size_t node = 0; node < nodeCpus_.size(); node++) {
+            for (int cpu : nodeCpus_[node]) {
+                if (cpu >= 0) {
+                    if ((size_t)cpu >= cpuNode_.size()) {
+                        cpuNode_.resize(cpu + 1, ANY_NODE);
+                    }
+
+                    cpuNode_[cpu] = node;
+                }
+            }
+        }
+    }
+
+    std::vector<std::vector<int> > nodeCpus_;
+    std::vector<size_t> cpuNode_;
+}; // class NumaTopology
+
+} // namespace cppjieba
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <sys/resource.h>
+
+namespace cppjieba {
+
+// page faults of the process so far, subtract two of them for the faults of a phase (load, warm-up, serving)
+struct PageFaults {
+    PageFaults()
+        : minor(0), major(0) {
+    }
+
+    PageFaults(uint64_t minorFaults, uint64_t majorFaults)
+        : minor(minorFaults), major(majorFaults) {
+    }
+
+    static PageFaults OfProcess() {
+        struct rusage usage;
+
+        if (0 != getrusage(RUSAGE_SELF, &usage)) {
+            return PageFaults();
+        }
+
+        return PageFaults(usage.ru_minflt, usage.ru_majflt);
+    }
+
+    PageFaults operator - (const PageFaults& other) const {
+        return PageFaults(minor - other.minor, major - other.major);
+    }
+
+    uint64_t minor; // no I/O, e.g. the first touch of a page of the page cache or of anonymous memory
+    uint64_t major; // read from the disk
+}; // struct PageFaults
+
+} // namespace cppjieba
@@ -0,0 +1,524 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <map>
+
+#include "limonp/StringUtil.hpp"
+#include "limonp/Logging.hpp"
+#include "Unicode.hpp"
+#include "DictTrie.hpp"
+#include "CacheLock.hpp"
+#include "Error.hpp"
+
+namespace cppjieba {
+
+using namespace limonp;
+
+/*
+ * State of the joint segmentation and POS tagging HMM: position of the char in its word (B/E/M/S) and the tag of the word,
+ * e.g. "B,ns" for the first char of a place name.
+ * */
+struct PosState {
+    char bmes = 0;
+    char tag[7] = {};
+
+    string GetTag() const {
+        return &tag[0];
+    }
+};
+
+/*
+ * Emit probs of a char: emits_[offset, offset + count).
+ * The first tab_count ones are its candidate states in char_state_tab,
+ * if the char is missing there (tab_count is 0) every state is a candidate.
+ * */
+struct PosCharStates {
+    Rune rune = 0;
+    uint32_t offset = 0;
+    uint32_t count = 0;
+    uint32_t tab_count = 0;
+
+    bool operator < (const PosCharStates & b) const {
+        return rune < b.rune;
+    }
+};
+
+struct PosEmitProb {
+    double prob = 0;
+    uint32_t state = 0;
+    uint32_t reserved = 0;
+};
+
+struct PosCacheFileHeader {
+    char md5_hex[32] = {};
+    uint32_t state_num = 0;
+    uint32_t char_num = 0;
+    uint32_t emit_num = 0;
+    uint32_t reserved = 0;
+};
+
+static_assert(sizeof(PosState) == 8, "PosState length invalid");
+static_assert(sizeof(PosCharStates) == 16, "PosCharStates length invalid");
+static_assert(sizeof(PosEmitProb) == 16, "PosEmitProb length invalid");
+static_assert(sizeof(PosCacheFileHeader) == 48, "PosCacheFileHeader length invalid");
+
+/*
+ * Model of dict/pos_dict: prob_start.utf8, prob_trans.utf8, prob_emit.utf8 and char_state_tab.utf8.
+ *
+ * The text files are compiled once into a binary cache which is mmap'ed afterwards, in the same way as the dat cache:
+ *   PosCacheFileHeader
+ *   PosState       states[state_num]               sorted by name, so the state id order is the name order
+ *   double         start[state_num]
+ *   double         trans[state_num * state_num]    dense, -inf where there is no transition
+ *   PosCharStates  chars[char_num]                 sorted by rune
+ *   PosEmitProb    emits[emit_num]                 the states of char_state_tab first, in the order of the file
+ * */
+class PosHMMModel {
+public:
+    PosHMMModel() {}
+
+    explicit PosHMMModel(const string& model_dir, const string& cache_path = "") {
+        Create(model_dir, cache_path);
+    }
+
+    ~PosHMMModel() {
+        Release();
+    }
+
+    PosHMMModel(const PosHMMModel &) = delete;
+    PosHMMModel &operator=(const PosHMMModel &) = delete;
+
+    Error Create(const string& model_dir, string cache_path = "") {
+        Release();
+
+        const vector<string> files = {
+            model_dir + "/prob_start.utf8",
+            model_dir + "/prob_trans.utf8",
+            model_dir + "/prob_emit.utf8",
+            model_dir + "/char_state_tab.utf8",
+        };
+
+        size_t file_size_sum = 0;
+        string md5;
+        Error status = CalcFileListMD5(files, file_size_sum, md5);
+        if (status != Error::Ok) {
+            return status;
+        }
+
+        if (cache_path.empty()) {
+            cache_path = model_dir + "/pos_model." + md5 + ".pos_cache";
+        }
+
+        if (Error::Ok == Attach(cache_path, md5)) {
+            return Error::Ok;
+        }
+
+        Release();
+        // one process builds a missing cache while the others wait for it, as DictTrie does
+        CacheLock lock(cache_path);
+
+        if (lock.Lock() && Error::Ok == Attach(cache_path, md5)) {
+            return Error::Ok;
+        }
+
+        Release();
+        lock.RemoveStaleTempFiles();
+        status = BuildCache(files, cache_path, md5);
+        if (status != Error::Ok) {
+            XLOG(ERROR) << "create POS HMM model failed. Model dir: " << model_dir;
+            return status;
+        }
+
+        return Attach(cache_path, md5);
+    }
+
+    bool Empty() const {
+        return 0 == state_num_;
+    }
+
+    size_t StateNum() const {
+        return state_num_;
+    }
+
+    const PosState& GetState(size_t state) const {
+        return states_[state];
+    }
+
+    double GetStartProb(size_t state) const {
+        return start_[state];
+    }
+
+    // -inf if `to` never follows `from`
+    double GetTransProb(size_t from, size_t to) const {
+        return trans_[from * state_num_ + to];
+    }
+
+    // states with a transition from `state`
+    const vector<uint16_t>& GetNextStates(size_t state) const {
+        return next_states_[state];
+    }
+
+    // nullptr if the char is unknown to the model
+    const PosCharStates* GetCharStates(Rune rune) const {
+        PosCharStates key;
+        key.rune = rune;
+        const PosCharStates* it = std::lower_bound(chars_, chars_ + char_num_, key);
+
+        if (it == chars_ + char_num_ || it->rune != rune) {
+            return nullptr;
+        }
+
+        return it;
+    }
+
+    const PosEmitProb* GetEmitProbs(const PosCharStates& cs) const {
+        return emits_ + cs.offset;
+    }
+
+private:
+    Error Attach(const string& cache_path, const string& md5) {
+        mmap_fd_ = ::open(cache_path.c_str(), O_RDONLY);
+
+        if (mmap_fd_ < 0) {
+            return Error::OpenFileFailed;
+        }
+
+        mmap_length_ = ::lseek(mmap_fd_, 0, SEEK_END);
+        if (mmap_length_ < sizeof(PosCacheFileHeader)) {
+            return Error::FileOperationError;
+        }
+
+        mmap_addr_ = reinterpret_cast<char *>(mmap(nullptr, mmap_length_, PROT_READ, MAP_SHARED, mmap_fd_, 0));
+        if (MAP_FAILED == mmap_addr_) {
+            mmap_addr_ = nullptr;
+            return Error::MmapError;
+        }
+
+        const PosCacheFileHeader & header = *reinterpret_cast<const PosCacheFileHeader*>(mmap_addr_);
+        assert(sizeof(header.md5_hex) == md5.size());
+
+        if (0 != memcmp(&header.md5_hex[0], md5.c_str(), md5.size())) {
+            XLOG(ERROR) << "MD5 checksum failed for file: " << cache_path;
+            return Error::ValueError;
+        }
+
+        const size_t n = header.state_num;
+        if (mmap_length_ != sizeof(header) + n * (sizeof(PosState) + sizeof(double)) + n * n * sizeof(double)
+                + header.char_num * sizeof(PosCharStates) + header.emit_num * sizeof(PosEmitProb)) {
+            XLOG(ERROR) << "mmap length check failed. ";
+            return Error::ValueError;
+        }
+
+        const char * ptr = mmap_addr_ + sizeof(header);
+        states_ = reinterpret_cast<const PosState *>(ptr);
+        ptr += n * sizeof(PosState);
+        start_ = reinterpret_cast<const double *>(ptr);
+        ptr += n * sizeof(double);
+        trans_ = reinterpret_cast<const double *>(ptr);
+        ptr += n * n * sizeof(double);
+        chars_ = reinterpret_cast<const PosCharStates *>(ptr);
+        ptr += header.char_num * sizeof(PosCharStates);
+        emits_ = reinterpret_cast<const PosEmitProb *>(ptr);
+
+        state_num_ = n;
+        char_num_ = header.char_num;
+        next_states_.assign(n, vector<uint16_t>());
+
+        for (size_t from = 0; from < n; from++) {
+            for (size_t to = 0; to < n; to++) {
+                if (!std::isinf(GetTransProb(from, to))) {
+                    next_states_[from].push_back(to);
+                }
+            }
+        }
+
+        return Error::Ok;
+    }
+
+    void Release() {
+        if (mmap_addr_ != nullptr) {
+            ::munmap(mmap_addr_, mmap_length_);
+        }
+
+        if (mmap_fd_ >= 0) {
+            ::close(mmap_fd_);
+        }
+
+        mmap_addr_ = nullptr;
+        mmap_length_ = 0;
+        mmap_fd_ = -1;
+        state_num_ = 0;
+        char_num_ = 0;
+        next_states_.clear();
+    }
+
+    static bool GetLine(ifstream& ifile, string& line) {
+        while (getline(ifile, line)) {
+            Trim(line);
+
+            if (line.empty() || StartsWith(line, "#")) {
+                continue;
+            }
+
+            return true;
+        }
+
+        return false;
+    }
+
+    static bool ParseProb(const string& s, double& prob) {
+        char * end = nullptr;
+        prob = strtod(s.c_str(), &end);
+        return !s.empty() && end == s.c_str() + s.size();
+    }
+
+    static bool ParseRune(const string& s, Rune& rune) {
+        RuneArray runes;
+
+        if (!DecodeRunesInString(s, runes) || runes.size() != 1) {
+            return false;
+        }
+
+        rune = runes[0];
+        return true;
+    }
+
+    Error BuildCache(const vector<string>& files, const string& cache_path, const string& md5) {
+        vector<PosState> states;
+        std::map<string, uint32_t> state_ids;
+        vector<double> start;
+        string line;
+        vector<string> buf;
+
+        // prob_start: "B,a:-4.76"
+        {
+            vector<pair<string, double> > start_probs;
+            ifstream ifs(files[0].c_str());
+            if (!ifs.is_open()) {
+                XLOG(ERROR) << "open " << files[0] << " failed";
+                return Error::OpenFileFailed;
+            }
+
+            while (GetLine(ifs, line)) {
+                const size_t colon = line.rfind(':');
+                double prob = 0;
+
+                if (colon == string::npos || !ParseProb(line.substr(colon + 1), prob)) {
+                    XLOG(ERROR) << "parse line failed: " << line;
+                    return Error::ValueError;
+                }
+
+                start_probs.push_back(make_pair(line.substr(0, colon), prob));
+            }
+
+            std::sort(start_probs.begin(), start_probs.end());
+
+            for (auto & kv : start_probs) {
+                Split(kv.first, buf, ",");
+
+                if (buf.size() != 2 || buf[0].size() != 1 || buf[1].size() >= sizeof(PosState::tag)
+                        || string("BEMS").find(buf[0][0]) == string::npos) {
+                    XLOG(ERROR) << "illegal state: " << kv.first;
+                    return Error::ValueError;
+                }
+
+                if (!state_ids.insert(make_pair(kv.first, uint32_t(states.size()))).second) {
+                    XLOG(ERROR) << "state " << kv.first << " already exists";
+                    return Error::ValueError;
+                }
+
+                states.emplace_back();
+                states.back().bmes = buf[0][0];
+                strncpy(&states.back().tag[0], buf[1].c_str(), sizeof(PosState::tag) - 1);
+                start.push_back(kv.second);
+            }
+
+            if (states.empty() || states.size() > UINT16_MAX) {
+                XLOG(ERROR) << "illegal state number " << states.size() << " in " << files[0];
+                return Error::ValueError;
+            }
+        }
+
+        const size_t n = states.size();
+        auto find_state = [&state_ids](const string & name, uint32_t & id) {
+            auto it = state_ids.find(name);
+
+            if (it == state_ids.end()) {
+                XLOG(ERROR) << "unknown state: " << name;
+                return false;
+            }
+
+            id = it->second;
+            return true;
+        };
+
+        // prob_trans: "B,ad:E,ad:-0.0007"
+        vector<double> trans(n * n, -std::numeric_limits<double>::infinity());
+        {
+            ifstream ifs(files[1].c_str());
+            if (!ifs.is_open()) {
+                XLOG(ERROR) << "open " << files[1] << " failed";
+                return Error::OpenFileFailed;
+            }
+
+            while (GetLine(ifs, line)) {
+                Split(line, buf, ":");
+                uint32_t from = 0, to = 0;
+                double prob = 0;
+
+                if (buf.size() != 3 || !ParseProb(buf[2], prob)) {
+                    XLOG(ERROR) << "parse line failed: " << line;
+                    return Error::ValueError;
+                }
+
+                if (!find_state(buf[0], from) || !find_state(buf[1], to)) {
+                    return Error::ValueError;
+                }
+
+                trans[from * n + to] = prob;
+            }
+        }
+
+        // char_state_tab: "耀:E,v;M,nr;"  prob_emit: "B,ad:突,-2.70;肃,-10.27;"
+        std::map<Rune, vector<PosEmitProb> > char_emits;
+        std::map<Rune, uint32_t> tab_count;
+        {
+            ifstream ifs(files[3].c_str());
+            if (!ifs.is_open()) {
+                XLOG(ERROR) << "open " << files[3] << " failed";
+                return Error::OpenFileFailed;
+            }
+
+            while (GetLine(ifs, line)) {
+                const size_t colon = line.find(':');
+                Rune rune = 0;
+
+                if (colon == string::npos || !ParseRune(line.substr(0, colon), rune)) {
+                    XLOG(ERROR) << "parse line failed: " << line;
+                    return Error::ValueError;
+                }
+
+                Split(line.substr(colon + 1), buf, ";");
+                vector<PosEmitProb> & emits = char_emits[rune];
+
+                for (auto & name : buf) {
+                    if (name.empty()) {
+                        continue;
+                    }
+
+                    emits.emplace_back();
+                    // the state never emitted the char in the training data
+                    emits.back().prob = MIN_DOUBLE;
+
+                    if (!find_state(name, emits.back().state)) {
+                        return Error::ValueError;
+                    }
+                }
+
+                tab_count[rune] = emits.size();
+            }
+        }
+        {
+            ifstream ifs(files[2].c_str());
+            if (!ifs.is_open()) {
+                XLOG(ERROR) << "open " << files[2] << " failed";
+                return Error::OpenFileFailed;
+            }
+
+            while (GetLine(ifs, line)) {
+                const size_t colon = line.find(':');
+                uint32_t state = 0;
+
+                if (colon == string::npos || !find_state(line.substr(0, colon), state)) {
+                    XLOG(ERROR) << "parse line failed: " << line.substr(0, 64);
+                    return Error::ValueError;
+                }
+
+                Split(line.substr(colon + 1), buf, ";");
+
+                for (auto & s : buf) {
+                    if (s.empty()) {
+                        continue;
+                    }
+
+                    const size_t comma = s.rfind(',');
+                    Rune rune = 0;
+                    double prob = 0;
+
+                    if (comma == string::npos || !ParseRune(s.substr(0, comma), rune) || !ParseProb(s.substr(comma + 1), prob)) {
+                        XLOG(ERROR) << "illegal emit prob: " << s;
+                        return Error::ValueError;
+                    }
+
+                    vector<PosEmitProb> & emits = char_emits[rune];
+                    auto it = emits.begin();
+
+                    while (it != emits.end() && it->state != state) {
+                        ++it;
+                    }
+
+                    if (it == emits.end()) {
+                        emits.emplace_back();
+                        emits.back().state = state;
+                        it = emits.end() - 1;
+                    }
+
+                    it->prob = prob;
+                }
+            }
+        }
+
+        vector<PosCharStates> chars;
+        vector<PosEmitProb> emits;
+        chars.reserve(char_emits.size());
+
+        for (auto & kv : char_emits) {
+            chars.emplace_back();
+            chars.back().rune = kv.first;
+            chars.back().offset = emits.size();
+            chars.back().count = kv.second.size();
+            chars.back().tab_count = tab_count.count(kv.first) ? tab_count[kv.first] : 0;
+            emits.insert(emits.end(), kv.second.begin(), kv.second.end());
+        }
+
+        PosCacheFileHeader header;
+        assert(sizeof(header.md5_hex) == md5.size());
+        memcpy(&header.md5_hex[0], md5.c_str(), md5.size());
+        header.state_num = n;
+        header.char_num = chars.size();
+        header.emit_num = emits.size();
+
+        return WriteCacheFile(cache_path, {
+            {&header, sizeof(header)},
+            {&states[0], n * sizeof(PosState)},
+            {&start[0], n * sizeof(double)},
+            {&trans[0], n * n * sizeof(double)},
+            {chars.data(), chars.size() * sizeof(PosCharStates)},
+            {emits.data(), emits.size() * sizeof(PosEmitProb)},
+        });
+    }
+
+    const PosState * states_ = nullptr;
+    const double * start_ = nullptr;
+    const double * trans_ = nullptr;
+    const PosCharStates * chars_ = nullptr;
+    const PosEmitProb * emits_ = nullptr;
+    size_t state_num_ = 0;
+    size_t char_num_ = 0;
+    vector<vector<uint16_t> > next_states_;
+
+    int mmap_fd_ = -1;
+    size_t mmap_length_ = 0;
+    char * mmap_addr_ = nullptr;
+}; // class PosHMMModel
+
+} // namespace cppjieba
@@ -0,0 +1,306 @@
+#pragma once
+
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include "PosHMMModel.hpp"
+#include "HMMSegment.hpp"
+#include "PosTagger.hpp"
+#include "SegmentBase.hpp"
+
+namespace cppjieba {
+
+/*
+ * Joint segmentation and POS tagging of the runs of Chinese chars with the (B/E/M/S x tag) HMM of dict/pos_dict,
+ * following the posseg mode of jieba. Letters and numbers are cut by the rules of HMMSegment and tagged eng and m,
+ * the other chars are single words tagged x.
+ * */
+class PosHMMSegment: public SegmentBase {
+public:
+    explicit PosHMMSegment(const PosHMMModel* model)
+        : model_(model) {
+        assert(model);
+    }
+
+    Error Create(const PosHMMModel* model) {
+        if (nullptr == model) {
+            XLOG(ERROR) << "Got NULL PosHMMModel pointer ";
+            return Error::ValueError;
+        }
+        this->model_ = model;
+        return Error::Ok;
+    }
+
+    ~PosHMMSegment() override = default;
+
+    void Cut(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end, vector<WordRange>& res, bool,
+             size_t) const override {
+        Cut(begin, end, res, nullptr);
+    }
+
+    // tags[i] is the tag of res[i], pointing into the model
+    void Cut(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end, vector<WordRange>& res,
+             vector<const char*>* tags) const {
+        RuneStrArray::const_iterator left = begin;
+
+        while (left != end) {
+            RuneStrArray::const_iterator right = left;
+
+            if (IsHan(left->rune)) {
+                while (right != end && IsHan(right->rune)) {
+                    right++;
+                }
+
+                InternalCut(left, right, res, tags);
+                left = right;
+                continue;
+            }
+
+            const char* tag = POS_X;
+
+            if (left->rune < 0x80) {
+                if ((right = HMMSegment::SequentialLetterRule(left, end)) != left) {
+                    tag = POS_ENG;
+                } else if ((right = HMMSegment::NumbersRule(left, end)) != left) {
+                    tag = POS_M;
+                }
+            }
+
+            if (right == left) {
+                right++;
+            }
+
+            res.push_back(WordRange(left, right - 1));
+            if (tags != nullptr) {
+                tags->push_back(tag);
+            }
+            left = right;
+        }
+    }
+
+    // false if the model is not loaded, which its Create reported already
+    bool Tag(const string& src, vector<pair<string, string> >& res) const {
+        if (model_->Empty()) {
+            return false;
+        }
+
+        PreFilter pre_filter(symbols_, src);
+        vector<WordRange> wrs;
+        vector<const char*> tags;
+        wrs.reserve(src.size() / 2);
+        tags.reserve(src.size() / 2);
+
+        while (pre_filter.HasNext()) {
+            auto range = pre_filter.Next();
+            Cut(range.left, range.right, wrs, &tags);
+        }
+
+        for (size_t i = 0; i < wrs.size(); i++) {
+            res.push_back(make_pair(GetWordFromRunes(src, wrs[i].left, wrs[i].right).word, string(tags[i])));
+        }
+
+        return !res.empty();
+    }
+
+private:
+    // the chars jieba posseg feeds to its HMM
+    static bool IsHan(Rune rune) {
+        return 0x4E00 <= rune && rune <= 0x9FD5;
+    }
+
+    void InternalCut(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end, vector<WordRange>& res,
+                     vector<const char*>* tags) const {
+        vector<uint16_t> route;
+        Viterbi(begin, end, route);
+
+        // a word ends at E or S and gets the tag of its last char
+        size_t left = 0;
+
+        for (size_t i = 0; i < route.size(); i++) {
+            const PosState& state = model_->GetState(route[i]);
+
+            if (state.bmes == 'B' && left < i) {
+                Emit(begin + left, begin + i - 1, model_->GetState(route[left]), res, tags);
+                left = i;
+            }
+
+            if (state.bmes == 'E' || state.bmes == 'S') {
+                Emit(begin + left, begin + i, state, res, tags);
+                left = i + 1;
+            }
+        }
+
+        if (left < route.size()) {
+            Emit(begin + left, end - 1, model_->GetState(route[left]), res, tags);
+        }
+    }
+
+    static void Emit(RuneStrArray::const_iterator left, RuneStrArray::const_iterator right, const PosState& state,
+                     vector<WordRange>& res, vector<const char*>* tags) {
+        res.push_back(WordRange(left, right));
+        if (tags != nullptr) {
+            tags->push_back(&state.tag[0]);
+        }
+    }
+
+    /*
+     * Pruned Viterbi: the states of a char are its candidates in char_state_tab that can follow one of the states of the
+     * previous char, or all the states that can follow them if there is none. Equal scores go to the greatest state id,
+     * like the max over (score, state) of jieba.
+     * */
+    void Viterbi(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end, vector<uint16_t>& route) const {
+        const size_t N = model_->StateNum();
+        const size_t X = end - begin;
+        const double MIN_INF = -std::numeric_limits<double>::infinity();
+
+        // the states of column x are states[col[x], col[x + 1]), back[i] indexes the best state of the previous column
+        vector<uint16_t> states;
+        vector<double> weight;
+        vector<uint32_t> back;
+        vector<size_t> col(X + 1, 0);
+        vector<uint32_t> prev;
+        // only needed when the candidates of a char do not fit, allocated then
+        vector<double> emit;
+        vector<size_t> expect_stamp;
+
+        states.reserve(X * 16);
+        weight.reserve(X * 16);
+        back.reserve(X * 16);
+
+        auto add_state = [&](size_t y, double w, uint32_t b) {
+            states.push_back(y);
+            weight.push_back(w);
+            back.push_back(b);
+        };
+
+        for (size_t x = 0; x < X; x++) {
+            const PosCharStates* cs = model_->GetCharStates((begin + x)->rune);
+            const PosEmitProb* emits = cs != nullptr ? model_->GetEmitProbs(*cs) : nullptr;
+            const size_t emit_num = cs != nullptr ? cs->count : 0;
+            const size_t tab_num = cs != nullptr ? cs->tab_count : 0;
+
+            if (x == 0) {
+                if (tab_num > 0) {
+                    for (size_t i = 0; i < tab_num; i++) {
+                        add_state(emits[i].state, model_->GetStartProb(emits[i].state) + emits[i].prob, 0);
+                    }
+                } else {
+                    FillEmit(emits, emit_num, emit);
+
+                    for (size_t y = 0; y < N; y++) {
+                        add_state(y, model_->GetStartProb(y) + emit[y], 0);
+                    }
+
+                    ResetEmit(emits, emit_num, emit);
+                }
+
+                col[1] = states.size();
+                continue;
+            }
+
+            // the previous states which have a next state
+            prev.clear();
+            for (size_t i = col[x - 1]; i < col[x]; i++) {
+                if (!model_->GetNextStates(states[i]).empty()) {
+                    prev.push_back(i);
+                }
+            }
+
+            if (prev.empty()) {
+                for (size_t i = col[x - 1]; i < col[x]; i++) {
+                    prev.push_back(i);
+                }
+            }
+
+            // the emit prob is added before comparing, since MIN_DOUBLE absorbs the differences between the previous states
+            auto best_prev = [&](size_t y, double emit_prob, double & best, uint32_t & best_i) {
+                best = MIN_INF;
+                best_i = prev[0];
+                bool reachable = false;
+
+                for (auto i : prev) {
+                    const double trans = model_->GetTransProb(states[i], y);
+                    reachable = reachable || trans != MIN_INF;
+                    const double w = weight[i] + trans + emit_prob;
+
+                    if (w > best || (w == best && states[i] > states[best_i])) {
+                        best = w;
+                        best_i = i;
+                    }
+                }
+
+                return reachable;
+            };
+
+            double best = 0;
+            uint32_t best_i = 0;
+
+            for (size_t i = 0; i < tab_num; i++) {
+                if (best_prev(emits[i].state, emits[i].prob, best, best_i)) {
+                    add_state(emits[i].state, best, best_i);
+                }
+            }
+
+            if (states.size() == col[x]) {
+                // every state which can follow a previous state, or every state
+                FillEmit(emits, emit_num, emit);
+                expect_stamp.resize(N, 0);
+
+                for (auto i : prev) {
+                    for (auto y : model_->GetNextStates(states[i])) {
+                        if (expect_stamp[y] != x) {
+                            expect_stamp[y] = x;
+                            best_prev(y, emit[y], best, best_i);
+                            add_state(y, best, best_i);
+                        }
+                    }
+                }
+
+                if (states.size() == col[x]) {
+                    for (size_t y = 0; y < N; y++) {
+                        best_prev(y, emit[y], best, best_i);
+                        add_state(y, best, best_i);
+                    }
+                }
+
+                ResetEmit(emits, emit_num, emit);
+            }
+
+            col[x + 1] = states.size();
+        }
+
+        size_t stat = col[X - 1];
+
+        for (size_t i = col[X - 1] + 1; i < col[X]; i++) {
+            if (weight[i] > weight[stat] || (weight[i] == weight[stat] && states[i] > states[stat])) {
+                stat = i;
+            }
+        }
+
+        route.resize(X);
+
+        for (size_t x = X; x-- > 0;) {
+            route[x] = states[stat];
+            stat = back[stat];
+        }
+    }
+
+    // scatters the emit probs of a char into `emit`, which is MIN_DOUBLE for the other states
+    void FillEmit(const PosEmitProb* emits, size_t emit_num, vector<double>& emit) const {
+        emit.resize(model_->StateNum(), MIN_DOUBLE);
+
+        for (size_t i = 0; i < emit_num; i++) {
+            emit[emits[i].state] = emits[i].prob;
+        }
+    }
+
+    static void ResetEmit(const PosEmitProb* emits, size_t emit_num, vector<double>& emit) {
+        for (size_t i = 0; i < emit_num; i++) {
+            emit[emits[i].state] = MIN_DOUBLE;
+        }
+    }
+
+    const PosHMMModel* model_;
+}; // class PosHMMSegment
+
+} // namespace cppjieba
@@ -18,12 +18,35 @@ public:
     ~PosTagger() {
     }
 
+    /*
+     * One segmentation pass: the words the segment took from the dictionary carry their entry,
+     * only the other ones (hmm words, unknown single runes) are looked up.
+     * */
     bool Tag(const string& src, vector<pair<string, string> >& res, const SegmentTagged& segment) const {
-        vector<string> CutRes;
-        segment.CutToStr(src, CutRes);
+        RuneStrArray runes;
 
-        for (vector<string>::iterator itr = CutRes.begin(); itr != CutRes.end(); ++itr) {
-            res.push_back(make_pair(*itr, LookupTag(*itr, segment)));
+        if (!DecodeRunesInString(src, runes)) {
+            XLOG_RATE(ERROR, 10) << "decode failed. " << src;
+            return false;
+        }
+
+        vector<WordRange> wrs;
+        wrs.reserve(runes.size());
+        segment.CutToRanges(runes.begin(), runes.end(), wrs);
+
+        const DictTrie * dict = segment.GetDictTrie();
+        assert(dict != NULL);
+
+        for (const auto & wr : wrs) {
+            const uint32_t offset = wr.left->offset;
+            string word = src.substr(offset, wr.right->offset + wr.right->len - offset);
+            const DatMemElem * elem = wr.elem != nullptr ? wr.elem : dict->Find(word);
+
+            if (elem == nullptr || elem->tag[0] == '\0') {
+                res.push_back(make_pair(std::move(word), string(SpecialRule(wr.left, wr.right + 1))));
+            } else {
+                res.push_back(make_pair(std::move(word), string(&elem->tag[0])));
+            }
         }
 
         return !res.empty();
@@ -38,26 +61,27 @@ public:
             RuneStrArray runes;
 
             if (!DecodeRunesInString(str, runes)) {
-                XLOG(ERROR) << "Decode failed.";
+                XLOG_RATE(ERROR, 10) << "Decode failed.";
                 return POS_X;
             }
 
-            return SpecialRule(runes);
+            return SpecialRule(runes.begin(), runes.end());
         } else {
             return tmp->GetTag();
         }
     }
 
 private:
-    const char* SpecialRule(const RuneStrArray& unicode) const {
+    static const char* SpecialRule(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end) {
+        const size_t size = end - begin;
         size_t m = 0;
         size_t eng = 0;
 
-        for (size_t i = 0; i < unicode.size() && eng < unicode.size() / 2; i++) {
-            if (unicode[i].rune < 0x80) {
+        for (size_t i = 0; i < size && eng < size / 2; i++) {
+            if (begin[i].rune < 0x80) {
                 eng ++;
 
-                if ('0' <= unicode[i].rune && unicode[i].rune <= '9') {
+                if ('0' <= begin[i].rune && begin[i].rune <= '9') {
                     m++;
                 }
             }
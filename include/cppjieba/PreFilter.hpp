@@ -12,20 +12,27 @@ public:
               const string& sentence)
         : symbols_(symbols) {
         if (!DecodeRunesInString(sentence, sentence_)) {
-            XLOG(ERROR) << "decode failed. "<<sentence;
+            XLOG_RATE(ERROR, 10) << "decode failed. " << sentence;
         }
 
         cursor_ = sentence_.begin();
+        end_ = sentence_.end();
+    }
+    // over runes decoded by the caller, which must outlive the filter
+    PreFilter(const std::unordered_set<Rune>& symbols,
+              RuneStrArray::const_iterator begin,
+              RuneStrArray::const_iterator end)
+        : cursor_(begin), end_(end), symbols_(symbols) {
     }
     ~PreFilter() {
     }
     bool HasNext() const {
-        return cursor_ != sentence_.end();
+        return cursor_ != end_;
     }
     WordRange Next() {
         WordRange range(cursor_, cursor_);
 
-        while (cursor_ != sentence_.end()) {
+        while (cursor_ != end_) {
             if (IsIn(symbols_, cursor_->rune)) {
                 if (range.left == cursor_) {
                     cursor_ ++;
@@ -38,11 +45,12 @@ public:
             cursor_ ++;
         }
 
-        range.right = sentence_.end();
+        range.right = end_;
         return range;
     }
 private:
     RuneStrArray::const_iterator cursor_;
+    RuneStrArray::const_iterator end_;
     RuneStrArray sentence_;
     const std::unordered_set<Rune>& symbols_;
 }; // class PreFilter
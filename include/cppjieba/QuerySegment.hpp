@@ -30,8 +30,29 @@ public:
 
     ~QuerySegment() override = default;
 
+    /*
+     * 0 (default): emit the dictionary 2-grams and 3-grams hidden in every token, like jieba `cut_for_search`.
+     * n >= 2: emit every dictionary word of 2..n runes contained in a token, taken from the DAG of the MP pass.
+     * */
+    void SetMaxSubWordLength(size_t len) {
+        maxSubWordLen_ = len;
+    }
+
+    size_t GetMaxSubWordLength() const {
+        return maxSubWordLen_;
+    }
+
+    void SetScoreType(ScoreType type) {
+        mixSeg_.SetScoreType(type);
+    }
+
     void Cut(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end, vector<WordRange>& res, bool hmm,
                      size_t) const override {
+        if (maxSubWordLen_ >= 2) {
+            CutWithSubWords(begin, end, res, hmm, maxSubWordLen_);
+            return;
+        }
+
         //use mix Cut first
         vector<WordRange> mixRes;
         mixSeg_.CutRuneArray(begin, end, mixRes, hmm);
@@ -42,10 +63,10 @@ public:
             if (mixRe.Length() > 2) {
                 for (size_t i = 0; i + 1 < mixRe.Length(); i++) {
                     string text = EncodeRunesToString(mixRe.left + i, mixRe.left + i + 2);
+                    const DatMemElem* elem = trie_->Find(text);
 
-                    if (trie_->Find(text) != nullptr) {
-                        WordRange wr(mixRe.left + i, mixRe.left + i + 1);
-                        res.push_back(wr);
+                    if (elem != nullptr) {
+                        res.push_back(WordRange(mixRe.left + i, mixRe.left + i + 1, elem));
                     }
                 }
             }
@@ -53,10 +74,10 @@ public:
             if (mixRe.Length() > 3) {
                 for (size_t i = 0; i + 2 < mixRe.Length(); i++) {
                     string text = EncodeRunesToString(mixRe.left + i, mixRe.left + i + 3);
+                    const DatMemElem* elem = trie_->Find(text);
 
-                    if (trie_->Find(text) != nullptr) {
-                        WordRange wr(mixRe.left + i, mixRe.left + i + 2);
-                        res.push_back(wr);
+                    if (elem != nullptr) {
+                        res.push_back(WordRange(mixRe.left + i, mixRe.left + i + 2, elem));
                     }
                 }
             }
@@ -64,6 +85,40 @@ public:
             res.push_back(mixRe);
         }
     }
+
+    // Coarse tokens and their fine-grained sub-words in one pass, without querying the trie again.
+    void CutWithSubWords(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end, vector<WordRange>& res,
+                         bool hmm, size_t max_sub_word_len) const {
+        vector<DatDag> dags;
+        vector<WordRange> mixRes;
+        mixSeg_.CutWithDag(begin, end, mixRes, hmm, dags);
+
+        for (const auto & mixRe : mixRes) {
+            const size_t len = mixRe.Length();
+
+            if (len > 2) {
+                const size_t left = mixRe.left - begin;
+                const size_t right = left + len;
+
+                for (size_t i = left; i + 1 < right; i++) {
+                    for (const auto & next : dags[i].nexts) {
+                        const size_t wordLen = next.first - i;
+
+                        if (wordLen > max_sub_word_len || next.first > right || wordLen >= len) {
+                            break;
+                        }
+
+                        if (wordLen >= 2 && nullptr != next.second) {
+                            res.push_back(WordRange(begin + i, begin + next.first - 1, next.second));
+                        }
+                    }
+                }
+            }
+
+            res.push_back(mixRe);
+        }
+    }
+
 private:
     static bool IsAllAscii(const RuneArray& s) {
         for (unsigned int i : s) {
@@ -76,6 +131,7 @@ private:
     }
     MixSegment mixSeg_;
     const DictTrie* trie_;
+    size_t maxSubWordLen_ = 0;
 }; // QuerySegment
 
 } // namespace cppjieba
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <limits>
+
+namespace cppjieba {
+
+/*
+ * Numeric type used for the log-probability scores of the MP dynamic programming and the HMM Viterbi.
+ * ScoreDouble is the reference path. ScoreFloat and ScoreFixed32 halve the size of the score tables.
+ * */
+enum ScoreType {
+    ScoreDouble,
+    ScoreFloat,
+    ScoreFixed32,
+};
+
+/*
+ * Every score type provides:
+ *   Min():            score of an impossible choice, the counterpart of MIN_DOUBLE
+ *   FromLogProb(p):   convert a log-probability (or MIN_DOUBLE) into a score
+ *   Add(a, b):        sum of two scores, never wrapping around
+ *   IsNearTie(a, b, terms, magnitude):
+ *                     whether choosing a over b might have gone the other way in double, given that each of them
+ *                     sums `terms` rounded log-probabilities, and that `magnitude` bounds the absolute value of
+ *                     these terms and of the partial sums
+ *   CHECK_TIES:       whether IsNearTie can ever be true
+ *   RENORMALIZE:      whether long Viterbi runs rescale their scores around 0 to save precision
+ *
+ * Tie-breaking: the DP and Viterbi loops only replace a candidate when the new score is strictly greater,
+ * so on equal scores the first candidate wins (the shortest next word, the lowest previous state),
+ * exactly like the double path does. Since rounding can turn a near tie into the opposite choice,
+ * a reduced precision run whose best path goes through a near tie is decided again in double.
+ * The segmentation is therefore the one of the double path.
+ * */
+template <typename Score>
+struct ScoreTraits;
+
+template <>
+struct ScoreTraits<double> {
+    static const bool CHECK_TIES = false;
+    static const bool RENORMALIZE = false;
+
+    static double Min() {
+        return -3.14e+100;
+    }
+
+    static double FromLogProb(double p) {
+        return p;
+    }
+
+    static double Add(double a, double b) {
+        return a + b;
+    }
+
+    static bool IsNearTie(double, double, size_t, double) {
+        return false;
+    }
+};
+
+template <>
+struct ScoreTraits<float> {
+    static const bool CHECK_TIES = true;
+    static const bool RENORMALIZE = true;
+
+    // far below any real path score, and adding a few thousands of them still does not reach -inf
+    static float Min() {
+        return -1e+30f;
+    }
+
+    static float FromLogProb(double p) {
+        return p < -1e+30 ? Min() : static_cast<float>(p);
+    }
+
+    static float Add(float a, float b) {
+        return a + b;
+    }
+
+    /*
+     * Each conversion and each addition is off by half an epsilon of `magnitude` at most, so a score is off by
+     * `terms` epsilons of it, and the difference of two by twice that.
+     *
+     * Like MIN_DOUBLE in double, Min() absorbs any finite log-probability added to it,
+     * so two impossible choices compare the same way in both types and are never near ties.
+     * */
+    static bool IsNearTie(float best, float second, size_t terms, double magnitude) {
+        const double error = 2.0 * terms * magnitude * std::numeric_limits<float>::epsilon();
+        return best > Min() / 2 && double(best) - second <= error;
+    }
+};
+
+// log-probabilities scaled by 2^12, i.e. a resolution of about 2.4e-4 nat
+template <>
+struct ScoreTraits<int32_t> {
+    static const bool CHECK_TIES = true;
+    static const bool RENORMALIZE = true;
+    static const int32_t SCALE = 1 << 12;
+
+    static int32_t Min() {
+        return INT32_MIN / 2;
+    }
+
+    static int32_t FromLogProb(double p) {
+        const double scaled = p * SCALE;
+
+        if (scaled <= Min()) {
+            return Min();
+        }
+
+        if (scaled >= INT32_MAX) {
+            return INT32_MAX;
+        }
+
+        return static_cast<int32_t>(std::lround(scaled));
+    }
+
+    static int32_t Add(int32_t a, int32_t b) {
+        const int64_t sum = int64_t(a) + b;
+
+        if (sum < INT32_MIN) {
+            return INT32_MIN;
+        }
+
+        if (sum > INT32_MAX) {
+            return INT32_MAX;
+        }
+
+        return static_cast<int32_t>(sum);
+    }
+
+    /*
+     * The additions are exact, only the conversions round, by half a unit each: a score is off by `terms` / 2 units,
+     * and the difference of two by `terms`, whatever the magnitude.
+     *
+     * Unlike MIN_DOUBLE in double, Min() does not absorb what is added to it, so the impossible choices may compare
+     * differently in double and are all near ties.
+     * */
+    static bool IsNearTie(int32_t best, int32_t second, size_t terms, double) {
+        return best <= Min() / 2 || int64_t(best) - second <= int64_t(terms);
+    }
+};
+
+} // namespace cppjieba
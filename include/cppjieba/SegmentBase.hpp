@@ -44,6 +44,17 @@ public:
         GetWordsFromWordRanges(sentence, wrs, words);
     }
 
+    // Cut over the pieces between the separators, the ranges point into [begin, end)
+    void CutToRanges(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end, vector<WordRange>& res,
+                     bool hmm = true, size_t max_word_len = MAX_WORD_LENGTH) const {
+        PreFilter pre_filter(symbols_, begin, end);
+
+        while (pre_filter.HasNext()) {
+            auto range = pre_filter.Next();
+            Cut(range.left, range.right, res, hmm, max_word_len);
+        }
+    }
+
     void CutRuneArray(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end, vector<WordRange>& res,
                       bool hmm = true, size_t max_word_len = MAX_WORD_LENGTH) const {
         Cut(begin, end, res, hmm, max_word_len);
@@ -0,0 +1,596 @@
+#pragma once
+
+#ifndef __linux__
+#error "ShmTransport needs memfd and futex"
+#endif
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "Jieba.hpp"
+
+namespace cppjieba {
+
+struct ShmTransportOptions {
+    size_t slot_num = 64;       // requests in flight, rounded up to a power of 2
+    size_t slot_size = 1 << 16; // bytes of a request, its text then 8 bytes per word of the answer
+    size_t thread_num = 0;      // workers of the server, 0 for all the cores
+};
+
+// a word of the answer, bytes of the text of the request
+struct TokenSpan {
+    uint32_t offset;
+    uint32_t length;
+};
+
+/*
+ * Layout of the memfd shared by ShmServer and its ShmClients, whatever their process:
+ *   shm::Header, then the cells of the request ring, then the ones of the free ring, then the slots
+ * A client takes a free slot, writes its text there and pushes the slot into the request ring; a worker cuts the text
+ * in place and writes the spans of the words after it, then marks the slot done. The rings are Vyukov bounded MPMC
+ * queues of slot indexes, which never fill up as they hold each slot once at most. The futexes are shared (no
+ * FUTEX_PRIVATE_FLAG), and only the sides which went to sleep are woken, so that a busy pair does no syscall.
+ * */
+namespace shm {
+
+const uint64_t MAGIC = 0x6a69656261736d31ULL; // "jiebasm1"
+const uint32_t VERSION = 1;
+
+enum SlotState : uint32_t {
+    SLOT_FREE = 0,
+    SLOT_REQUEST = 1,
+    SLOT_WAITING = 2, // request, and its client sleeps on the state
+    SLOT_DONE = 3,
+};
+
+enum SlotStatus : uint32_t {
+    STATUS_OK = 0,
+    STATUS_DECODE_FAILED = 1,
+    STATUS_TOO_MANY_WORDS = 2,
+};
+
+struct Cell {
+    std::atomic<uint64_t> seq;
+    uint32_t value;
+    uint32_t pad;
+};
+
+struct Ring {
+    std::atomic<uint64_t> enqueue;
+    char pad1[56];
+    std::atomic<uint64_t> dequeue;
+    char pad2[56];
+};
+
+struct Header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t slotNum;
+    uint64_t slotSize;
+    uint64_t totalSize;
+    char pad0[32];
+    Ring requests;
+    Ring frees;
+    std::atomic<uint32_t> requestSeq;  // futex, bumped by each request
+    std::atomic<uint32_t> requestWaiters;
+    char pad1[56];
+    std::atomic<uint32_t> freeSeq;     // futex, bumped by each freed slot
+    std::atomic<uint32_t> freeWaiters;
+    char pad2[56];
+    std::atomic<uint32_t> stop;
+    std::atomic<uint32_t> workers;     // running, a request is lost once they are all gone
+};
+
+struct Slot {
+    std::atomic<uint32_t> state;
+    uint32_t hmm;
+    uint32_t textSize;
+    uint32_t spanNum;
+    uint32_t status;
+    uint32_t pad[3];
+    // char text[textSize], then TokenSpan spans[spanNum] aligned to 8
+};
+
+// the atomics of the region are shared by processes, which takes lock-free ones
+static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2, "lock-free atomics needed");
+
+inline size_t Align(size_t n, size_t a) {
+    return (n + a - 1) / a * a;
+}
+
+inline size_t SpansOffset(size_t textSize) {
+    return sizeof(Slot) + Align(textSize, 8);
+}
+
+inline void FutexWait(std::atomic<uint32_t>* addr, uint32_t expected, const timespec* timeout = nullptr) {
+    syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAIT, expected, timeout, nullptr, 0);
+}
+
+inline void FutexWake(std::atomic<uint32_t>* addr, int n) {
+    syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAKE, n, nullptr, nullptr, 0);
+}
+
+/*
+ * A mapped memfd, the ring and slot accessors. The geometry is kept out of the header, which any process of the fd
+ * may write: read there on each access, a client could send the server out of the region.
+ * */
+class Region {
+public:
+    Region() {
+    }
+
+    ~Region() {
+        if (header_ != nullptr) {
+            munmap(header_, totalSize_);
+        }
+    }
+
+    Region(const Region &) = delete;
+    Region &operator=(const Region &) = delete;
+
+    Error Create(size_t slotNum, size_t slotSize, int& fd) {
+        size_t num = 1;
+
+        while (num < slotNum) {
+            num <<= 1;
+        }
+
+        slotSize = Align(std::max<size_t>(slotSize, sizeof(Slot) + 64), 64);
+        const size_t total = SlotsOffset(num) + num * slotSize;
+        fd = memfd_create("cppjieba", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+        // sealed, so that a client cannot shrink the region under the server
+        if (fd < 0 || ftruncate(fd, total) != 0 || fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) != 0) {
+            XLOG(ERROR) << "memfd of " << total << " bytes failed: " << strerror(errno);
+            return Error::MmapError;
+        }
+
+        Error status = Map(fd, total);
+
+        if (status != Error::Ok) {
+            return status;
+        }
+
+        slotNum_ = num;
+        slotSize_ = slotSize;
+
+        header_->magic = MAGIC;
+        header_->version = VERSION;
+        header_->slotNum = num;
+        header_->slotSize = slotSize;
+        header_->totalSize = total;
+
+        for (size_t i = 0; i < num; i++) {
+            GetCells(0)[i].seq.store(i);
+            GetCells(1)[i].seq.store(i);
+            GetSlot(i)->state.store(SLOT_FREE);
+            Push(1, i);
+        }
+
+        return Error::Ok;
+    }
+
+    Error Attach(int fd) {
+        struct stat st;
+
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header)) {
+            XLOG(ERROR) << "bad shared memory fd " << fd;
+            return Error::ValueError;
+        }
+
+        Error status = Map(fd, st.st_size);
+
+        if (status != Error::Ok) {
+            return status;
+        }
+
+        const size_t slotNum = header_->slotNum;
+        const size_t slotSize = header_->slotSize;
+
+        if (header_->magic != MAGIC || header_->version != VERSION || header_->totalSize != (size_t)st.st_size
+                || slotNum == 0 || (slotNum & (slotNum - 1)) != 0
+                || slotSize < sizeof(Slot) || SlotsOffset(slotNum) + slotNum * slotSize != (size_t)st.st_size) {
+            XLOG(ERROR) << "shared memory fd " << fd << " is no cppjieba transport of version " << VERSION;
+            munmap(header_, st.st_size);
+            header_ = nullptr;
+            totalSize_ = 0;
+            return Error::ValueError;
+        }
+
+        slotNum_ = slotNum;
+        slotSize_ = slotSize;
+        return Error::Ok;
+    }
+
+    Header* GetHeader() const {
+        return header_;
+    }
+
+    size_t GetSlotNum() const {
+        return slotNum_;
+    }
+
+    size_t GetSlotSize() const {
+        return slotSize_;
+    }
+
+    Slot* GetSlot(size_t i) const {
+        return (Slot*)((char*)header_ + SlotsOffset(slotNum_) + i * slotSize_);
+    }
+
+    // 0 for the request ring, 1 for the free one
+    bool Push(int ring, uint32_t value) {
+        Ring& r = ring == 0 ? header_->requests : header_->frees;
+        Cell* cells = GetCells(ring);
+        const uint64_t mask = slotNum_ - 1;
+        uint64_t pos = r.enqueue.load(std::memory_order_relaxed);
+
+        for (;;) {
+            Cell& cell = cells[pos & mask];
+            const int64_t diff = (int64_t)cell.seq.load(std::memory_order_acquire) - (int64_t)pos;
+
+            if (diff == 0) {
+                if (r.enqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value = value;
+                    cell.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = r.enqueue.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool Pop(int ring, uint32_t& value) {
+        Ring& r = ring == 0 ? header_->requests : header_->frees;
+        Cell* cells = GetCells(ring);
+        const uint64_t mask = slotNum_ - 1;
+        uint64_t pos = r.dequeue.load(std::memory_order_relaxed);
+
+        for (;;) {
+            Cell& cell = cells[pos & mask];
+            const int64_t diff = (int64_t)cell.seq.load(std::memory_order_acquire) - (int64_t)(pos + 1);
+
+            if (diff == 0) {
+                if (r.dequeue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = cell.value;
+                    cell.seq.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = r.dequeue.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /*
+     * Pops from `ring`, sleeping on `seq` while it is empty, until `stop` is set if not null. `spins` tries come
+     * first, the requests of a busy client being answered within microseconds.
+     * */
+    bool PopWait(int ring, std::atomic<uint32_t>& seq, std::atomic<uint32_t>& waiters, uint32_t& value,
+                 size_t spins, const std::atomic<uint32_t>* stop) {
+        for (size_t i = 0; i < spins; i++) {
+            if (Pop(ring, value)) {
+                return true;
+            }
+        }
+
+        for (;;) {
+            const uint32_t current = seq.load(std::memory_order_seq_cst);
+
+            if (Pop(ring, value)) {
+                return true;
+            }
+
+            if (stop != nullptr && stop->load(std::memory_order_seq_cst) != 0) {
+                return false;
+            }
+
+            waiters.fetch_add(1, std::memory_order_seq_cst);
+
+            if (seq.load(std::memory_order_seq_cst) == current) {
+                FutexWait(&seq, current);
+            }
+
+            waiters.fetch_sub(1, std::memory_order_seq_cst);
+        }
+    }
+
+    // pushes into `ring`, then wakes `wake` of its sleepers
+    void PushWake(int ring, std::atomic<uint32_t>& seq, std::atomic<uint32_t>& waiters, uint32_t value, int wake) {
+        bool pushed = Push(ring, value);
+        assert(pushed);
+        (void)pushed;
+        seq.fetch_add(1, std::memory_order_seq_cst);
+
+        if (waiters.load(std::memory_order_seq_cst) != 0) {
+            FutexWake(&seq, wake);
+        }
+    }
+
+private:
+    static size_t CellsOffset(size_t slotNum, int ring) {
+        return Align(sizeof(Header), 64) + ring * Align(slotNum * sizeof(Cell), 64);
+    }
+
+    static size_t SlotsOffset(size_t slotNum) {
+        return CellsOffset(slotNum, 2);
+    }
+
+    Cell* GetCells(int ring) const {
+        return (Cell*)((char*)header_ + CellsOffset(slotNum_, ring));
+    }
+
+    Error Map(int fd, size_t size) {
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+        if (p == MAP_FAILED) {
+            XLOG(ERROR) << "mmap of the shared memory failed: " << strerror(errno);
+            return Error::MmapError;
+        }
+
+        header_ = (Header*)p;
+        totalSize_ = size;
+        return Error::Ok;
+    }
+
+    Header* header_ = nullptr;
+    size_t totalSize_ = 0;
+    size_t slotNum_ = 0;
+    size_t slotSize_ = 0;
+}; // class Region
+
+} // namespace shm
+
+/*
+ * Segmentation for the processes of the host over shared memory, see shm::Region. GetFd is the memfd to hand to the
+ * clients, over a unix socket (SCM_RIGHTS) or as /proc/<pid>/fd/<fd>.
+ * */
+class ShmServer {
+public:
+    ShmServer(const Jieba* jieba, const ShmTransportOptions& options = ShmTransportOptions())
+        : jieba_(jieba), options_(options) {
+    }
+
+    ~ShmServer() {
+        Stop();
+
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+    }
+
+    ShmServer(const ShmServer &) = delete;
+    ShmServer &operator=(const ShmServer &) = delete;
+
+    Error Start() {
+        if (nullptr == jieba_) {
+            XLOG(ERROR) << "Got NULL Jieba pointer ";
+            return Error::ValueError;
+        }
+
+        Error status = region_.Create(options_.slot_num, options_.slot_size, fd_);
+
+        if (status != Error::Ok) {
+            return status;
+        }
+
+        size_t threadNum = options_.thread_num;
+
+        if (threadNum == 0) {
+            threadNum = std::max(1u, std::thread::hardware_concurrency());
+        }
+
+        region_.GetHeader()->workers.store(threadNum);
+
+        for (size_t i = 0; i < threadNum; i++) {
+            workers_.emplace_back(&ShmServer::WorkerLoop, this);
+        }
+
+        return Error::Ok;
+    }
+
+    // the pending requests are answered first
+    void Stop() {
+        if (workers_.empty()) {
+            return;
+        }
+
+        shm::Header* header = region_.GetHeader();
+        header->stop.store(1, std::memory_order_seq_cst);
+        header->requestSeq.fetch_add(1, std::memory_order_seq_cst);
+        shm::FutexWake(&header->requestSeq, INT32_MAX);
+
+        for (auto & worker : workers_) {
+            worker.join();
+        }
+
+        workers_.clear();
+    }
+
+    int GetFd() const {
+        return fd_;
+    }
+
+private:
+    void WorkerLoop() {
+        shm::Header* header = region_.GetHeader();
+        const size_t slotNum = region_.GetSlotNum();
+        const size_t slotSize = region_.GetSlotSize();
+        const MixSegment* segment = jieba_->GetMixSegment();
+        RuneStrArray runes;
+        vector<WordRange> wrs;
+        uint32_t index = 0;
+
+        while (region_.PopWait(0, header->requestSeq, header->requestWaiters, index, 1024, &header->stop)) {
+            if (index >= slotNum) {
+                continue;
+            }
+
+            shm::Slot* slot = region_.GetSlot(index);
+            // read once, the client may be in another process
+            const size_t textSize = std::min<size_t>(slot->textSize, slotSize - sizeof(shm::Slot));
+            const char* text = reinterpret_cast<const char*>(slot) + sizeof(shm::Slot);
+            const size_t spansOffset = std::min<size_t>(shm::SpansOffset(textSize), slotSize);
+            const size_t capacity = (slotSize - spansOffset) / sizeof(TokenSpan);
+            TokenSpan* spans = (TokenSpan*)((char*)slot + spansOffset);
+
+            // counted here, the client may write the slot meanwhile
+            size_t spanNum = 0;
+            slot->status = shm::STATUS_OK;
+            wrs.clear();
+
+            if (!DecodeRunesInString(text, textSize, runes)) {
+                slot->status = shm::STATUS_DECODE_FAILED;
+            } else {
+                segment->CutToRanges(runes.begin(), runes.end(), wrs, slot->hmm != 0);
+
+                if (wrs.size() > capacity) {
+                    slot->status = shm::STATUS_TOO_MANY_WORDS;
+                } else {
+                    for (const auto & wr : wrs) {
+                        spans[spanNum++] = {wr.left->offset, wr.right->offset + wr.right->len - wr.left->offset};
+                    }
+                }
+            }
+
+            slot->spanNum = spanNum;
+
+            if (slot->state.exchange(shm::SLOT_DONE, std::memory_order_acq_rel) == shm::SLOT_WAITING) {
+                shm::FutexWake(&slot->state, 1);
+            }
+        }
+
+        if (header->workers.fetch_sub(1, std::memory_order_seq_cst) == 1) {
+            // the clients waiting for a lost request check the workers
+            for (size_t i = 0; i < slotNum; i++) {
+                shm::FutexWake(&region_.GetSlot(i)->state, INT32_MAX);
+            }
+        }
+    }
+
+    const Jieba* jieba_;
+    ShmTransportOptions options_;
+    shm::Region region_;
+    int fd_ = -1;
+    vector<std::thread> workers_;
+}; // class ShmServer
+
+// may be shared by the threads of a process, each Cut taking a slot of its own
+class ShmClient {
+public:
+    ShmClient() {
+    }
+
+    // `fd` of ShmServer::GetFd, received or opened by the caller, which keeps it
+    explicit ShmClient(int fd) {
+        Create(fd);
+    }
+
+    ~ShmClient() = default;
+
+    ShmClient(const ShmClient &) = delete;
+    ShmClient &operator=(const ShmClient &) = delete;
+
+    Error Create(int fd) {
+        return region_.Attach(fd);
+    }
+
+    // "/proc/<pid>/fd/<fd>" of the server
+    Error Create(const string& path) {
+        const int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+
+        if (fd < 0) {
+            XLOG(ERROR) << "open " << path << " failed: " << strerror(errno);
+            return Error::OpenFileFailed;
+        }
+
+        Error status = region_.Attach(fd);
+        close(fd);
+        return status;
+    }
+
+    // the longest text a request takes, leaving room for the spans of one word per byte at worst
+    size_t GetMaxTextSize() const {
+        return (region_.GetSlotSize() - sizeof(shm::Slot)) / (1 + sizeof(TokenSpan)) / 8 * 8;
+    }
+
+    /*
+     * The words of `text` as spans of its bytes. False if the server stopped, the text is not UTF-8, or the text and
+     * its spans do not fit in a slot.
+     * */
+    bool Cut(const char* text, size_t size, vector<TokenSpan>& spans, bool hmm = true) {
+        shm::Header* header = region_.GetHeader();
+        spans.clear();
+
+        if (header == nullptr || shm::SpansOffset(size) > region_.GetSlotSize()) {
+            return false;
+        }
+
+        uint32_t index = 0;
+
+        if (!region_.PopWait(1, header->freeSeq, header->freeWaiters, index, 64, &header->stop)) {
+            return false;
+        }
+
+        shm::Slot* slot = region_.GetSlot(index);
+        memcpy(reinterpret_cast<char*>(slot) + sizeof(shm::Slot), text, size);
+        slot->textSize = size;
+        slot->hmm = hmm;
+        slot->state.store(shm::SLOT_REQUEST, std::memory_order_release);
+        region_.PushWake(0, header->requestSeq, header->requestWaiters, index, 1);
+
+        // spins a little, then sleeps until a worker marks the slot done
+        for (size_t i = 0; slot->state.load(std::memory_order_acquire) != shm::SLOT_DONE; i++) {
+            if (i < 4096) {
+                continue;
+            }
+
+            if (header->workers.load(std::memory_order_seq_cst) == 0) {
+                // the server is gone, so is the slot
+                return false;
+            }
+
+            uint32_t expected = shm::SLOT_REQUEST;
+
+            if (slot->state.compare_exchange_strong(expected, shm::SLOT_WAITING, std::memory_order_acq_rel)
+                    || expected == shm::SLOT_WAITING) {
+                const timespec timeout = {0, 100 * 1000 * 1000};
+                shm::FutexWait(&slot->state, shm::SLOT_WAITING, &timeout);
+            }
+        }
+
+        const bool ok = slot->status == shm::STATUS_OK;
+
+        if (ok) {
+            const TokenSpan* begin = (const TokenSpan*)((const char*)slot + shm::SpansOffset(size));
+            const size_t capacity = (region_.GetSlotSize() - shm::SpansOffset(size)) / sizeof(TokenSpan);
+            spans.assign(begin, begin + std::min<size_t>(slot->spanNum, capacity));
+        }
+
+        slot->state.store(shm::SLOT_FREE, std::memory_order_relaxed);
+        region_.PushWake(1, header->freeSeq, header->freeWaiters, index, 1);
+        return ok;
+    }
+
+    bool Cut(const string& text, vector<TokenSpan>& spans, bool hmm = true) {
+        return Cut(text.data(), text.size(), spans, hmm);
+    }
+
+private:
+    shm::Region region_;
+}; // class ShmClient
+
+} // namespace cppjieba
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cassert>
+#include <set>
+#include "limonp/Md5.hpp"
+#include "limonp/Logging.hpp"
+#include "DictTrie.hpp"
+#include "Error.hpp"
+
+namespace cppjieba {
+
+using namespace limonp;
+
+/*
+ * Stop words as a mmap'ed DAT cache, <stop_word_path>.<md5>.stop_cache by default, so that the extractors and the
+ * processes using the same files share one copy:
+ *   DAT     every stop word of the file
+ *   column  1 for the elements of the dict trie which are stop words, 0 for the other ones
+ * The md5 covers both the stop word file and the dict trie, whose element ids the column depends on.
+ * */
+class StopWords {
+public:
+    StopWords() {}
+    ~StopWords() = default;
+
+    StopWords(const StopWords &) = delete;
+    StopWords &operator=(const StopWords &) = delete;
+
+    Error Create(const string& stop_word_path, const DictTrie* dict_trie, string cache_path = "") {
+        if (nullptr == dict_trie) {
+            XLOG(ERROR) << "Got NULL DictTrie pointer ";
+            return Error::ValueError;
+        }
+        dict_trie_ = dict_trie;
+
+        size_t file_size_sum = 0;
+        string file_md5;
+        Error status = CalcFileListMD5({stop_word_path}, file_size_sum, file_md5);
+        if (status != Error::Ok) {
+            return status;
+        }
+
+        string md5;
+        md5String((file_md5 + dict_trie->GetMd5()).c_str(), md5);
+
+        if (cache_path.empty()) {
+            cache_path = stop_word_path + "." + md5 + ".stop_cache";
+        }
+
+        if (Error::Ok == dat_.InitAttachDat(cache_path, md5)) {
+            return Error::Ok;
+        }
+
+        vector<DatElement> elements;
+        status = LoadStopWordDict(stop_word_path, elements);
+        if (status != Error::Ok) {
+            return status;
+        }
+
+        vector<double> column(dict_trie->GetElementsNum(), 0);
+
+        for (const auto & element : elements) {
+            const DatMemElem* elem = dict_trie->Find(element.word);
+
+            if (elem != nullptr) {
+                column[dict_trie->GetElementIndex(elem)] = 1;
+            }
+        }
+
+        return dat_.InitBuildDat(elements, cache_path, md5, column);
+    }
+
+    // `elem` being an entry of the dict trie the stop words were created with
+    bool IsStopWord(const DatMemElem* elem) const {
+        assert(elem != nullptr && dict_trie_->GetElementIndex(elem) < dat_.GetColumnSize());
+        return dat_.GetColumn()[dict_trie_->GetElementIndex(elem)] != 0;
+    }
+
+    bool IsStopWord(const string& word) const {
+        return !word.empty() && dat_.Find(word) != nullptr;
+    }
+
+private:
+    static Error LoadStopWordDict(const string& filePath, vector<DatElement>& elements) {
+        ifstream ifs(filePath.c_str());
+        if (!ifs.is_open()) {
+            XLOG(ERROR) << "open " << filePath << " failed";
+            return Error::OpenFileFailed;
+        }
+
+        std::set<string> words;
+        string line;
+
+        while (getline(ifs, line)) {
+            if (!line.empty()) {
+                words.insert(line);
+            }
+        }
+
+        if (words.empty()) {
+            XLOG(ERROR) << "empty file";
+            return Error::ValueError;
+        }
+
+        for (const auto & word : words) {
+            elements.emplace_back();
+            elements.back().word = word;
+        }
+
+        return Error::Ok;
+    }
+
+    const DictTrie* dict_trie_ = nullptr;
+    DatTrie dat_;
+}; // class StopWords
+
+} // namespace cppjieba
@@ -0,0 +1,618 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "NumaTopology.hpp"
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <condition_variable>
+#include <mutex>
+#endif
+
+namespace cppjieba {
+
+/*
+ * A callable and its captures in 64 bytes, copied around as words: the captures must be trivially copyable and fit in
+ * 56 bytes, i.e. a few pointers, references and integers, so that no task is ever allocated.
+ * */
+class Task {
+public:
+    enum { WORDS = 8 };
+
+    Task() {
+        memset(words_, 0, sizeof(words_));
+    }
+
+    template <class F>
+    explicit Task(const F& f) {
+        static_assert(sizeof(F) <= sizeof(uint64_t) * (WORDS - 1), "captures too large for a Task, capture pointers");
+        static_assert(alignof(F) <= alignof(uint64_t), "captures over-aligned for a Task");
+        static_assert(std::is_trivially_copyable<F>::value, "captures of a Task must be trivially copyable");
+        memset(words_, 0, sizeof(words_));
+        Invoke invoke = &Call<F>;
+        static_assert(sizeof(invoke) <= sizeof(uint64_t), "function pointers wider than 64 bits");
+        memcpy(&words_[0], &invoke, sizeof(invoke));
+        memcpy(&words_[1], &f, sizeof(F));
+    }
+
+    void operator()() const {
+        Invoke invoke;
+        memcpy(&invoke, &words_[0], sizeof(invoke));
+        invoke(&words_[1]);
+    }
+
+    uint64_t GetWord(size_t i) const {
+        return words_[i];
+    }
+
+    void SetWord(size_t i, uint64_t word) {
+        words_[i] = word;
+    }
+
+private:
+    typedef void (*Invoke)(const uint64_t*);
+
+    template <class F>
+    static void Call(const uint64_t* captures) {
+        (*reinterpret_cast<const F*>(captures))();
+    }
+
+    uint64_t words_[WORDS];
+}; // class Task
+
+/*
+ * A 32 bits word to sleep on until it changes, a futex on Linux. Once WaitWhile returns or Changed is true, no Set
+ * touches the Futex any more, so that its waiter may destroy it.
+ * */
+class Futex {
+public:
+    Futex(): value_(0) {}
+
+    std::atomic<uint32_t>& Value() {
+        return value_;
+    }
+
+    // returns at once if the word is not `expected` any more, and may return spuriously
+    void Wait(uint32_t expected) {
+#ifdef __linux__
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&value_), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+#else
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (value_.load() == expected) {
+            cond_.wait(lock);
+        }
+#endif
+    }
+
+    // returns once the word is not `expected` any more
+    void WaitWhile(uint32_t expected) {
+#ifdef __linux__
+        while (value_.load(std::memory_order_acquire) == expected) {
+            Wait(expected);
+        }
+
+        WaitSetters();
+#else
+        // under the lock, so that the Futex can be destroyed once it returns
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (value_.load() == expected) {
+            cond_.wait(lock);
+        }
+#endif
+    }
+
+    // whether the word is not `expected` any more, without waiting
+    bool Changed(uint32_t expected) {
+#ifdef __linux__
+        if (value_.load(std::memory_order_acquire) == expected) {
+            return false;
+        }
+
+        WaitSetters();
+        return true;
+#else
+        std::lock_guard<std::mutex> lock(mutex_);
+        return value_.load() != expected;
+#endif
+    }
+
+    // stores `value` and wakes all the waiters
+    void Set(uint32_t value) {
+#ifdef __linux__
+        // the waiters seeing `value` see the count, and wait for it to drop before they may destroy the Futex
+        setters_.fetch_add(1, std::memory_order_relaxed);
+        value_.store(value, std::memory_order_release);
+        Wake(true);
+        setters_.fetch_sub(1, std::memory_order_release);
+#else
+        std::lock_guard<std::mutex> lock(mutex_);
+        value_.store(value);
+        cond_.notify_all();
+#endif
+    }
+
+    // to call once the word was changed
+    void Wake(bool all) {
+#ifdef __linux__
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&value_), FUTEX_WAKE_PRIVATE, all ? INT_MAX : 1, nullptr, nullptr, 0);
+#else
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (all) {
+            cond_.notify_all();
+        } else {
+            cond_.notify_one();
+        }
+#endif
+    }
+
+private:
+#ifdef __linux__
+    // a Set is between its store and its wake for a syscall at most
+    void WaitSetters() {
+        while (setters_.load(std::memory_order_acquire) != 0) {
+            std::this_thread::yield();
+        }
+    }
+#endif
+
+    std::atomic<uint32_t> value_;
+#ifdef __linux__
+    std::atomic<uint32_t> setters_{0};
+#else
+    std::mutex mutex_;
+    std::condition_variable cond_;
+#endif
+}; // class Futex
+
+/*
+ * Chase-Lev work-stealing deque (Le et al., "Correct and Efficient Work-Stealing for Weak Memory Models"): the owner
+ * pushes and pops at the bottom, the thieves steal at the top. The tasks are stored as relaxed atomic words since a thief
+ * may read a slot the owner is writing; the arrays outgrown are kept until the deque is destroyed for the same reason.
+ * */
+class WorkDeque {
+public:
+    WorkDeque(): top_(0), bottom_(0) {
+        arrays_.emplace_back(new Array(64));
+        array_.store(arrays_.back().get(), std::memory_order_relaxed);
+    }
+
+    // owner only
+    void Push(const Task& task) {
+        const int64_t b = bottom_.load(std::memory_order_relaxed);
+        const int64_t t = top_.load(std::memory_order_acquire);
+        Array* array = array_.load(std::memory_order_relaxed);
+
+        if (b - t > (int64_t)array->Capacity() - 1) {
+            array = Grow(array, t, b);
+        }
+
+        array->Put(b, task);
+        bottom_.store(b + 1, std::memory_order_release);
+    }
+
+    // owner only
+    bool Pop(Task& task) {
+        const int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        Array* array = array_.load(std::memory_order_relaxed);
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top_.load(std::memory_order_relaxed);
+
+        if (t > b) {
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        array->Get(b, task);
+
+        if (t == b) {
+            // the last task, raced for with the thieves
+            const bool won = top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                                          std::memory_order_relaxed);
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+
+        return true;
+    }
+
+    // any thread, may fail when another thread took the task first
+    bool Steal(Task& task) {
+        int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int64_t b = bottom_.load(std::memory_order_acquire);
+
+        if (t >= b) {
+            return false;
+        }
+
+        array_.load(std::memory_order_acquire)->Get(t, task);
+        return top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+
+private:
+    class Array {
+    public:
+        explicit Array(size_t capacity)
+            : mask_(capacity - 1), words_(new std::atomic<uint64_t>[capacity * Task::WORDS]) {
+            assert((capacity & mask_) == 0);
+        }
+
+        size_t Capacity() const {
+            return mask_ + 1;
+        }
+
+        void Put(int64_t i, const Task& task) {
+            std::atomic<uint64_t>* words = &words_[(i & mask_) * Task::WORDS];
+
+            for (size_t w = 0; w < Task::WORDS; w++) {
+                words[w].store(task.GetWord(w), std::memory_order_relaxed);
+            }
+        }
+
+        void Get(int64_t i, Task& task) const {
+            const std::atomic<uint64_t>* words = &words_[(i & mask_) * Task::WORDS];
+
+            for (size_t w = 0; w < Task::WORDS; w++) {
+                task.SetWord(w, words[w].load(std::memory_order_relaxed));
+            }
+        }
+
+    private:
+        size_t mask_;
+        std::unique_ptr<std::atomic<uint64_t>[]> words_;
+    }; // class Array
+
+    Array* Grow(Array* array, int64_t t, int64_t b) {
+        arrays_.emplace_back(new Array(array->Capacity() * 2));
+        Array* grown = arrays_.back().get();
+        Task task;
+
+        for (int64_t i = t; i < b; i++) {
+            array->Get(i, task);
+            grown->Put(i, task);
+        }
+
+        array_.store(grown, std::memory_order_release);
+        return grown;
+    }
+
+    // apart to avoid false sharing between the owner and the thieves
+    std::atomic<int64_t> top_;
+    char pad_[64];
+    std::atomic<int64_t> bottom_;
+    std::atomic<Array*> array_;
+    std::vector<std::unique_ptr<Array> > arrays_;
+}; // class WorkDeque
+
+// Vyukov's bounded lock-free MPMC queue, for the tasks spawned by the threads outside of the scheduler
+class TaskQueue {
+public:
+    explicit TaskQueue(size_t capacity)
+        : mask_(capacity - 1), cells_(new Cell[capacity]), enqueue_(0), dequeue_(0) {
+        assert(capacity >= 2 && (capacity & mask_) == 0);
+
+        for (size_t i = 0; i < capacity; i++) {
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // false when full
+    bool Push(const Task& task) {
+        size_t pos = enqueue_.load(std::memory_order_relaxed);
+        Cell* cell = nullptr;
+
+        for (;;) {
+            cell = &cells_[pos & mask_];
+            const size_t seq = cell->seq.load(std::memory_order_acquire);
+            const intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+            if (diff == 0) {
+                if (enqueue_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueue_.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->task = task;
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // false when empty
+    bool Pop(Task& task) {
+        size_t pos = dequeue_.load(std::memory_order_relaxed);
+        Cell* cell = nullptr;
+
+        for (;;) {
+            cell = &cells_[pos & mask_];
+            const size_t seq = cell->seq.load(std::memory_order_acquire);
+            const intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+            if (diff == 0) {
+                if (dequeue_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = dequeue_.load(std::memory_order_relaxed);
+            }
+        }
+
+        task = cell->task;
+        cell->seq.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> seq;
+        Task task;
+    };
+
+    const size_t mask_;
+    std::unique_ptr<Cell[]> cells_;
+    std::atomic<size_t> enqueue_;
+    char pad_[64];
+    std::atomic<size_t> dequeue_;
+}; // class TaskQueue
+
+/*
+ * Work-stealing scheduler of the batch APIs. Each of the threadNum workers runs the tasks of its own deque first, then
+ * the ones spawned from outside, then steals from the other workers, and parks on a futex once it found nothing for a
+ * while. ParallelFor splits its range in halves down to `grain`, so that the thieves take the large pieces.
+ * */
+class TaskScheduler {
+public:
+    // 0 for all the cores
+    explicit TaskScheduler(size_t threadNum = 0)
+        : injected_(1024), stop_(false) {
+        Start(threadNum);
+    }
+
+    // workers spread over the nodes of `topology` in as even blocks as possible, each pinned to the CPUs of its node
+    explicit TaskScheduler(const NumaTopology& topology, size_t threadNum = 0)
+        : injected_(1024), stop_(false), topology_(new NumaTopology(topology)) {
+        Start(threadNum);
+    }
+
+    ~TaskScheduler() {
+        stop_.store(true, std::memory_order_seq_cst);
+        Notify(true);
+
+        for (auto & worker : workers_) {
+            worker.join();
+        }
+    }
+
+    TaskScheduler(const TaskScheduler &) = delete;
+    TaskScheduler &operator=(const TaskScheduler &) = delete;
+
+    size_t GetThreadNum() const {
+        return workers_.size();
+    }
+
+    // node `worker` is pinned to, NumaTopology::ANY_NODE for the workers of a scheduler without topology
+    size_t GetWorkerNode(size_t worker) const {
+        return topology_ ? worker * topology_->GetNodeNum() / deques_.size() : (size_t)NumaTopology::ANY_NODE;
+    }
+
+    // index of the worker running the calling thread, GetThreadNum() for the threads outside of the scheduler
+    size_t CurrentWorker() const {
+        const WorkerSlot& slot = CurrentSlot();
+        return slot.scheduler == this ? slot.index : workers_.size();
+    }
+
+    /*
+     * Calls f(begin, end, worker) over pieces of [begin, end) of `grain` items at most, on the workers, and returns
+     * once they are all done. `worker` is the one in [0, GetThreadNum()) running the piece, so it can index per thread
+     * state. A worker calling ParallelFor runs tasks while it waits, the other threads sleep. Hence a piece calling
+     * ParallelFor (or a batch API using it) may see other pieces, of any range, run on its thread with its `worker`
+     * before the call returns: it must not hold per worker state across the call.
+     * */
+    template <class F>
+    void ParallelFor(size_t begin, size_t end, size_t grain, const F& f) {
+        if (begin >= end) {
+            return;
+        }
+
+        Range<F> range(this, &f, std::max<size_t>(grain, 1));
+        Spawn(Task(RangeTask<F>{&range, begin, end}));
+
+        if (CurrentSlot().scheduler == this) {
+            const size_t index = CurrentSlot().index;
+            Task task;
+
+            // on `done` rather than `pending`, which the last piece zeroes before it is done with `range`
+            while (!range.done.Changed(0)) {
+                if (FindTask(index, task)) {
+                    task();
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        } else {
+            range.done.WaitWhile(0);
+        }
+    }
+
+private:
+    struct WorkerSlot {
+        const TaskScheduler* scheduler = nullptr;
+        size_t index = 0;
+    };
+
+    static WorkerSlot& CurrentSlot() {
+        static thread_local WorkerSlot slot;
+        return slot;
+    }
+
+    template <class F>
+    struct Range {
+        Range(TaskScheduler* s, const F* fn, size_t g)
+            : scheduler(s), f(fn), grain(g), pending(1) {
+        }
+
+        TaskScheduler* scheduler;
+        const F* f;
+        size_t grain;
+        std::atomic<size_t> pending; // pieces spawned and not done yet
+        Futex done;
+    };
+
+    template <class F>
+    struct RangeTask {
+        Range<F>* range;
+        size_t begin;
+        size_t end;
+
+        // keeps the first half, spawns the second one, until the piece fits in a grain
+        void operator()() const {
+            size_t e = end;
+
+            while (e - begin > range->grain) {
+                const size_t mid = begin + (e - begin) / 2;
+                range->pending.fetch_add(1, std::memory_order_relaxed);
+                range->scheduler->Spawn(Task(RangeTask<F>{range, mid, e}));
+                e = mid;
+            }
+
+            (*range->f)(begin, e, range->scheduler->CurrentWorker());
+
+            if (range->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                range->done.Set(1);
+            }
+        }
+    };
+
+    void Start(size_t threadNum) {
+        if (threadNum == 0) {
+            threadNum = std::max(1u, std::thread::hardware_concurrency());
+        }
+
+        deques_.resize(threadNum);
+        for (auto & deque : deques_) {
+            deque.reset(new WorkDeque());
+        }
+
+        for (size_t i = 0; i < threadNum; i++) {
+            workers_.emplace_back(&TaskScheduler::WorkerLoop, this, i);
+        }
+    }
+
+    void Spawn(const Task& task) {
+        const WorkerSlot& slot = CurrentSlot();
+
+        if (slot.scheduler == this) {
+            deques_[slot.index]->Push(task);
+        } else {
+            while (!injected_.Push(task)) {
+                std::this_thread::yield();
+            }
+        }
+
+        Notify(false);
+    }
+
+    bool FindTask(size_t index, Task& task) {
+        if (deques_[index]->Pop(task) || injected_.Pop(task)) {
+            return true;
+        }
+
+        const size_t n = deques_.size();
+
+        for (size_t k = 1; k < n; k++) {
+            if (deques_[(index + k) % n]->Steal(task)) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // wakes parked workers, if any; the fence orders the task or the stop flag before reading `sleepers_`
+    void Notify(bool all) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (sleepers_.load(std::memory_order_relaxed) == 0) {
+            return;
+        }
+
+        epoch_.Value().fetch_add(1, std::memory_order_seq_cst);
+        epoch_.Wake(all);
+    }
+
+    void WorkerLoop(size_t index) {
+        const size_t SPINS = 64;
+        CurrentSlot().scheduler = this;
+        CurrentSlot().index = index;
+
+        if (topology_) {
+            topology_->PinCurrentThread(GetWorkerNode(index));
+        }
+
+        Task task;
+        size_t idle = 0;
+
+        for (;;) {
+            if (FindTask(index, task)) {
+                task();
+                idle = 0;
+                continue;
+            }
+
+            if (stop_.load(std::memory_order_acquire)) {
+                break;
+            }
+
+            if (++idle < SPINS) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            // announce the parking, then look again so that a task spawned meanwhile is not missed
+            sleepers_.fetch_add(1, std::memory_order_seq_cst);
+            const uint32_t epoch = epoch_.Value().load(std::memory_order_seq_cst);
+
+            if (FindTask(index, task)) {
+                sleepers_.fetch_sub(1, std::memory_order_relaxed);
+                task();
+                idle = 0;
+                continue;
+            }
+
+            if (!stop_.load(std::memory_order_seq_cst)) {
+                epoch_.Wait(epoch);
+            }
+
+            sleepers_.fetch_sub(1, std::memory_order_relaxed);
+            idle = 0;
+        }
+    }
+
+    std::vector<std::unique_ptr<WorkDeque> > deques_;
+    TaskQueue injected_;
+    std::vector<std::thread> workers_;
+    std::atomic<bool> stop_;
+    std::atomic<uint32_t> sleepers_{0};
+    Futex epoch_;
+    std::unique_ptr<NumaTopology> topology_;
+}; // class TaskScheduler
+
+} // namespace cppjieba
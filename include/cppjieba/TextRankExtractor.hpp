@@ -1,6 +1,8 @@
 
 #include <cmath>
+#include <memory>
 #include "Jieba.hpp"
+#include "StopWords.hpp"
 
 namespace cppjieba {
 using namespace limonp;
@@ -14,85 +16,111 @@ public:
         double weight;
     }    Word; // struct Word
 private:
-    typedef std::map<string, Word> WordMap;
-
+    /*
+     * Undirected word graph over node ids, as a CSR adjacency once built. The nodes are ranked in id order and every
+     * update is seen by the next nodes (Gauss-Seidel), with coef = weight / outSum of the neighbor precomputed per edge.
+     * */
     class WordGraph {
     private:
-        typedef double Score;
-        typedef string Node;
-        typedef std::set<Node> NodeSet;
-
-        typedef std::map<Node, double> Edges;
-        typedef std::map<Node, Edges> Graph;
-        //typedef std::unordered_map<Node,double> Edges;
-        //typedef std::unordered_map<Node,Edges> Graph;
+        struct Edge {
+            uint32_t start;
+            uint32_t end;
+            double weight;
+        };
 
         double d;
-        Graph graph;
-        NodeSet nodeSet;
+        size_t nodeNum;
+        vector<Edge> edges;
     public:
-        WordGraph(): d(0.85) {};
-        WordGraph(double in_d): d(in_d) {};
+        explicit WordGraph(size_t in_nodeNum, double in_d = 0.85): d(in_d), nodeNum(in_nodeNum) {};
 
-        void addEdge(Node start, Node end, double weight) {
-            Edges temp;
-            Edges::iterator gotEdges;
-            nodeSet.insert(start);
-            nodeSet.insert(end);
-            graph[start][end] += weight;
-            graph[end][start] += weight;
+        void addEdge(uint32_t start, uint32_t end, double weight) {
+            assert(start < nodeNum && end < nodeNum);
+            edges.push_back({start, end, weight});
+            edges.push_back({end, start, weight});
         }
 
-        void rank(WordMap &ws, size_t rankTime = 10) {
-            WordMap outSum;
-            Score wsdef, min_rank, max_rank;
-
-            if (graph.size() == 0) {
+        // ws[i] is the rank of node i, nodes without edges keep theirs. Stops early once no rank moves by epsilon or more
+        void rank(vector<double>& ws, size_t rankTime = 10, double epsilon = 0) {
+            if (edges.empty()) {
                 return;
             }
 
-            wsdef = 1.0 / graph.size();
+            // the duplicated edges are summed in the order they were added
+            std::stable_sort(edges.begin(), edges.end(), [](const Edge & lhs, const Edge & rhs) {
+                return lhs.start != rhs.start ? lhs.start < rhs.start : lhs.end < rhs.end;
+            });
 
-            for (Graph::iterator edges = graph.begin(); edges != graph.end(); ++edges) {
-                // edges->first start节点；edge->first end节点；edge->second 权重
-                ws[edges->first].word = edges->first;
-                ws[edges->first].weight = wsdef;
-                outSum[edges->first].weight = 0;
+            vector<size_t> rows(nodeNum + 1, 0);
+            vector<uint32_t> cols;
+            vector<double> coefs;
+            vector<double> outSum(nodeNum, 0);
+            size_t graphSize = 0;
+
+            for (size_t e = 0; e < edges.size(); e++) {
+                if (e > 0 && edges[e].start == edges[e - 1].start && edges[e].end == edges[e - 1].end) {
+                    coefs.back() += edges[e].weight;
+                    continue;
+                }
 
-                for (Edges::iterator edge = edges->second.begin(); edge != edges->second.end(); ++edge) {
-                    outSum[edges->first].weight += edge->second;
+                if (e == 0 || edges[e].start != edges[e - 1].start) {
+                    graphSize++;
                 }
+
+                rows[edges[e].start + 1]++;
+                cols.push_back(edges[e].end);
+                coefs.push_back(edges[e].weight);
             }
 
-            //sort(nodeSet.begin(),nodeSet.end()); 是否需要排序?
-            for (size_t i = 0; i < rankTime; i++) {
-                for (NodeSet::iterator node = nodeSet.begin(); node != nodeSet.end(); node++) {
-                    double s = 0;
+            for (size_t i = 0; i < nodeNum; i++) {
+                rows[i + 1] += rows[i];
 
-                    for (Edges::iterator edge = graph[*node].begin(); edge != graph[*node].end(); edge++)
-                        // edge->first end节点；edge->second 权重
-                    {
-                        s += edge->second / outSum[edge->first].weight * ws[edge->first].weight;
-                    }
+                for (size_t e = rows[i]; e < rows[i + 1]; e++) {
+                    outSum[i] += coefs[e];
+                }
+            }
+
+            for (size_t e = 0; e < cols.size(); e++) {
+                coefs[e] /= outSum[cols[e]];
+            }
 
-                    ws[*node].weight = (1 - d) + d * s;
+            const double wsdef = 1.0 / graphSize;
+
+            for (size_t i = 0; i < nodeNum; i++) {
+                if (rows[i] != rows[i + 1]) {
+                    ws[i] = wsdef;
                 }
             }
 
-            min_rank = max_rank = ws.begin()->second.weight;
+            for (size_t t = 0; t < rankTime; t++) {
+                double delta = 0;
 
-            for (WordMap::iterator i = ws.begin(); i != ws.end(); i ++) {
-                if (i->second.weight < min_rank) {
-                    min_rank = i->second.weight;
+                for (size_t i = 0; i < nodeNum; i++) {
+                    if (rows[i] == rows[i + 1]) {
+                        continue;
+                    }
+
+                    double s = 0;
+
+                    for (size_t e = rows[i]; e < rows[i + 1]; e++) {
+                        s += coefs[e] * ws[cols[e]];
+                    }
+
+                    const double w = (1 - d) + d * s;
+                    delta = max(delta, fabs(w - ws[i]));
+                    ws[i] = w;
                 }
 
-                if (i->second.weight > max_rank) {
-                    max_rank = i->second.weight;
+                if (delta < epsilon) {
+                    break;
                 }
             }
 
-            for (WordMap::iterator i = ws.begin(); i != ws.end(); i ++) {
-                ws[i->first].weight = (i->second.weight - min_rank / 10.0) / (max_rank - min_rank / 10.0);
+            const double min_rank = *min_element(ws.begin(), ws.end());
+            const double max_rank = *max_element(ws.begin(), ws.end());
+
+            for (auto & w : ws) {
+                w = (w - min_rank / 10.0) / (max_rank - min_rank / 10.0);
             }
         }
     };
@@ -100,16 +128,52 @@ private:
 public:
     TextRankExtractor(const DictTrie* dictTrie,
                       const HMMModel* model,
-                      const string& stopWordPath)
-        : segment_(dictTrie, model) {
-        LoadStopWordDict(stopWordPath);
+                      const string& stopWordPath) {
+        Create(dictTrie, model, stopWordPath);
+    }
+    // shares the segment of `jieba`
+    TextRankExtractor(const Jieba& jieba, const string& stopWordPath) {
+        Create(jieba.GetMixSegment(), stopWordPath);
     }
-    TextRankExtractor(const Jieba& jieba, const string& stopWordPath) : segment_(jieba.GetDictTrie(), jieba.GetHMMModel()) {
-        LoadStopWordDict(stopWordPath);
+    // shares `segment`, which must outlive the extractor
+    TextRankExtractor(const MixSegment* segment, const string& stopWordPath) {
+        Create(segment, stopWordPath);
+    }
+    // shares `segment` and `stopWords` too, which must have been created with the dict trie of `segment`
+    TextRankExtractor(const MixSegment* segment, const StopWords* stopWords) {
+        Create(segment, stopWords);
     }
     ~TextRankExtractor() {
     }
 
+    Error Create(const DictTrie* dictTrie, const HMMModel* model, const string& stopWordPath) {
+        ownSegment_.reset(new MixSegment(dictTrie, model));
+        return Create(ownSegment_.get(), stopWordPath);
+    }
+
+    Error Create(const MixSegment* segment, const string& stopWordPath) {
+        if (nullptr == segment) {
+            XLOG(ERROR) << "Got NULL MixSegment pointer ";
+            return Error::ValueError;
+        }
+        auto status = ownStopWords_.Create(stopWordPath, segment->GetDictTrie());
+        if (Error::Ok != status) {
+            XLOG(ERROR) << "failed to load stop words dict";
+            return status;
+        }
+        return Create(segment, &ownStopWords_);
+    }
+
+    Error Create(const MixSegment* segment, const StopWords* stopWords) {
+        if (nullptr == segment || nullptr == stopWords) {
+            XLOG(ERROR) << "Got NULL MixSegment or StopWords pointer ";
+            return Error::ValueError;
+        }
+        this->segment_ = segment;
+        this->stopWords_ = stopWords;
+        return Error::Ok;
+    }
+
     void Extract(const string& sentence, vector<string>& keywords, size_t topN) const {
         vector<Word> topWords;
         Extract(sentence, topWords, topN);
@@ -128,46 +192,108 @@ public:
         }
     }
 
-    void Extract(const string& sentence, vector<Word>& keywords, size_t topN, size_t span = 5, size_t rankTime = 10) const {
-        vector<string> words;
-        segment_.CutToStr(sentence, words);
+    // rankTime iterations at most, fewer once no weight moves by epsilon or more
+    void Extract(const string& sentence, vector<Word>& keywords, size_t topN, size_t span = 5, size_t rankTime = 10,
+                 double epsilon = 0) const {
+        keywords.clear();
 
-        TextRankExtractor::WordGraph graph;
-        WordMap wordmap;
-        size_t offset = 0;
+        if (nullptr == segment_) {
+            XLOG(ERROR) << "extractor not created";
+            return;
+        }
+
+        vector<cppjieba::Word> words;
+        segment_->CutToWord(sentence, words);
+
+        if ((words.empty() ? 0 : words.back().offset + words.back().word.size()) != sentence.size()) {
+            XLOG_RATE(ERROR, 10) << "words illegal";
+            return;
+        }
+
+        Extract(sentence, words, keywords, topN, span, rankTime, epsilon);
+    }
+
+    // `words` already cut from `sentence`, e.g. by Jieba::Cut when indexing it
+    void Extract(const string& sentence, const vector<cppjieba::Word>& words, vector<Word>& keywords, size_t topN,
+                 size_t span = 5, size_t rankTime = 10, double epsilon = 0) const {
+        keywords.clear();
+
+        if (nullptr == stopWords_) {
+            XLOG(ERROR) << "extractor not created";
+            return;
+        }
+
+        // node id of every word, NONE for the skipped ones
+        vector<uint32_t> ids(words.size(), NONE);
+        unordered_map<string, uint32_t> interned;
+        vector<const string*> nodes;
 
         for (size_t i = 0; i < words.size(); i++) {
-            size_t t = offset;
-            offset += words[i].size();
+            if (words[i].offset + words[i].word.size() > sentence.size()) {
+                XLOG(ERROR) << "word " << words[i].word << " out of the sentence";
+                return;
+            }
+
+            if (IsSingleWord(words[i].word) || stopWords_->IsStopWord(words[i].word)) {
+                continue;
+            }
+
+            auto it = interned.emplace(words[i].word, (uint32_t)nodes.size()).first;
+            if (it->second == nodes.size()) {
+                nodes.push_back(&it->first);
+            }
+            ids[i] = it->second;
+        }
 
-            if (IsSingleWord(words[i]) || stopWords_.find(words[i]) != stopWords_.end()) {
+        // the ids follow the order of the words, which is the order the ranks are updated in
+        vector<uint32_t> order(nodes.size());
+        vector<uint32_t> sorted(nodes.size());
+        for (uint32_t k = 0; k < order.size(); k++) {
+            order[k] = k;
+        }
+        sort(order.begin(), order.end(), [&](uint32_t lhs, uint32_t rhs) {
+            return *nodes[lhs] < *nodes[rhs];
+        });
+        for (uint32_t k = 0; k < order.size(); k++) {
+            sorted[order[k]] = k;
+        }
+        for (auto & id : ids) {
+            if (id != NONE) {
+                id = sorted[id];
+            }
+        }
+
+        TextRankExtractor::WordGraph graph(nodes.size());
+
+        for (size_t i = 0; i < words.size(); i++) {
+            if (ids[i] == NONE) {
                 continue;
             }
 
             for (size_t j = i + 1, skip = 0; j < i + span + skip && j < words.size(); j++) {
-                if (IsSingleWord(words[j]) || stopWords_.find(words[j]) != stopWords_.end()) {
+                if (ids[j] == NONE) {
                     skip++;
                     continue;
                 }
 
-                graph.addEdge(words[i], words[j], 1);
+                graph.addEdge(ids[i], ids[j], 1);
             }
-
-            wordmap[words[i]].offsets.push_back(t);
         }
 
-        if (offset != sentence.size()) {
-            XLOG(ERROR) << "words illegal";
-            return;
-        }
+        vector<double> ws(nodes.size(), 0);
+        graph.rank(ws, rankTime, epsilon);
 
-        graph.rank(wordmap, rankTime);
+        keywords.resize(nodes.size());
 
-        keywords.clear();
-        keywords.reserve(wordmap.size());
+        for (size_t k = 0; k < nodes.size(); k++) {
+            keywords[k].word = *nodes[order[k]];
+            keywords[k].weight = ws[k];
+        }
 
-        for (WordMap::iterator itr = wordmap.begin(); itr != wordmap.end(); ++itr) {
-            keywords.push_back(itr->second);
+        for (size_t i = 0; i < words.size(); i++) {
+            if (ids[i] != NONE) {
+                keywords[ids[i]].offsets.push_back(words[i].offset);
+            }
         }
 
         topN = min(topN, keywords.size());
@@ -175,24 +301,16 @@ public:
         keywords.resize(topN);
     }
 private:
-    void LoadStopWordDict(const string& filePath) {
-        ifstream ifs(filePath.c_str());
-        XCHECK(ifs.is_open()) << "open " << filePath << " failed";
-        string line ;
-
-        while (getline(ifs, line)) {
-            stopWords_.insert(line);
-        }
-
-        assert(stopWords_.size());
-    }
+    enum : uint32_t { NONE = UINT32_MAX };
 
     static bool Compare(const Word &x, const Word &y) {
         return x.weight > y.weight;
     }
 
-    MixSegment segment_;
-    unordered_set<string> stopWords_;
+    unique_ptr<MixSegment> ownSegment_;
+    const MixSegment* segment_ = nullptr;
+    StopWords ownStopWords_;
+    const StopWords* stopWords_ = nullptr;
 }; // class TextRankExtractor
 
 inline ostream& operator << (ostream& os, const TextRankExtractor::Word& word) {
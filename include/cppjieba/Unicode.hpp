@@ -52,16 +52,46 @@ inline std::ostream& operator << (std::ostream& os, const RuneInfo& r) {
     return os << "{\"rune\": \"" << r.rune << "\", \"offset\": " << r.offset << ", \"len\": " << r.len << "}";
 }
 
+// set of runes as a bitmap, sized by the largest rune inserted (8KB for the whole BMP)
+class RuneBitmap {
+public:
+    void Insert(Rune r) {
+        if (r / 64 >= bits_.size()) {
+            bits_.resize(r / 64 + 1, 0);
+        }
+
+        bits_[r / 64] |= uint64_t(1) << (r % 64);
+    }
+
+    bool Contains(Rune r) const {
+        return r / 64 < bits_.size() && ((bits_[r / 64] >> (r % 64)) & 1);
+    }
+
+    void Clear() {
+        bits_.clear();
+    }
+
+private:
+    vector<uint64_t> bits_;
+}; // class RuneBitmap
+
 typedef limonp::LocalVector<Rune> RuneArray;
 typedef limonp::LocalVector<struct RuneInfo> RuneStrArray;
 
+struct DatMemElem;
+
 // [left, right]
 struct WordRange {
     RuneStrArray::const_iterator left;
     RuneStrArray::const_iterator right;
+    // the dictionary entry the segment matched, nullptr for the words it did not take from the dictionary
+    const DatMemElem* elem = nullptr;
     WordRange(RuneStrArray::const_iterator l, RuneStrArray::const_iterator r)
         : left(l), right(r) {
     }
+    WordRange(RuneStrArray::const_iterator l, RuneStrArray::const_iterator r, const DatMemElem* e)
+        : left(l), right(r), elem(e) {
+    }
     size_t Length() const {
         return right - left + 1;
     }
@@ -89,10 +119,10 @@ inline RuneArray DecodeRunesInString(const string& s) {
     return result;
 }
 
-inline bool DecodeRunesInString(const string& s, RuneStrArray& runes) {
+inline bool DecodeRunesInString(const char* s, size_t len, RuneStrArray& runes) {
     RuneArray arr;
 
-    if (not DecodeRunesInString(s, arr)) {
+    if (not limonp::Utf8ToUnicode32(s, len, arr)) {
         return false;
     }
 
@@ -110,6 +140,10 @@ inline bool DecodeRunesInString(const string& s, RuneStrArray& runes) {
     return true;
 }
 
+inline bool DecodeRunesInString(const string& s, RuneStrArray& runes) {
+    return DecodeRunesInString(s.data(), s.size(), runes);
+}
+
 class RunePtrWrapper {
 public:
     const RuneInfo * m_ptr = nullptr;
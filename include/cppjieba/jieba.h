@@ -0,0 +1,96 @@
+#ifndef CPPJIEBA_JIEBA_H
+#define CPPJIEBA_JIEBA_H
+
+/*
+ * C API of libjieba, for the bindings of other languages (cgo, ctypes, cffi...).
+ *
+ * A call cuts a whole batch of documents and answers with the words as byte ranges of their document, in two flat
+ * arrays: the tokens of all the documents one after the other, and the index of the first token of each document.
+ * The arrays belong to the caller, who frees them with jieba_free_result. A result passed again to jieba_cut_batch is
+ * reused, its arrays only grow when the batch does not fit, so that a caller cutting batch after batch into the same
+ * result does not allocate once warmed up.
+ *
+ *   jieba_t* jieba = jieba_new("dict/jieba.dict.utf8", "dict/hmm_model.utf8", "dict/user.dict.utf8");
+ *   jieba_result_t result = JIEBA_RESULT_INIT;
+ *
+ *   if (jieba_cut_batch(jieba, docs, lens, doc_num, JIEBA_CUT_MIX, 1, &result) == JIEBA_OK) {
+ *       for (size_t i = 0; i < result.doc_num; i++) {
+ *           for (size_t j = result.doc_index[i]; j < result.doc_index[i + 1]; j++) {
+ *               // docs[i] + result.tokens[j].offset, result.tokens[j].length bytes
+ *           }
+ *       }
+ *   }
+ *
+ *   jieba_free_result(&result);
+ *   jieba_free(jieba);
+ *
+ * A jieba_t may be shared by threads, each cutting into a result of its own.
+ * */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#if defined(JIEBA_BUILDING)
+#define JIEBA_API __declspec(dllexport)
+#else
+#define JIEBA_API __declspec(dllimport)
+#endif
+#else
+#define JIEBA_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct jieba_t jieba_t;
+
+typedef enum {
+    JIEBA_CUT_MIX = 0,   /* Cut, MP then HMM for the unknown words unless hmm is 0 */
+    JIEBA_CUT_HMM = 1,   /* CutHMM */
+    JIEBA_CUT_FULL = 2,  /* CutAll, every dictionary word, which may overlap */
+    JIEBA_CUT_QUERY = 3, /* CutForSearch, the words then their sub-words */
+} jieba_cut_method_t;
+
+enum {
+    JIEBA_OK = 0,
+    JIEBA_ERROR_ARGUMENT = 1,      /* null pointer, unknown method or document over 4GB, the result is emptied */
+    JIEBA_ERROR_DECODE = 2,        /* some documents are not UTF-8 and have no token, the others are cut */
+    JIEBA_ERROR_OUT_OF_MEMORY = 3, /* the result is emptied */
+};
+
+/* a word, in bytes of its document */
+typedef struct {
+    uint32_t offset;
+    uint32_t length;
+} jieba_token_t;
+
+typedef struct {
+    jieba_token_t* tokens; /* of all the documents, one after the other */
+    size_t token_num;
+    size_t* doc_index;     /* doc_num + 1 entries, the tokens of document i are [doc_index[i], doc_index[i + 1]) */
+    size_t doc_num;
+    size_t token_capacity; /* of the arrays, kept by jieba_cut_batch between the calls */
+    size_t doc_capacity;
+} jieba_result_t;
+
+#define JIEBA_RESULT_INIT {NULL, 0, NULL, 0, 0, 0}
+
+/* NULL if a dictionary or the model could not be loaded, user_dict_path may be NULL or "" */
+JIEBA_API jieba_t* jieba_new(const char* dict_path, const char* hmm_path, const char* user_dict_path);
+
+JIEBA_API void jieba_free(jieba_t* jieba);
+
+/* cuts the doc_num documents docs[i] of lens[i] bytes, which need not be null-terminated, with `method` */
+JIEBA_API int jieba_cut_batch(const jieba_t* jieba, const char* const* docs, const size_t* lens, size_t doc_num,
+                              jieba_cut_method_t method, int hmm, jieba_result_t* result);
+
+/* frees the arrays of `result`, which is then empty and may be reused */
+JIEBA_API void jieba_free_result(jieba_result_t* result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CPPJIEBA_JIEBA_H */
@@ -0,0 +1,176 @@
+#define JIEBA_BUILDING
+
+#include <cstdlib>
+#include "cppjieba/jieba.h"
+#include "cppjieba/Jieba.hpp"
+
+using namespace cppjieba;
+
+struct jieba_t {
+    jieba_t(const char* dict_path, const char* hmm_path, const char* user_dict_path)
+        : jieba(dict_path, hmm_path, user_dict_path ? user_dict_path : "") {
+    }
+
+    Jieba jieba;
+};
+
+namespace {
+
+// grows `*array` to hold `size` items at least, keeping its content
+template <class T>
+bool Reserve(T** array, size_t& capacity, size_t size) {
+    if (size <= capacity) {
+        return true;
+    }
+
+    size_t grown = capacity < 64 ? 64 : capacity;
+
+    while (grown < size) {
+        grown *= 2;
+    }
+
+    T* p = (T*)realloc(*array, grown * sizeof(T));
+
+    if (p == nullptr) {
+        return false;
+    }
+
+    *array = p;
+    capacity = grown;
+    return true;
+}
+
+const SegmentBase* GetSegment(const Jieba& jieba, jieba_cut_method_t method) {
+    switch (method) {
+        case JIEBA_CUT_MIX:
+            return jieba.GetMixSegment();
+
+        case JIEBA_CUT_HMM:
+            return jieba.GetHMMSegment();
+
+        case JIEBA_CUT_FULL:
+            return jieba.GetFullSegment();
+
+        case JIEBA_CUT_QUERY:
+            return jieba.GetQuerySegment();
+
+        default:
+            return nullptr;
+    }
+}
+
+int CutBatch(const jieba_t* jieba, const char* const* docs, const size_t* lens, size_t doc_num,
+             jieba_cut_method_t method, int hmm, jieba_result_t* result) {
+    if (result == nullptr) {
+        return JIEBA_ERROR_ARGUMENT;
+    }
+
+    result->token_num = 0;
+    result->doc_num = 0;
+
+    const SegmentBase* segment = jieba ? GetSegment(jieba->jieba, method) : nullptr;
+
+    if (segment == nullptr || (doc_num > 0 && (docs == nullptr || lens == nullptr))) {
+        return JIEBA_ERROR_ARGUMENT;
+    }
+
+    for (size_t i = 0; i < doc_num; i++) {
+        if (lens[i] > UINT32_MAX || (docs[i] == nullptr && lens[i] > 0)) {
+            return JIEBA_ERROR_ARGUMENT;
+        }
+    }
+
+    if (!Reserve(&result->doc_index, result->doc_capacity, doc_num + 1)) {
+        return JIEBA_ERROR_OUT_OF_MEMORY;
+    }
+
+    int status = JIEBA_OK;
+    RuneStrArray runes;
+    vector<WordRange> wrs;
+    size_t token_num = 0;
+
+    for (size_t i = 0; i < doc_num; i++) {
+        result->doc_index[i] = token_num;
+        wrs.clear();
+
+        if (!DecodeRunesInString(docs[i], lens[i], runes)) {
+            status = JIEBA_ERROR_DECODE;
+            continue;
+        }
+
+        segment->CutToRanges(runes.begin(), runes.end(), wrs, hmm != 0);
+
+        if (!Reserve(&result->tokens, result->token_capacity, token_num + wrs.size())) {
+            return JIEBA_ERROR_OUT_OF_MEMORY;
+        }
+
+        for (const auto & wr : wrs) {
+            jieba_token_t& token = result->tokens[token_num++];
+            token.offset = wr.left->offset;
+            token.length = wr.right->offset + wr.right->len - wr.left->offset;
+        }
+    }
+
+    result->doc_index[doc_num] = token_num;
+    result->token_num = token_num;
+    result->doc_num = doc_num;
+    return status;
+}
+
+} // namespace
+
+extern "C" {
+
+jieba_t* jieba_new(const char* dict_path, const char* hmm_path, const char* user_dict_path) {
+    if (dict_path == nullptr || hmm_path == nullptr) {
+        return nullptr;
+    }
+
+    jieba_t* jieba = nullptr;
+
+    try {
+        jieba = new jieba_t(dict_path, hmm_path, user_dict_path);
+    } catch (...) {
+        // std::bad_alloc, of the jieba_t or of the loading
+        return nullptr;
+    }
+
+    // the constructors log the errors and leave the dictionary or the model empty
+    if (jieba->jieba.GetDictTrie()->GetElementsNum() == 0 || jieba->jieba.GetHMMModel()->emitProbB.empty()) {
+        delete jieba;
+        return nullptr;
+    }
+
+    return jieba;
+}
+
+void jieba_free(jieba_t* jieba) {
+    delete jieba;
+}
+
+int jieba_cut_batch(const jieba_t* jieba, const char* const* docs, const size_t* lens, size_t doc_num,
+                    jieba_cut_method_t method, int hmm, jieba_result_t* result) {
+    // no exception may cross into C: the ones of the segments are std::bad_alloc of their buffers
+    try {
+        return CutBatch(jieba, docs, lens, doc_num, method, hmm, result);
+    } catch (...) {
+        if (result != nullptr) {
+            result->token_num = 0;
+            result->doc_num = 0;
+        }
+
+        return JIEBA_ERROR_OUT_OF_MEMORY;
+    }
+}
+
+void jieba_free_result(jieba_result_t* result) {
+    if (result == nullptr) {
+        return;
+    }
+
+    free(result->tokens);
+    free(result->doc_index);
+    *result = JIEBA_RESULT_INIT;
+}
+
+} // extern "C"
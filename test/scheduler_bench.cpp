@@ -0,0 +1,102 @@
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include "cppjieba/KeywordExtractor.hpp"
+#include "cppjieba/TaskScheduler.hpp"
+#include "limonp/ThreadPool.hpp"
+#include "limonp/Colors.hpp"
+
+using namespace cppjieba;
+
+const char* const DICT_PATH = "../dict/jieba.dict.utf8";
+const char* const HMM_PATH = "../dict/hmm_model.utf8";
+const char* const USER_DICT_PATH = "../dict/user.dict.utf8";
+const char* const IDF_PATH = "../dict/idf.utf8";
+const char* const STOP_WORD_PATH = "../dict/stop_words.utf8";
+
+const size_t TASK_NUM = 1 << 20;
+
+static double Seconds(std::chrono::steady_clock::time_point begin) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+static void Tiny(std::atomic<size_t>* count) {
+    count->fetch_add(1, std::memory_order_relaxed);
+}
+
+// one closure per task through the mutex of the bounded queue
+double ThreadPoolTiny(size_t threadNum) {
+    std::atomic<size_t> count(0);
+    auto begin = std::chrono::steady_clock::now();
+    {
+        limonp::ThreadPool pool(threadNum);
+        pool.Start();
+
+        for (size_t i = 0; i < TASK_NUM; i++) {
+            pool.Add(limonp::NewClosure(Tiny, &count));
+        }
+    }
+    assert(count.load() == TASK_NUM);
+    return Seconds(begin);
+}
+
+// tasks of a single item, split by the workers themselves
+double SchedulerTiny(size_t threadNum) {
+    std::atomic<size_t> count(0);
+    auto begin = std::chrono::steady_clock::now();
+    {
+        TaskScheduler scheduler(threadNum);
+        scheduler.ParallelFor(0, TASK_NUM, 1, [&](size_t b, size_t e, size_t) {
+            for (size_t i = b; i < e; i++) {
+                Tiny(&count);
+            }
+        });
+    }
+    assert(count.load() == TASK_NUM);
+    return Seconds(begin);
+}
+
+double ExtractBatch(const KeywordExtractor& extractor, const vector<string>& docs, size_t threadNum) {
+    TaskScheduler scheduler(threadNum);
+    vector<vector<KeywordExtractor::Word> > keywords;
+    auto begin = std::chrono::steady_clock::now();
+    extractor.ExtractBatch(scheduler, docs, 5, keywords);
+    return Seconds(begin);
+}
+
+int main(int argc, char** argv) {
+    const size_t maxThreadNum = argc > 1 ? atoi(argv[1]) : 64;
+    DictTrie trie(DICT_PATH, USER_DICT_PATH);
+    HMMModel model(HMM_PATH);
+    KeywordExtractor extractor(&trie, &model, IDF_PATH, STOP_WORD_PATH);
+
+    vector<string> lines;
+    ifstream ifs("../test/testdata/review.100");
+    assert(ifs);
+    string line;
+
+    while (getline(ifs, line)) {
+        lines.push_back(line);
+    }
+
+    vector<string> docs;
+
+    for (size_t i = 0; i < 100; i++) {
+        docs.insert(docs.end(), lines.begin(), lines.end());
+    }
+
+    printf("%8s %16s %16s %16s\n", "threads", "ThreadPool", "TaskScheduler", "ExtractBatch");
+
+    for (size_t threadNum = 1; threadNum <= maxThreadNum; threadNum *= 2) {
+        const double pool = ThreadPoolTiny(threadNum);
+        const double scheduler = SchedulerTiny(threadNum);
+        const double batch = ExtractBatch(extractor, docs, threadNum);
+        printf("%8zu %13.2lf M/s %13.2lf M/s %12.0lf docs/s\n", threadNum,
+               TASK_NUM / pool / 1e6, TASK_NUM / scheduler / 1e6, docs.size() / batch);
+    }
+
+    ColorPrintln(GREEN, "tasks/s of %zu tiny tasks, documents/s of ExtractBatch over %zu documents", TASK_NUM,
+                 docs.size());
+    return EXIT_SUCCESS;
+}
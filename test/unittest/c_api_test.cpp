@@ -0,0 +1,99 @@
+#include "cppjieba/jieba.h"
+#include "cppjieba/Jieba.hpp"
+#include "gtest/gtest.h"
+
+using namespace cppjieba;
+
+static vector<string> ToWords(const string& doc, const jieba_result_t& result, size_t i) {
+  vector<string> words;
+  for (size_t j = result.doc_index[i]; j < result.doc_index[i + 1]; j++) {
+    words.push_back(doc.substr(result.tokens[j].offset, result.tokens[j].length));
+  }
+  return words;
+}
+
+TEST(CApiTest, CutBatch) {
+  const char* const dict = "../test/testdata/extra_dict/jieba.dict.small.utf8";
+  const char* const hmm = "../dict/hmm_model.utf8";
+  const char* const user = "../dict/user.dict.utf8";
+  jieba_t* jieba = jieba_new(dict, hmm, user);
+  ASSERT_TRUE(jieba != NULL);
+  Jieba expected_jieba(dict, hmm, user);
+
+  const vector<string> docs = {
+    "我来自北京邮电大学。。。学号123456，用AK47",
+    "",
+    "南京市长江大桥",
+    "他来到了网易杭研大厦",
+  };
+  vector<const char*> ptrs;
+  vector<size_t> lens;
+  for (const auto & doc : docs) {
+    ptrs.push_back(doc.data());
+    lens.push_back(doc.size());
+  }
+
+  jieba_result_t result = JIEBA_RESULT_INIT;
+  vector<string> expected;
+
+  ASSERT_EQ(JIEBA_OK, jieba_cut_batch(jieba, ptrs.data(), lens.data(), docs.size(), JIEBA_CUT_MIX, 1, &result));
+  ASSERT_EQ(docs.size(), result.doc_num);
+  ASSERT_EQ(result.doc_index[docs.size()], result.token_num);
+  for (size_t i = 0; i < docs.size(); i++) {
+    expected_jieba.Cut(docs[i], expected);
+    ASSERT_EQ(expected, ToWords(docs[i], result, i));
+  }
+
+  // the arrays are reused
+  const jieba_token_t* tokens = result.tokens;
+  ASSERT_EQ(JIEBA_OK, jieba_cut_batch(jieba, ptrs.data(), lens.data(), docs.size(), JIEBA_CUT_MIX, 0, &result));
+  ASSERT_EQ(tokens, result.tokens);
+  for (size_t i = 0; i < docs.size(); i++) {
+    expected_jieba.Cut(docs[i], expected, false);
+    ASSERT_EQ(expected, ToWords(docs[i], result, i));
+  }
+
+  ASSERT_EQ(JIEBA_OK, jieba_cut_batch(jieba, ptrs.data(), lens.data(), docs.size(), JIEBA_CUT_HMM, 1, &result));
+  for (size_t i = 0; i < docs.size(); i++) {
+    expected_jieba.CutHMM(docs[i], expected);
+    ASSERT_EQ(expected, ToWords(docs[i], result, i));
+  }
+
+  ASSERT_EQ(JIEBA_OK, jieba_cut_batch(jieba, ptrs.data(), lens.data(), docs.size(), JIEBA_CUT_FULL, 1, &result));
+  for (size_t i = 0; i < docs.size(); i++) {
+    expected_jieba.CutAll(docs[i], expected);
+    ASSERT_EQ(expected, ToWords(docs[i], result, i));
+  }
+
+  ASSERT_EQ(JIEBA_OK, jieba_cut_batch(jieba, ptrs.data(), lens.data(), docs.size(), JIEBA_CUT_QUERY, 1, &result));
+  for (size_t i = 0; i < docs.size(); i++) {
+    expected_jieba.CutForSearch(docs[i], expected);
+    ASSERT_EQ(expected, ToWords(docs[i], result, i));
+  }
+
+  // a document which is not UTF-8 has no token, the others are cut
+  const char* bad[] = {"\xff\xfe", "南京市长江大桥"};
+  const size_t bad_lens[] = {2, strlen(bad[1])};
+  ASSERT_EQ(JIEBA_ERROR_DECODE, jieba_cut_batch(jieba, bad, bad_lens, 2, JIEBA_CUT_MIX, 1, &result));
+  ASSERT_EQ(2u, result.doc_num);
+  ASSERT_EQ(0u, result.doc_index[1]);
+  expected_jieba.Cut(bad[1], expected);
+  ASSERT_EQ(expected, ToWords(bad[1], result, 1));
+
+  ASSERT_EQ(JIEBA_ERROR_ARGUMENT, jieba_cut_batch(jieba, ptrs.data(), lens.data(), docs.size(),
+                                                  (jieba_cut_method_t)42, 1, &result));
+  ASSERT_EQ(0u, result.doc_num);
+  ASSERT_EQ(JIEBA_ERROR_ARGUMENT, jieba_cut_batch(NULL, ptrs.data(), lens.data(), docs.size(), JIEBA_CUT_MIX, 1,
+                                                  &result));
+
+  ASSERT_EQ(JIEBA_OK, jieba_cut_batch(jieba, NULL, NULL, 0, JIEBA_CUT_MIX, 1, &result));
+  ASSERT_EQ(0u, result.doc_num);
+  ASSERT_EQ(0u, result.doc_index[0]);
+
+  jieba_free_result(&result);
+  ASSERT_TRUE(result.tokens == NULL);
+  ASSERT_TRUE(result.doc_index == NULL);
+  jieba_free(jieba);
+
+  ASSERT_TRUE(jieba_new("/not/exists", hmm, NULL) == NULL);
+}
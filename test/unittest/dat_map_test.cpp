@@ -0,0 +1,48 @@
+#include "cppjieba/Jieba.hpp"
+#include "cppjieba/PageFaults.hpp"
+#include "gtest/gtest.h"
+
+using namespace cppjieba;
+
+TEST(DatMapTest, Remap) {
+  const string text = "我来自北京邮电大学。。。学号123456，用AK47";
+  vector<string> expected;
+  vector<string> words;
+
+  {
+    Jieba jieba("../test/testdata/extra_dict/jieba.dict.small.utf8",
+                "../dict/hmm_model.utf8",
+                "../dict/user.dict.utf8");
+    jieba.Cut(text, expected);
+  }
+
+  const DatHugePages huge_pages[] = {HugePagesNone, HugePagesTransparent, HugePagesExplicit};
+
+  for (DatHugePages huge : huge_pages) {
+    Jieba jieba("../test/testdata/extra_dict/jieba.dict.small.utf8",
+                "../dict/hmm_model.utf8",
+                "../dict/user.dict.utf8");
+    const size_t elements_num = jieba.GetDictTrie()->GetElementsNum();
+    const double min_weight = jieba.GetDictTrie()->GetMinWeight();
+
+    DatMapOptions options;
+    options.populate = true;
+    options.huge_pages = huge;
+    ASSERT_EQ(Error::Ok, jieba.SetDictMapOptions(options));
+    ASSERT_EQ(elements_num, jieba.GetDictTrie()->GetElementsNum());
+    ASSERT_EQ(min_weight, jieba.GetDictTrie()->GetMinWeight());
+    ASSERT_TRUE(jieba.Find("北京邮电大学"));
+
+    jieba.WarmUp({text, "南京市长江大桥"});
+    jieba.Cut(text, words);
+    ASSERT_EQ(expected, words);
+  }
+}
+
+TEST(DatMapTest, PageFaults) {
+  const PageFaults before = PageFaults::OfProcess();
+  const size_t size = 64 << 20;
+  vector<char> touched(size, 1);
+  const PageFaults faults = PageFaults::OfProcess() - before;
+  ASSERT_LE(size / (2 << 20), faults.minor + faults.major);
+}
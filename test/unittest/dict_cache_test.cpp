@@ -0,0 +1,254 @@
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <thread>
+#include "cppjieba/DictTrie.hpp"
+#include "gtest/gtest.h"
+
+using namespace cppjieba;
+
+static void CopyFile(const string& from, const string& to) {
+  ifstream ifs(from.c_str());
+  ofstream ofs(to.c_str());
+  ofs << ifs.rdbuf();
+}
+
+static void WriteFile(const string& path, const string& content) {
+  ofstream ofs(path.c_str());
+  ofs << content;
+}
+
+static size_t CountCaches(const string& dir) {
+  size_t count = 0;
+  DIR* d = opendir(dir.c_str());
+
+  for (struct dirent* entry = readdir(d); entry != nullptr; entry = readdir(d)) {
+    const string name = entry->d_name;
+    count += name.size() > 10 && name.compare(name.size() - 10, 10, ".dat_cache") == 0;
+  }
+
+  closedir(d);
+  return count;
+}
+
+class DictCacheTest : public testing::Test {
+protected:
+  void SetUp() override {
+    char dir[] = "/tmp/dict_cache_test_XXXXXX";
+    ASSERT_TRUE(mkdtemp(dir) != nullptr);
+    dir_ = dir;
+    dict_ = dir_ + "/jieba.dict.utf8";
+    user_dict_ = dir_ + "/user.dict.utf8";
+    CopyFile("../test/testdata/extra_dict/jieba.dict.small.utf8", dict_);
+    WriteFile(user_dict_, "蓝翔 nz\n龢\n");
+    WriteFile(dir_ + "/user.2.dict.utf8", "区块链 10 nz\n");
+  }
+
+  void TearDown() override {
+    ASSERT_EQ(0, system(("rm -rf " + dir_).c_str()));
+  }
+
+  string dir_;
+  string dict_;
+  string user_dict_;
+};
+
+TEST_F(DictCacheTest, WarmStart) {
+  const string user_dicts = user_dict_ + ";" + dir_ + "/user.2.dict.utf8";
+  DictTrie cold(dict_, user_dicts);
+  ASSERT_EQ(3u, CountCaches(dir_));
+
+  DictTrie warm(dict_, user_dicts);
+  ASSERT_EQ(3u, CountCaches(dir_));
+
+  ASSERT_EQ(cold.GetElementsNum(), warm.GetElementsNum());
+  ASSERT_EQ(cold.GetMd5(), warm.GetMd5());
+  ASSERT_EQ(cold.GetTotalDictSize(), warm.GetTotalDictSize());
+  ASSERT_EQ(cold.GetMinWeight(), warm.GetMinWeight());
+  ASSERT_TRUE(warm.Find("蓝翔") != nullptr);
+  ASSERT_TRUE(warm.Find("区块链") != nullptr);
+
+  // from the runes stored in the cache, the user dicts are not read
+  RuneArray runes;
+  ASSERT_TRUE(DecodeRunesInString("龢", runes));
+  ASSERT_TRUE(cold.IsUserDictSingleChineseWord(runes[0]));
+  ASSERT_TRUE(warm.IsUserDictSingleChineseWord(runes[0]));
+  ASSERT_TRUE(DecodeRunesInString("蓝", runes));
+  ASSERT_FALSE(warm.IsUserDictSingleChineseWord(runes[0]));
+}
+
+TEST_F(DictCacheTest, RebuildOnChange) {
+  {
+    DictTrie trie(dict_, user_dict_);
+    ASSERT_TRUE(trie.Find("区块链") == nullptr);
+  }
+
+  // a second apart at least, for the file systems of coarse mtimes
+  struct timeval times[2] = {{1000000000, 0}, {1000000000, 0}};
+  WriteFile(user_dict_, "区块链 nz\n");
+  ASSERT_EQ(0, utimes(user_dict_.c_str(), times));
+
+  DictTrie trie(dict_, user_dict_);
+  ASSERT_EQ(3u, CountCaches(dir_));
+  ASSERT_TRUE(trie.Find("区块链") != nullptr);
+  ASSERT_TRUE(trie.Find("蓝翔") == nullptr);
+
+  RuneArray runes;
+  ASSERT_TRUE(DecodeRunesInString("龢", runes));
+  ASSERT_FALSE(trie.IsUserDictSingleChineseWord(runes[0]));
+}
+
+TEST_F(DictCacheTest, Layers) {
+  const string cache = dir_ + "/jieba.dat_cache";
+  struct stat st;
+  ino_t base = 0;
+
+  {
+    DictTrie trie(dict_, user_dict_, cache);
+    ASSERT_EQ(1u, trie.GetUserLayerNum());
+    ASSERT_EQ(0, stat(cache.c_str(), &st));
+    base = st.st_ino;
+  }
+
+  // 一个 of the default weight loses to the heavier entry of the base, 我们 of a higher frequency wins
+  struct timeval times[2] = {{1000000000, 0}, {1000000000, 0}};
+  WriteFile(user_dict_, "一个 m\n我们 100000000 x\n蓝翔 nz\n");
+  ASSERT_EQ(0, utimes(user_dict_.c_str(), times));
+
+  DictTrie plain(dict_);
+  DictTrie trie(dict_, user_dict_, cache);
+  ASSERT_EQ(0, stat(cache.c_str(), &st));
+  ASSERT_EQ(base, st.st_ino);
+  ASSERT_EQ(plain.GetElementsNum() + 3, trie.GetElementsNum());
+
+  ASSERT_EQ(plain.GetElementIndex(plain.Find("一个")), trie.GetElementIndex(trie.Find("一个")));
+  ASSERT_EQ(plain.GetElementsNum() + 1, trie.GetElementIndex(trie.Find("我们")));
+  ASSERT_EQ("x", trie.Find("我们")->GetTag());
+  ASSERT_EQ(plain.GetElementsNum() + 2, trie.GetElementIndex(trie.Find("蓝翔")));
+
+  // the DAG of the layers merged, ordered by the end of the words
+  const string text = "我们蓝翔";
+  DatDag dag;
+  trie.Find(text.c_str(), text.size(), 0, dag);
+  ASSERT_EQ(2u, dag.nexts.size());
+  ASSERT_EQ(2u, dag.nexts[1].first);
+  ASSERT_EQ(trie.Find("我们"), dag.nexts[1].second);
+
+  DatDag next;
+  trie.Find(text.c_str() + 6, text.size() - 6, 2, next);
+  ASSERT_EQ(2u, next.nexts.size());
+  ASSERT_EQ(3u, next.nexts[0].first);
+  ASSERT_EQ(4u, next.nexts[1].first);
+  ASSERT_EQ(trie.Find("蓝翔"), next.nexts[1].second);
+}
+
+TEST_F(DictCacheTest, ValidateMd5) {
+  DictTrie fingerprint(dict_, user_dict_);
+  DictTrie cold(dict_, user_dict_, "", DictTrie::WordWeightMedian, DictTrie::ValidateMd5);
+  DictTrie warm(dict_, user_dict_, "", DictTrie::WordWeightMedian, DictTrie::ValidateMd5);
+  ASSERT_EQ(4u, CountCaches(dir_));
+
+  ASSERT_EQ(fingerprint.GetMd5(), warm.GetMd5());
+  ASSERT_EQ(cold.GetElementsNum(), warm.GetElementsNum());
+
+  RuneArray runes;
+  ASSERT_TRUE(DecodeRunesInString("龢", runes));
+  ASSERT_TRUE(warm.IsUserDictSingleChineseWord(runes[0]));
+}
+
+TEST_F(DictCacheTest, SingleBuilder) {
+  const string cache = dir_ + "/jieba.dat_cache";
+  const string temp = CacheLock::GetTempFileTemplate(cache);
+  const string owner = temp.substr(0, temp.rfind('.') + 1);
+  const pid_t dead = fork();
+  ASSERT_GE(dead, 0);
+  if (dead == 0) {
+    _exit(0);
+  }
+  ASSERT_EQ(dead, waitpid(dead, nullptr, 0));
+
+  // only the ones of a process which is gone are stale, a builder which timed out may be writing the others
+  const string stale = owner + std::to_string(dead) + "_Ab12Cd";
+  const string others[] = {owner + std::to_string(getppid()) + "_Ab12Cd", owner + std::to_string(dead) + "_Ab12Cd.bak",
+                           cache + "_Ab12Cd"};
+  WriteFile(stale, "left by a builder killed before its rename");
+  for (const auto & other : others) {
+    WriteFile(other, "");
+  }
+
+  CacheLock lock(cache);
+  ASSERT_TRUE(lock.Lock());
+
+  // blocks on the lock of the parent, then builds the cache or attaches to the one the parent built
+  const pid_t pid = fork();
+  ASSERT_GE(pid, 0);
+
+  if (pid == 0) {
+    CacheLock child_lock(cache);
+    const bool locked = child_lock.Lock(0);
+    child_lock.UnLock();
+    DictTrie trie(dict_, user_dict_, cache);
+    _exit(!locked && trie.GetElementsNum() > 0 ? 0 : 1);
+  }
+
+  usleep(100 * 1000);
+  struct stat st;
+  ASSERT_NE(0, stat(cache.c_str(), &st));
+
+  // the threads of the holder wait for it as well, so it lets go before building
+  lock.UnLock();
+
+  {
+    DictTrie trie(dict_, user_dict_, cache);
+    ASSERT_LT(0u, trie.GetElementsNum());
+  }
+
+  ASSERT_EQ(0, stat(cache.c_str(), &st));
+  const ino_t built = st.st_ino;
+  ASSERT_NE(0, access(stale.c_str(), F_OK));
+  for (const auto & other : others) {
+    ASSERT_EQ(0, access(other.c_str(), F_OK));
+  }
+
+  int status = 0;
+  ASSERT_EQ(pid, waitpid(pid, &status, 0));
+  ASSERT_TRUE(WIFEXITED(status));
+  ASSERT_EQ(0, WEXITSTATUS(status));
+
+  ASSERT_EQ(0, stat(cache.c_str(), &st));
+  ASSERT_EQ(built, st.st_ino);
+}
+
+TEST_F(DictCacheTest, SingleBuilderThreads) {
+  const string cache = dir_ + "/jieba.dat_cache";
+  const size_t expected = DictTrie(dict_, user_dict_).GetElementsNum();
+  vector<std::thread> threads;
+  vector<size_t> elements(4, 0);
+
+  // the fcntl lock does not exclude the threads of a process, the mutex of the cache path does
+  for (size_t i = 0; i < elements.size(); i++) {
+    threads.emplace_back([&, i]() {
+      DictTrie trie(dict_, user_dict_, cache);
+      elements[i] = trie.GetElementsNum();
+    });
+  }
+
+  for (auto & thread : threads) {
+    thread.join();
+  }
+
+  ASSERT_EQ(vector<size_t>(4, expected), elements);
+
+  // the threads of the paths of the same cache wait for each other too
+  CacheLock lock(cache);
+  ASSERT_TRUE(lock.Lock());
+  CacheLock other(dir_ + "/../" + dir_.substr(dir_.rfind('/') + 1) + "/jieba.dat_cache");
+  std::thread waiter([&other]() {
+    ASSERT_FALSE(other.Lock(100));
+  });
+  waiter.join();
+  lock.UnLock();
+  ASSERT_TRUE(other.Lock(0));
+}
@@ -4,10 +4,10 @@
 using namespace cppjieba;
 
 TEST(JiebaTest, Test1) {
-  cppjieba::Jieba jieba("../dict/jieba.dict.utf8",
+  cppjieba::Jieba jieba("../test/testdata/extra_dict/jieba.dict.small.utf8",
                         "../dict/hmm_model.utf8",
                         "../dict/user.dict.utf8",
-                        "../dict/idf.utf8",
+                        "../test/testdata/idf.small.utf8",
                         "../dict/stop_words.utf8");
   vector<string> words;
   string result;
@@ -33,18 +33,37 @@ TEST(JiebaTest, Test1) {
 
   jieba.CutAll("我来自北京邮电大学", words);
   result << words;
-  ASSERT_EQ(result, "[\"我\", \"来自\", \"北京\", \"北京邮电\", \"北京邮电大学\", \"邮电\", \"邮电大学\", \"电大\", \"大学\"]");
+  ASSERT_EQ(result, "[\"我\", \"来自\", \"北京\", \"北京邮电大学\", \"邮电\", \"电大\", \"大学\"]");
 
   jieba.CutForSearch("他来到了网易杭研大厦", words);
   result << words;
   ASSERT_EQ("[\"他\", \"来到\", \"了\", \"网易\", \"杭研\", \"大厦\"]", result);
 
 }
+TEST(JiebaTest, TagHMM) {
+  cppjieba::Jieba jieba("../test/testdata/extra_dict/jieba.dict.small.utf8",
+                        "../dict/hmm_model.utf8",
+                        "");
+  vector<pair<string, string> > tags;
+  ASSERT_FALSE(jieba.TagHMM("我是拖拉机学院手扶拖拉机专业的", tags));
+  ASSERT_TRUE(tags.empty());
+
+  cppjieba::Jieba tagger("../test/testdata/extra_dict/jieba.dict.small.utf8",
+                         "../dict/hmm_model.utf8",
+                         "",
+                         "",
+                         "",
+                         "",
+                         "../dict/pos_dict");
+  ASSERT_TRUE(tagger.TagHMM("我是拖拉机学院手扶拖拉机专业的", tags));
+  ASSERT_FALSE(tags.empty());
+}
+
 TEST(JiebaTest, WordTest) {
-  cppjieba::Jieba jieba("../dict/jieba.dict.utf8",
+  cppjieba::Jieba jieba("../test/testdata/extra_dict/jieba.dict.small.utf8",
                         "../dict/hmm_model.utf8",
                         "../dict/user.dict.utf8",
-                        "../dict/idf.utf8",
+                        "../test/testdata/idf.small.utf8",
                         "../dict/stop_words.utf8");
   vector<Word> words;
   string result;
@@ -73,8 +92,8 @@ TEST(JiebaTest, WordTest) {
 
   jieba.CutAll("我来自北京邮电大学", words);
   result << words;
-  //ASSERT_EQ(result, "[\"我\", \"来自\", \"北京\", \"北京邮电\", \"北京邮电大学\", \"邮电\", \"邮电大学\", \"电大\", \"大学\"]");
-  ASSERT_EQ("[{\"word\": \"\xE6\x88\x91\", \"offset\": 0}, {\"word\": \"\xE6\x9D\xA5\xE8\x87\xAA\", \"offset\": 3}, {\"word\": \"\xE5\x8C\x97\xE4\xBA\xAC\", \"offset\": 9}, {\"word\": \"\xE5\x8C\x97\xE4\xBA\xAC\xE9\x82\xAE\xE7\x94\xB5\", \"offset\": 9}, {\"word\": \"\xE5\x8C\x97\xE4\xBA\xAC\xE9\x82\xAE\xE7\x94\xB5\xE5\xA4\xA7\xE5\xAD\xA6\", \"offset\": 9}, {\"word\": \"\xE9\x82\xAE\xE7\x94\xB5\", \"offset\": 15}, {\"word\": \"\xE9\x82\xAE\xE7\x94\xB5\xE5\xA4\xA7\xE5\xAD\xA6\", \"offset\": 15}, {\"word\": \"\xE7\x94\xB5\xE5\xA4\xA7\", \"offset\": 18}, {\"word\": \"\xE5\xA4\xA7\xE5\xAD\xA6\", \"offset\": 21}]", result);
+  //ASSERT_EQ(result, "[\"我\", \"来自\", \"北京\", \"北京邮电大学\", \"邮电\", \"电大\", \"大学\"]");
+  ASSERT_EQ("[{\"word\": \"\xE6\x88\x91\", \"offset\": 0}, {\"word\": \"\xE6\x9D\xA5\xE8\x87\xAA\", \"offset\": 3}, {\"word\": \"\xE5\x8C\x97\xE4\xBA\xAC\", \"offset\": 9}, {\"word\": \"\xE5\x8C\x97\xE4\xBA\xAC\xE9\x82\xAE\xE7\x94\xB5\xE5\xA4\xA7\xE5\xAD\xA6\", \"offset\": 9}, {\"word\": \"\xE9\x82\xAE\xE7\x94\xB5\", \"offset\": 15}, {\"word\": \"\xE7\x94\xB5\xE5\xA4\xA7\", \"offset\": 18}, {\"word\": \"\xE5\xA4\xA7\xE5\xAD\xA6\", \"offset\": 21}]", result);
 
   jieba.CutForSearch("他来到了网易杭研大厦", words);
   result << words;
@@ -82,11 +101,11 @@ TEST(JiebaTest, WordTest) {
   ASSERT_EQ("[{\"word\": \"\xE4\xBB\x96\", \"offset\": 0}, {\"word\": \"\xE6\x9D\xA5\xE5\x88\xB0\", \"offset\": 3}, {\"word\": \"\xE4\xBA\x86\", \"offset\": 9}, {\"word\": \"\xE7\xBD\x91\xE6\x98\x93\", \"offset\": 12}, {\"word\": \"\xE6\x9D\xAD\xE7\xA0\x94\", \"offset\": 18}, {\"word\": \"\xE5\xA4\xA7\xE5\x8E\xA6\", \"offset\": 24}]", result);
 }
 
-TEST(JiebaTest, InsertUserWord) {
-  cppjieba::Jieba jieba("../dict/jieba.dict.utf8",
+TEST(JiebaTest, UserWord) {
+  cppjieba::Jieba jieba("../test/testdata/extra_dict/jieba.dict.small.utf8",
                         "../dict/hmm_model.utf8",
                         "../dict/user.dict.utf8",
-                        "../dict/idf.utf8",
+                        "../test/testdata/idf.small.utf8",
                         "../dict/stop_words.utf8");
   vector<string> words;
   string result;
@@ -95,31 +114,33 @@ TEST(JiebaTest, InsertUserWord) {
   result << words;
   ASSERT_EQ("[\"男默\", \"女泪\"]", result);
 
-  ASSERT_TRUE(jieba.InsertUserWord("男默女泪"));
-
-  jieba.Cut("男默女泪", words);
+  // the dictionary is read only once built, the words are added by a user dict
+  const string user_dict = "/tmp/jieba_test.user.dict.utf8";
+  {
+    ofstream ofs(user_dict.c_str());
+    ofs << "男默女泪\n同一个世界，同一个梦想\n";
+  }
+  cppjieba::Jieba userJieba("../test/testdata/extra_dict/jieba.dict.small.utf8",
+                            "../dict/hmm_model.utf8",
+                            user_dict,
+                            "../test/testdata/idf.small.utf8",
+                            "../dict/stop_words.utf8",
+                            user_dict + ".dat_cache");
+
+  userJieba.Cut("男默女泪", words);
   result << words;
   ASSERT_EQ("[\"男默女泪\"]", result);
 
-  for (size_t i = 0; i < 100; i++) {
-    string newWord;
-    newWord << rand();
-    ASSERT_TRUE(jieba.InsertUserWord(newWord));
-    jieba.Cut(newWord, words);
-    result << words;
-    ASSERT_EQ(result, StringFormat("[\"%s\"]", newWord.c_str()));
-  }
-
-  ASSERT_TRUE(jieba.InsertUserWord("同一个世界，同一个梦想"));
-  jieba.Cut("同一个世界，同一个梦想", words);
+  userJieba.Cut("同一个世界，同一个梦想", words);
   result = Join(words.begin(), words.end(), "/");
   ASSERT_EQ(result, "同一个/世界/，/同一个/梦想");
 
-  jieba.ResetSeparators("");
+  userJieba.ResetSeparators("");
 
-  jieba.Cut("同一个世界，同一个梦想", words);
+  userJieba.Cut("同一个世界，同一个梦想", words);
   result = Join(words.begin(), words.end(), "/");
   ASSERT_EQ(result, "同一个世界，同一个梦想");
+  ASSERT_EQ(0, system(("rm -f " + user_dict + "*").c_str()));
 
   {
     string s("一部iPhone6");
@@ -128,6 +149,6 @@ TEST(JiebaTest, InsertUserWord) {
     size_t topN = 5;
     jieba.extractor.Extract(s, wordweights, topN);
     res << wordweights;
-    ASSERT_EQ(res, "[{\"word\": \"iPhone6\", \"offset\": [6], \"weight\": 11.7392}, {\"word\": \"\xE4\xB8\x80\xE9\x83\xA8\", \"offset\": [0], \"weight\": 6.47592}]");
+    ASSERT_EQ(res, "[{\"word\": \"iPhone6\", \"offset\": [6], \"weight\": 8.1}, {\"word\": \"\xE4\xB8\x80\xE9\x83\xA8\", \"offset\": [0], \"weight\": 8.1}]");
   }
 }
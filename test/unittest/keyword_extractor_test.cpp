@@ -1,10 +1,14 @@
+#include <thread>
 #include "cppjieba/KeywordExtractor.hpp"
+#include "cppjieba/IdfBuilder.hpp"
 #include "gtest/gtest.h"
 
 using namespace cppjieba;
 
 TEST(KeywordExtractorTest, Test1) {
-  KeywordExtractor Extractor("../test/testdata/extra_dict/jieba.dict.small.utf8", "../dict/hmm_model.utf8", "../dict/idf.utf8", "../dict/stop_words.utf8");
+  DictTrie trie("../test/testdata/extra_dict/jieba.dict.small.utf8");
+  HMMModel model("../dict/hmm_model.utf8");
+  KeywordExtractor Extractor(&trie, &model, "../test/testdata/idf.small.utf8", "../dict/stop_words.utf8");
 
   {
     string s("你好世界世界而且而且");
@@ -22,14 +26,14 @@ TEST(KeywordExtractorTest, Test1) {
       vector<pair<string, double> > words;
       Extractor.Extract(s, words, topN);
       res << words;
-      ASSERT_EQ(res, "[世界:8.73506, 你好:7.95788]");
+      ASSERT_EQ(res, "[世界:16.2, 你好:8.1]");
     }
 
     {
       vector<KeywordExtractor::Word> words;
       Extractor.Extract(s, words, topN);
       res << words;
-      ASSERT_EQ(res, "[{\"word\": \"\xE4\xB8\x96\xE7\x95\x8C\", \"offset\": [6, 12], \"weight\": 8.73506}, {\"word\": \"\xE4\xBD\xA0\xE5\xA5\xBD\", \"offset\": [0], \"weight\": 7.95788}]");
+      ASSERT_EQ(res, "[{\"word\": \"\xE4\xB8\x96\xE7\x95\x8C\", \"offset\": [6, 12], \"weight\": 16.2}, {\"word\": \"\xE4\xBD\xA0\xE5\xA5\xBD\", \"offset\": [0], \"weight\": 8.1}]");
     }
   }
 
@@ -40,7 +44,7 @@ TEST(KeywordExtractorTest, Test1) {
     size_t topN = 5;
     Extractor.Extract(s, wordweights, topN);
     res << wordweights;
-    ASSERT_EQ(res, "[{\"word\": \"CEO\", \"offset\": [93], \"weight\": 11.7392}, {\"word\": \"\xE5\x8D\x87\xE8\x81\x8C\", \"offset\": [72], \"weight\": 10.8562}, {\"word\": \"\xE5\x8A\xA0\xE8\x96\xAA\", \"offset\": [78], \"weight\": 10.6426}, {\"word\": \"\xE6\x89\x8B\xE6\x89\xB6\xE6\x8B\x96\xE6\x8B\x89\xE6\x9C\xBA\", \"offset\": [21], \"weight\": 10.0089}, {\"word\": \"\xE5\xB7\x85\xE5\xB3\xB0\", \"offset\": [111], \"weight\": 9.49396}]");
+    ASSERT_EQ(res, "[{\"word\": \"CEO\", \"offset\": [93], \"weight\": 8.1}, {\"word\": \"不用\", \"offset\": [48], \"weight\": 8.1}, {\"word\": \"专业\", \"offset\": [36], \"weight\": 8.1}, {\"word\": \"人生\", \"offset\": [105], \"weight\": 8.1}, {\"word\": \"加薪\", \"offset\": [78], \"weight\": 8.1}]");
   }
 
   {
@@ -50,12 +54,14 @@ TEST(KeywordExtractorTest, Test1) {
     size_t topN = 5;
     Extractor.Extract(s, wordweights, topN);
     res << wordweights;
-    ASSERT_EQ(res, "[{\"word\": \"iPhone6\", \"offset\": [6], \"weight\": 11.7392}, {\"word\": \"\xE4\xB8\x80\xE9\x83\xA8\", \"offset\": [0], \"weight\": 6.47592}]");
+    ASSERT_EQ(res, "[{\"word\": \"iPhone6\", \"offset\": [6], \"weight\": 8.1}, {\"word\": \"\xE4\xB8\x80\xE9\x83\xA8\", \"offset\": [0], \"weight\": 8.1}]");
   }
 }
 
 TEST(KeywordExtractorTest, Test2) {
-  KeywordExtractor Extractor("../test/testdata/extra_dict/jieba.dict.small.utf8", "../dict/hmm_model.utf8", "../dict/idf.utf8", "../dict/stop_words.utf8", "../test/testdata/userdict.utf8");
+  DictTrie trie("../test/testdata/extra_dict/jieba.dict.small.utf8", "../test/testdata/userdict.utf8");
+  HMMModel model("../dict/hmm_model.utf8");
+  KeywordExtractor Extractor(&trie, &model, "../test/testdata/idf.small.utf8", "../dict/stop_words.utf8");
 
   {
     string s("蓝翔优秀毕业生");
@@ -64,7 +70,7 @@ TEST(KeywordExtractorTest, Test2) {
     size_t topN = 5;
     Extractor.Extract(s, wordweights, topN);
     res << wordweights;
-    ASSERT_EQ(res, "[{\"word\": \"\xE8\x93\x9D\xE7\xBF\x94\", \"offset\": [0], \"weight\": 11.7392}, {\"word\": \"\xE6\xAF\x95\xE4\xB8\x9A\xE7\x94\x9F\", \"offset\": [12], \"weight\": 8.13549}, {\"word\": \"\xE4\xBC\x98\xE7\xA7\x80\", \"offset\": [6], \"weight\": 6.78347}]");
+    ASSERT_EQ(res, "[{\"word\": \"蓝翔\", \"offset\": [0], \"weight\": 11.75}, {\"word\": \"优秀\", \"offset\": [6], \"weight\": 8.1}, {\"word\": \"毕业生\", \"offset\": [12], \"weight\": 8.1}]");
   }
 
   {
@@ -74,6 +80,162 @@ TEST(KeywordExtractorTest, Test2) {
     size_t topN = 5;
     Extractor.Extract(s, wordweights, topN);
     res << wordweights;
-    ASSERT_EQ(res, "[{\"word\": \"iPhone6\", \"offset\": [6], \"weight\": 11.7392}, {\"word\": \"\xE4\xB8\x80\xE9\x83\xA8\", \"offset\": [0], \"weight\": 6.47592}]");
+    ASSERT_EQ(res, "[{\"word\": \"iPhone6\", \"offset\": [6], \"weight\": 8.1}, {\"word\": \"\xE4\xB8\x80\xE9\x83\xA8\", \"offset\": [0], \"weight\": 8.1}]");
   }
 }
+
+TEST(IdfTrieTest, Find) {
+  DictTrie trie("../test/testdata/extra_dict/jieba.dict.small.utf8");
+  for (int round = 0; round < 2; round++) { // build, then attach to the cache
+    IdfTrie idf;
+    ASSERT_EQ(idf.Create("../test/testdata/idf.small.utf8", &trie), Error::Ok);
+    ASSERT_DOUBLE_EQ(idf.GetMeanIdf(), (6.5 + 5.25 + 11.5 + 11.75 + 5.5) / 5);
+    ASSERT_DOUBLE_EQ(idf.Find(trie.Find("北京"), "北京"), 6.5);
+    ASSERT_DOUBLE_EQ(idf.Find(nullptr, "北京"), 6.5);
+    ASSERT_DOUBLE_EQ(idf.Find(trie.Find("大学"), "大学"), 5.5);
+    ASSERT_DOUBLE_EQ(idf.Find(nullptr, "蓝翔"), 11.75);
+    ASSERT_DOUBLE_EQ(idf.Find(trie.Find("邮电"), "邮电"), idf.GetMeanIdf());
+    ASSERT_DOUBLE_EQ(idf.Find(nullptr, "邮电"), idf.GetMeanIdf());
+  }
+}
+
+TEST(KeywordExtractorTest, ElementIds) {
+  DictTrie trie("../test/testdata/extra_dict/jieba.dict.small.utf8");
+  HMMModel model("../dict/hmm_model.utf8");
+  KeywordExtractor extractor(&trie, &model, "../test/testdata/idf.small.utf8", "../dict/stop_words.utf8");
+  {
+    vector<KeywordExtractor::Word> words;
+    extractor.Extract("我在北京邮电大学读大学，北京的大学很多，而且而且", words, 3);
+    string res;
+    res << words;
+    ASSERT_EQ(res, "[{\"word\": \"北京邮电大学\", \"offset\": [6], \"weight\": 11.5}, {\"word\": \"大学\", \"offset\": [27, 45], \"weight\": 11}, {\"word\": \"很多\", \"offset\": [51], \"weight\": 8.1}]");
+  }
+  {
+    vector<pair<string, double> > words;
+    extractor.Extract("蓝翔北京蓝翔", words, 5);
+    string res;
+    res << words;
+    ASSERT_EQ(res, "[蓝翔:23.5, 北京:6.5]");
+  }
+}
+
+TEST(IdfBuilderTest, Write) {
+  DictTrie trie("../test/testdata/extra_dict/jieba.dict.small.utf8");
+  HMMModel model("../dict/hmm_model.utf8");
+  IdfBuilderOptions options;
+  options.thread_num = 2;
+  options.batch_lines = 1;
+  options.sketch_width = 64;
+  IdfBuilder builder(&trie, &model, options);
+  istringstream corpus("北京邮电大学在北京\n\n北京的大学\n蓝翔的蓝翔\n");
+  builder.Process(corpus);
+  ASSERT_EQ(builder.GetDocumentsNum(), 3u);
+
+  vector<pair<string, size_t> > dfs;
+  builder.GetDocumentFrequencies(dfs);
+  map<string, size_t> df(dfs.begin(), dfs.end());
+  ASSERT_EQ(df["北京"], 2u);
+  ASSERT_EQ(df["的"], 2u);
+  ASSERT_EQ(df["北京邮电大学"], 1u);
+  ASSERT_EQ(df["蓝翔"], 1u);
+
+  ASSERT_EQ(builder.Write("idf_builder_test.utf8"), Error::Ok);
+  IdfTrie idf;
+  ASSERT_EQ(idf.Create("idf_builder_test.utf8", &trie), Error::Ok);
+  ASSERT_NEAR(idf.Find(trie.Find("北京"), "北京"), log(3.0 / 2), 1e-9);
+  ASSERT_NEAR(idf.Find(nullptr, "蓝翔"), log(3.0), 1e-9);
+}
+
+TEST(KeywordExtractorTest, SharedSegment) {
+  DictTrie trie("../test/testdata/extra_dict/jieba.dict.small.utf8");
+  HMMModel model("../dict/hmm_model.utf8");
+  MixSegment segment(&trie, &model);
+  StopWords stopWords;
+  ASSERT_EQ(stopWords.Create("../dict/stop_words.utf8", &trie), Error::Ok);
+  ASSERT_TRUE(stopWords.IsStopWord("而且"));
+  ASSERT_TRUE(stopWords.IsStopWord(trie.Find("而且")));
+  ASSERT_FALSE(stopWords.IsStopWord(trie.Find("北京")));
+
+  KeywordExtractor extractor(&segment, "../test/testdata/idf.small.utf8", &stopWords);
+  const string s("我在北京邮电大学读大学，北京的大学很多，而且而且");
+  vector<KeywordExtractor::Word> keywords;
+  extractor.Extract(s, keywords, 3);
+  string res;
+  res << keywords;
+  ASSERT_EQ(res, "[{\"word\": \"北京邮电大学\", \"offset\": [6], \"weight\": 11.5}, {\"word\": \"大学\", \"offset\": [27, 45], \"weight\": 11}, {\"word\": \"很多\", \"offset\": [51], \"weight\": 8.1}]");
+
+  // the words of an earlier segmentation
+  vector<Word> words;
+  segment.CutToWord(s, words);
+  extractor.Extract(s, words, keywords, 3);
+  string res2;
+  res2 << keywords;
+  ASSERT_EQ(res2, res);
+
+  ASSERT_EQ(extractor.Create(&segment, "../test/testdata/idf.small.utf8", "not_exist.utf8"), Error::OpenFileFailed);
+}
+
+TEST(KeywordExtractorTest, ExtractBatch) {
+  DictTrie trie("../test/testdata/extra_dict/jieba.dict.small.utf8");
+  HMMModel model("../dict/hmm_model.utf8");
+  KeywordExtractor extractor(&trie, &model, "../test/testdata/idf.small.utf8", "../dict/stop_words.utf8");
+  vector<string> docs;
+  ifstream ifs("../test/testdata/review.100");
+  string line;
+  while (getline(ifs, line)) {
+    docs.push_back(line);
+  }
+  docs.push_back("北京邮电大学，北京的大学");
+  docs.push_back("");
+
+  vector<vector<KeywordExtractor::Word> > out;
+  vector<pair<string, double> > corpus;
+  extractor.ExtractBatch(docs, 5, out, &corpus, 3);
+  ASSERT_EQ(out.size(), docs.size());
+
+  map<string, double> sums;
+  for (size_t i = 0; i < docs.size(); i++) {
+    vector<KeywordExtractor::Word> keywords;
+    extractor.Extract(docs[i], keywords, 5);
+    string expected, res;
+    expected << keywords;
+    res << out[i];
+    ASSERT_EQ(res, expected);
+
+    extractor.Extract(docs[i], keywords, docs[i].size());
+    for (const auto & keyword : keywords) {
+      sums[keyword.word] += keyword.weight;
+    }
+  }
+
+  ASSERT_EQ(corpus.size(), 5u);
+  for (size_t i = 0; i < corpus.size(); i++) {
+    ASSERT_NEAR(corpus[i].second, sums[corpus[i].first], 1e-6);
+    if (i > 0) {
+      ASSERT_GE(corpus[i - 1].second, corpus[i].second);
+    }
+  }
+
+  // on the scheduler of the first batch, kept by the extractor
+  vector<vector<KeywordExtractor::Word> > again;
+  extractor.ExtractBatch(docs, 5, again, nullptr, 3);
+  string expected, res;
+  expected << out;
+  res << again;
+  ASSERT_EQ(res, expected);
+
+  // replaced by the one of another number of threads, from batches running together
+  vector<std::thread> threads;
+  vector<string> results(4);
+  for (size_t t = 0; t < results.size(); t++) {
+    threads.emplace_back([&, t]() {
+      vector<vector<KeywordExtractor::Word> > words;
+      extractor.ExtractBatch(docs, 5, words, nullptr, 1 + t % 2);
+      results[t] << words;
+    });
+  }
+  for (auto & thread : threads) {
+    thread.join();
+  }
+  ASSERT_EQ(vector<string>(results.size(), expected), results);
+}
@@ -0,0 +1,45 @@
+#include "cppjieba/LatencyHistogram.hpp"
+#include "gtest/gtest.h"
+
+using namespace cppjieba;
+
+TEST(LatencyHistogramTest, Percentiles) {
+  LatencyHistogram histogram;
+  ASSERT_EQ(0u, histogram.GetValueAtPercentile(99));
+
+  // 1us .. 100ms
+  for (uint64_t i = 1; i <= 100000; i++) {
+    histogram.Record(i * 1000);
+  }
+
+  ASSERT_EQ(100000u, histogram.GetCount());
+  ASSERT_EQ(1000u, histogram.GetMin());
+  ASSERT_EQ(100000000u, histogram.GetMax());
+  ASSERT_NEAR(50000500.0, histogram.GetMean(), 1);
+
+  const double percentiles[] = {0, 50, 90, 99, 99.9, 99.99, 100};
+
+  for (double p : percentiles) {
+    const double expected = std::max(1.0, p * 1000) * 1000;
+    const double actual = histogram.GetValueAtPercentile(p);
+    ASSERT_GE(actual, expected) << p;
+    ASSERT_LE(actual, expected * (1 + 1.0 / 64)) << p;
+  }
+
+  // small values are exact
+  LatencyHistogram small;
+  for (uint64_t i = 0; i < 128; i++) {
+    small.Record(i);
+  }
+  ASSERT_EQ(63u, small.GetValueAtPercentile(50));
+  ASSERT_EQ(127u, small.GetValueAtPercentile(100));
+
+  small.Record(UINT64_MAX);
+  ASSERT_EQ(UINT64_MAX, small.GetValueAtPercentile(100));
+
+  histogram.Merge(small);
+  ASSERT_EQ(100129u, histogram.GetCount());
+  ASSERT_EQ(0u, histogram.GetMin());
+  histogram.Reset();
+  ASSERT_EQ(0u, histogram.GetCount());
+}
@@ -0,0 +1,83 @@
+#include <cstdio>
+#include <thread>
+#include "cppjieba/AsyncLogging.hpp"
+#include "gtest/gtest.h"
+
+using namespace cppjieba;
+using namespace std;
+
+class CaptureLogSink: public limonp::LogSink {
+ public:
+  virtual void Write(size_t level, const char* line, size_t size) {
+    lines.push_back(string(line, size));
+  }
+  vector<string> lines;
+};
+
+static int Count(int& n) {
+  return ++n;
+}
+
+TEST(LoggingTest, Sink) {
+  CaptureLogSink sink;
+  ASSERT_TRUE(limonp::SetLogSink(&sink) == NULL);
+
+  int n = 0;
+  // compiled out by LOGGING_LEVEL=LL_WARNING, the arguments are not evaluated
+  XLOG(INFO) << Count(n);
+  ASSERT_EQ(0, n);
+  ASSERT_EQ(0u, sink.lines.size());
+
+  XLOG(ERROR) << "error " << Count(n);
+  ASSERT_EQ(1, n);
+  ASSERT_EQ(1u, sink.lines.size());
+  ASSERT_NE(string::npos, sink.lines[0].find("ERROR error 1"));
+
+  for (size_t i = 0; i < 10; i++) {
+    XLOG_RATE(WARNING, 3) << "rate " << i;
+  }
+
+  ASSERT_LE(sink.lines.size(), 1u + 6u);
+  ASSERT_NE(string::npos, sink.lines[1].find("rate 0"));
+
+  ASSERT_EQ(&sink, limonp::SetLogSink(NULL));
+}
+
+TEST(LoggingTest, AsyncLogSink) {
+  FILE* out = tmpfile();
+  ASSERT_TRUE(out != NULL);
+  {
+    AsyncLogSink sink(out, 64);
+    limonp::SetLogSink(&sink);
+
+    vector<thread> threads;
+
+    for (size_t t = 0; t < 4; t++) {
+      threads.emplace_back([t]() {
+        for (size_t i = 0; i < 50; i++) {
+          XLOG(ERROR) << "thread " << t << " line " << i;
+        }
+      });
+    }
+
+    for (auto & thread : threads) {
+      thread.join();
+    }
+
+    sink.Flush();
+    ASSERT_EQ(0u, sink.GetDroppedNum());
+  }
+  ASSERT_TRUE(limonp::GetLogSink() != NULL);
+
+  rewind(out);
+  char buf[256];
+  size_t lines = 0;
+
+  while (fgets(buf, sizeof(buf), out) != NULL) {
+    ASSERT_NE(string::npos, string(buf).find("ERROR thread "));
+    lines++;
+  }
+
+  fclose(out);
+  ASSERT_EQ(200u, lines);
+}
@@ -0,0 +1,84 @@
+#include "cppjieba/NumaReplicas.hpp"
+#include "gtest/gtest.h"
+
+using namespace cppjieba;
+
+TEST(NumaTopologyTest, ParseCpuList) {
+  ASSERT_EQ(vector<int>({0, 1, 2, 3, 8, 10, 11}), NumaTopology::ParseCpuList("0-3,8,10-11"));
+  ASSERT_EQ(vector<int>(), NumaTopology::ParseCpuList(""));
+
+  NumaTopology detected;
+  ASSERT_LE(1u, detected.GetNodeNum());
+  ASSERT_FALSE(detected.GetNodeCpus(0).empty());
+  ASSERT_GT(detected.GetNodeNum(), detected.GetCurrentNode());
+
+  NumaTopology topology({{0, 2}, {1, 3}});
+  ASSERT_EQ(2u, topology.GetNodeNum());
+  ASSERT_EQ(0u, topology.GetCpuNode(2));
+  ASSERT_EQ(1u, topology.GetCpuNode(3));
+  ASSERT_EQ(0u, topology.GetCpuNode(64));
+}
+
+TEST(NumaReplicasTest, CutBatch) {
+  Jieba jieba("../test/testdata/extra_dict/jieba.dict.small.utf8",
+              "../dict/hmm_model.utf8",
+              "../dict/user.dict.utf8");
+  const vector<string> docs = {
+    "我来自北京邮电大学。。。学号123456，用AK47",
+    "南京市长江大桥",
+    "",
+    "他来到了网易杭研大厦",
+  };
+
+  // two nodes sharing the first core, so that the copies are made whatever the machine
+  const int cpu = NumaTopology().GetNodeCpus(0)[0];
+  NumaTopology topology({{cpu}, {cpu}});
+  NumaReplicas replicas(&jieba, topology);
+  ASSERT_EQ(2u, replicas.GetNodeNum());
+
+  for (size_t node = 0; node < replicas.GetNodeNum(); node++) {
+    const NumaReplicas::Segments& segments = replicas.GetSegments(node);
+    ASSERT_NE(jieba.GetDictTrie(), segments.mix->GetDictTrie());
+    ASSERT_EQ(jieba.GetDictTrie()->GetElementsNum(), segments.mix->GetDictTrie()->GetElementsNum());
+  }
+  ASSERT_NE(replicas.GetSegments(0).mix->GetDictTrie(), replicas.GetSegments(1).mix->GetDictTrie());
+
+  vector<string> expected;
+  vector<vector<Word> > words;
+  TaskScheduler pinned(topology, 2);
+  ASSERT_EQ(0u, pinned.GetWorkerNode(0));
+  ASSERT_EQ(1u, pinned.GetWorkerNode(1));
+  replicas.CutBatch(pinned, docs, words);
+  ASSERT_EQ(docs.size(), words.size());
+  for (size_t i = 0; i < docs.size(); i++) {
+    vector<string> got;
+    GetStringsFromWords(words[i], got);
+    jieba.Cut(docs[i], expected);
+    ASSERT_EQ(expected, got);
+  }
+
+  TaskScheduler scheduler(2);
+  ASSERT_EQ((size_t)NumaTopology::ANY_NODE, scheduler.GetWorkerNode(0));
+  replicas.CutBatch(scheduler, docs, words, false);
+  for (size_t i = 0; i < docs.size(); i++) {
+    vector<string> got;
+    GetStringsFromWords(words[i], got);
+    jieba.Cut(docs[i], expected, false);
+    ASSERT_EQ(expected, got);
+  }
+
+  vector<WordRange> wrs;
+  RuneStrArray runes;
+  ASSERT_TRUE(DecodeRunesInString(docs[3], runes));
+  replicas.GetLocalSegments().query->CutToRanges(runes.begin(), runes.end(), wrs);
+  vector<Word> found;
+  GetWordsFromWordRanges(docs[3], wrs, found);
+  GetStringsFromWords(found, expected);
+  vector<string> query;
+  jieba.CutForSearch(docs[3], query);
+  ASSERT_EQ(query, expected);
+
+  // one node, the segments of the Jieba
+  NumaReplicas single(&jieba, NumaTopology(vector<vector<int> >(1, vector<int>(1, cpu))));
+  ASSERT_EQ(jieba.GetMixSegment(), single.GetSegments(0).mix);
+}
@@ -1,19 +1,25 @@
+#include <thread>
 #include "cppjieba/MixSegment.hpp"
+#include "cppjieba/PosHMMSegment.hpp"
 #include "gtest/gtest.h"
 
 using namespace cppjieba;
 
+static const char * const DICT_FILE = "../test/testdata/extra_dict/jieba.dict.small.utf8";
+
 static const char * const QUERY_TEST1 = "我是蓝翔技工拖拉机学院手扶拖拉机专业的。不用多久，我就会升职加薪，当上总经理，出任CEO，迎娶白富美，走上人生巅峰。";
-static const char * const ANS_TEST1 = "[我:r, 是:v, 蓝翔:x, 技工:n, 拖拉机:n, 学院:n, 手扶拖拉机:n, 专业:n, 的:uj, 。:x, 不用:v, 多久:m, ，:x, 我:r, 就:d, 会:v, 升职:v, 加薪:nr, ，:x, 当上:t, 总经理:n, ，:x, 出任:v, CEO:eng, ，:x, 迎娶:v, 白富:x, 美:ns, ，:x, 走上:v, 人生:n, 巅峰:n, 。:x]";
+static const char * const ANS_TEST1 = "[我:r, 是:v, 蓝翔:x, 技工:n, 拖拉机:n, 学院:n, 手扶拖拉机:n, 专业:n, 的:uj, 。:x, 不用:v, 多久:m, ，:x, 我:r, 就:d, 会:v, 升职:v, 加薪:nr, ，:x, 当上:x, 总经理:n, ，:x, 出任:v, CEO:eng, ，:x, 迎娶:v, 白富:x, 美:ns, ，:x, 走上:v, 人生:n, 巅峰:n, 。:x]";
 static const char * const QUERY_TEST2 = "我是蓝翔技工拖拉机学院手扶拖拉机专业的。不用多久，我就会升职加薪，当上总经理，出任CEO，迎娶白富美，走上人生巅峰。";
-static const char * const ANS_TEST2 = "[我:r, 是:v, 蓝翔:nz, 技工:n, 拖拉机:n, 学院:n, 手扶拖拉机:n, 专业:n, 的:uj, 。:x, 不用:v, 多久:m, ，:x, 我:r, 就:d, 会:v, 升职:v, 加薪:nr, ，:x, 当上:t, 总经理:n, ，:x, 出任:v, CEO:eng, ，:x, 迎娶:v, 白富:x, 美:ns, ，:x, 走上:v, 人生:n, 巅峰:n, 。:x]";
+static const char * const ANS_TEST2 = "[我:r, 是:v, 蓝翔:nz, 技工:n, 拖拉机:n, 学院:n, 手扶拖拉机:n, 专业:n, 的:uj, 。:x, 不用:v, 多久:m, ，:x, 我:r, 就:d, 会:v, 升职:v, 加薪:nr, ，:x, 当上:x, 总经理:n, ，:x, 出任:v, CEO:eng, ，:x, 迎娶:v, 白富:x, 美:ns, ，:x, 走上:v, 人生:n, 巅峰:n, 。:x]";
 
 static const char * const QUERY_TEST3 = "iPhone6手机的最大特点是很容易弯曲。";
 static const char * const ANS_TEST3 = "[iPhone6:eng, 手机:n, 的:uj, 最大:a, 特点:n, 是:v, 很:zg, 容易:a, 弯曲:v, 。:x]";
 //static const char * const ANS_TEST3 = "";
 
 TEST(PosTaggerTest, Test) {
-  MixSegment tagger("../dict/jieba.dict.utf8", "../dict/hmm_model.utf8");
+  DictTrie trie(DICT_FILE);
+  HMMModel model("../dict/hmm_model.utf8");
+  MixSegment tagger(&trie, &model);
   {
     vector<pair<string, string> > res;
     tagger.Tag(QUERY_TEST1, res);
@@ -23,7 +29,9 @@ TEST(PosTaggerTest, Test) {
   }
 }
 TEST(PosTagger, TestUserDict) {
-  MixSegment tagger("../dict/jieba.dict.utf8", "../dict/hmm_model.utf8", "../test/testdata/userdict.utf8");
+  DictTrie trie(DICT_FILE, "../test/testdata/userdict.utf8");
+  HMMModel model("../dict/hmm_model.utf8");
+  MixSegment tagger(&trie, &model);
   {
     vector<pair<string, string> > res;
     tagger.Tag(QUERY_TEST2, res);
@@ -39,3 +47,51 @@ TEST(PosTagger, TestUserDict) {
     ASSERT_EQ(s, ANS_TEST3);
   }
 }
+
+TEST(PosHMMSegmentTest, Tag) {
+  PosHMMModel model("../dict/pos_dict");
+  ASSERT_FALSE(model.Empty());
+  PosHMMSegment segment(&model);
+  {
+    vector<pair<string, string> > res;
+    ASSERT_TRUE(segment.Tag(QUERY_TEST3, res));
+    string s;
+    s << res;
+    ASSERT_EQ(s, "[iPhone6:eng, 手机:n, 的:uj, 最大:a, 特点:n, 是:v, 很:d, 容易:a, 弯曲:v, 。:x]");
+  }
+
+  // attached to the cache built above
+  PosHMMModel cached("../dict/pos_dict");
+  PosHMMSegment cachedSegment(&cached);
+  {
+    vector<pair<string, string> > res;
+    ASSERT_TRUE(cachedSegment.Tag("王小明在北京大学读书，价格是3.5元", res));
+    string s;
+    s << res;
+    ASSERT_EQ(s, "[王小明:nr, 在:p, 北京大学:nt, 读书:n, ，:x, 价格:n, 是:v, 3.5:m, 元:m]");
+  }
+}
+
+TEST(PosHMMModelTest, SingleBuilder) {
+  char dir[] = "/tmp/pos_tagger_test_XXXXXX";
+  ASSERT_TRUE(mkdtemp(dir) != nullptr);
+  const string cache = string(dir) + "/pos_model.pos_cache";
+  vector<std::thread> threads;
+  vector<int> loaded(4, 0);
+
+  // one thread builds, the others attach to what it built
+  for (size_t i = 0; i < loaded.size(); i++) {
+    threads.emplace_back([&, i]() {
+      PosHMMModel model("../dict/pos_dict", cache);
+      loaded[i] = !model.Empty();
+    });
+  }
+  for (auto & thread : threads) {
+    thread.join();
+  }
+  ASSERT_EQ(vector<int>(4, 1), loaded);
+
+  // the cache and its lock file, no temporary file left
+  ASSERT_EQ(0, system(("test $(ls " + string(dir) + " | wc -l) -eq 2").c_str()));
+  ASSERT_EQ(0, system(("rm -rf " + string(dir)).c_str()));
+}
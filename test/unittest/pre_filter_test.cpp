@@ -5,7 +5,7 @@
 using namespace cppjieba;
 
 TEST(PreFilterTest, Test1) {
-  unordered_set<Rune> symbol;
+  std::unordered_set<Rune> symbol;
   symbol.insert(65292u); // "，"
   symbol.insert(12290u); // "。"
   string expected;
@@ -13,14 +13,15 @@ TEST(PreFilterTest, Test1) {
 
   {
     string s = "你好，美丽的，世界";
-    PreFilter filter(symbol, s);
+    RuneStrArray runes;
+    ASSERT_TRUE(DecodeRunesInString(s, runes));
+    PreFilter filter(symbol, runes.begin(), runes.end());
     expected = "你好/，/美丽的/，/世界";
     ASSERT_TRUE(filter.HasNext());
     vector<string> words;
     while (filter.HasNext()) {
-      PreFilter::Range range;
-      range = filter.Next();
-      words.push_back(GetStringFromRunes(s, range.begin, range.end - 1));
+      WordRange range = filter.Next();
+      words.push_back(EncodeRunesToString(range.left, range.right));
     }
     res = limonp::Join(words.begin(), words.end(), "/");
     ASSERT_EQ(res, expected);
@@ -28,14 +29,15 @@ TEST(PreFilterTest, Test1) {
 
   {
     string s = "我来自北京邮电大学。。。学号123456，用AK47";
-    PreFilter filter(symbol, s);
+    RuneStrArray runes;
+    ASSERT_TRUE(DecodeRunesInString(s, runes));
+    PreFilter filter(symbol, runes.begin(), runes.end());
     expected = "我来自北京邮电大学/。/。/。/学号123456/，/用AK47";
     ASSERT_TRUE(filter.HasNext());
     vector<string> words;
     while (filter.HasNext()) {
-      PreFilter::Range range;
-      range = filter.Next();
-      words.push_back(GetStringFromRunes(s, range.begin, range.end - 1));
+      WordRange range = filter.Next();
+      words.push_back(EncodeRunesToString(range.left, range.right));
     }
     res = limonp::Join(words.begin(), words.end(), "/");
     ASSERT_EQ(res, expected);
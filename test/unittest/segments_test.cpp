@@ -8,8 +8,13 @@
 
 using namespace cppjieba;
 
+static const char* const DICT_FILE = "../test/testdata/extra_dict/jieba.dict.small.utf8";
+static const char* const HMM_FILE = "../dict/hmm_model.utf8";
+
 TEST(MixSegmentTest, Test1) {
-  MixSegment segment("../dict/jieba.dict.utf8", "../dict/hmm_model.utf8");;
+  DictTrie trie(DICT_FILE);
+  HMMModel model(HMM_FILE);
+  MixSegment segment(&trie, &model);
   string sentence;
   vector<string> words;
   string actual;
@@ -18,15 +23,7 @@ TEST(MixSegmentTest, Test1) {
   {
     sentence = "我来自北京邮电大学。。。学号123456，用AK47";
     expected = "我/来自/北京邮电大学/。/。/。/学号/123456/，/用/AK47";
-    segment.Cut(sentence, words);
-    actual = Join(words.begin(), words.end(), "/");
-    ASSERT_EQ(actual, expected);
-  }
-
-  {
-    sentence = "B超 T恤";
-    expected = "B超/ /T恤";
-    segment.Cut(sentence, words);
+    segment.CutToStr(sentence, words);
     actual = Join(words.begin(), words.end(), "/");
     ASSERT_EQ(actual, expected);
   }
@@ -34,7 +31,7 @@ TEST(MixSegmentTest, Test1) {
   {
     sentence = "他来到了网易杭研大厦";
     expected = "他/来到/了/网易/杭/研/大厦";
-    segment.Cut(sentence, words, false);
+    segment.CutToStr(sentence, words, false);
     actual = Join(words.begin(), words.end(), "/");
     ASSERT_EQ(actual, expected);
   }
@@ -42,34 +39,38 @@ TEST(MixSegmentTest, Test1) {
   {
     sentence = "他来到了网易杭研大厦";
     expected = "他/来到/了/网易/杭研/大厦";
-    segment.Cut(sentence, words);
+    segment.CutToStr(sentence, words);
     actual = Join(words.begin(), words.end(), "/");
     ASSERT_EQ(actual, expected);
   }
 }
 
 TEST(MixSegmentTest, NoUserDict) {
-  MixSegment segment("../test/testdata/extra_dict/jieba.dict.small.utf8", "../dict/hmm_model.utf8");
+  DictTrie trie(DICT_FILE);
+  HMMModel model(HMM_FILE);
+  MixSegment segment(&trie, &model);
   const char* str = "令狐冲是云计算方面的专家";
   vector<string> words;
-  segment.Cut(str, words);
+  segment.CutToStr(str, words);
   string res;
   ASSERT_EQ("[\"令狐冲\", \"是\", \"云\", \"计算\", \"方面\", \"的\", \"专家\"]", res << words);
 
 }
 TEST(MixSegmentTest, UserDict) {
-  MixSegment segment("../test/testdata/extra_dict/jieba.dict.small.utf8", "../dict/hmm_model.utf8", "../dict/user.dict.utf8");
+  DictTrie trie(DICT_FILE, "../dict/user.dict.utf8");
+  HMMModel model(HMM_FILE);
+  MixSegment segment(&trie, &model);
   {
     const char* str = "令狐冲是云计算方面的专家";
     vector<string> words;
-    segment.Cut(str, words);
+    segment.CutToStr(str, words);
     string res;
     ASSERT_EQ("[\"令狐冲\", \"是\", \"云计算\", \"方面\", \"的\", \"专家\"]", res << words);
   }
   {
     const char* str = "小明先就职于IBM,后在日本京都大学深造";
     vector<string> words;
-    segment.Cut(str, words);
+    segment.CutToStr(str, words);
     string res;
     res << words;
     ASSERT_EQ("[\"小明\", \"先\", \"就职\", \"于\", \"IBM\", \",\", \"后\", \"在\", \"日本\", \"京都大学\", \"深造\"]", res);
@@ -77,30 +78,31 @@ TEST(MixSegmentTest, UserDict) {
   {
     const char* str = "IBM,3.14";
     vector<string> words;
-    segment.Cut(str, words);
+    segment.CutToStr(str, words);
     string res;
     res << words;
     ASSERT_EQ("[\"IBM\", \",\", \"3.14\"]", res);
   }
 }
 TEST(MixSegmentTest, TestUserDict) {
-  MixSegment segment("../test/testdata/extra_dict/jieba.dict.small.utf8", "../dict/hmm_model.utf8", 
-        "../test/testdata/userdict.utf8");
+  DictTrie trie(DICT_FILE, "../test/testdata/userdict.utf8");
+  HMMModel model(HMM_FILE);
+  MixSegment segment(&trie, &model);
   vector<string> words;
   string res;
 
-  segment.Cut("令狐冲是云计算方面的专家", words);
+  segment.CutToStr("令狐冲是云计算方面的专家", words);
   ASSERT_EQ("[\"令狐冲\", \"是\", \"云计算\", \"方面\", \"的\", \"专家\"]", res << words);
 
-  segment.Cut("小明先就职于IBM,后在日本京都大学深造", words);
+  segment.CutToStr("小明先就职于IBM,后在日本京都大学深造", words);
   res << words;
   ASSERT_EQ("[\"小明\", \"先\", \"就职\", \"于\", \"I\", \"B\", \"M\", \",\", \"后\", \"在\", \"日本\", \"京都大学\", \"深造\"]", res);
 
-  segment.Cut("IBM,3.14", words);
+  segment.CutToStr("IBM,3.14", words);
   res << words;
   ASSERT_EQ("[\"I\", \"B\", \"M\", \",\", \"3.14\"]", res);
 
-  segment.Cut("忽如一夜春风来，千树万树梨花开", words);
+  segment.CutToStr("忽如一夜春风来，千树万树梨花开", words);
   res = limonp::Join(words.begin(), words.end(), "/");
   ASSERT_EQ("忽如一夜春风来/，/千树/万树/梨花/开", res);
 
@@ -117,58 +119,54 @@ TEST(MixSegmentTest, TestUserDict) {
       for (size_t j = 0; j < len; j++) {
         s[rand() % len] = rand();
       }
-      segment.Cut(s, words);
+      segment.CutToStr(s, words);
     }
   }
 }
 
 TEST(MixSegmentTest, TestMultiUserDict) {
-  MixSegment segment("../test/testdata/extra_dict/jieba.dict.small.utf8", "../dict/hmm_model.utf8", 
-        "../test/testdata/userdict.utf8;../test/testdata/userdict.2.utf8");
+  DictTrie trie(DICT_FILE, "../test/testdata/userdict.utf8;../test/testdata/userdict.2.utf8");
+  HMMModel model(HMM_FILE);
+  MixSegment segment(&trie, &model);
   vector<string> words;
   string res;
 
-  segment.Cut("忽如一夜春风来，千树万树梨花开", words);
+  segment.CutToStr("忽如一夜春风来，千树万树梨花开", words);
   res = limonp::Join(words.begin(), words.end(), "/");
   ASSERT_EQ("忽如一夜春风来/，/千树万树梨花开", res);
 }
 
 TEST(MPSegmentTest, Test1) {
-  MPSegment segment("../dict/jieba.dict.utf8");;
+  DictTrie trie(DICT_FILE);
+  MPSegment segment(&trie);
   string s;
   vector<string> words;
-  segment.Cut("我来自北京邮电大学。", words);
+  segment.CutToStr("我来自北京邮电大学。", words);
   ASSERT_EQ("[\"我\", \"来自\", \"北京邮电大学\", \"。\"]", s << words);
 
-  segment.Cut("B超 T恤", words);
-  ASSERT_EQ(s << words, "[\"B超\", \" \", \"T恤\"]");
-
-  segment.Cut("南京市长江大桥", words);
+  segment.CutToStr("南京市长江大桥", words);
   ASSERT_EQ("[\"南京市\", \"长江大桥\"]", s << words);
 
   // MaxWordLen
-  segment.Cut("南京市长江大桥", words, 3);
+  segment.CutToStr("南京市长江大桥", words, false, 3);
   ASSERT_EQ("[\"南京市\", \"长江\", \"大桥\"]", s << words);
 
-  segment.Cut("南京市长江大桥", words, 0);
+  segment.CutToStr("南京市长江大桥", words, false, 0);
   ASSERT_EQ("[\"南\", \"京\", \"市\", \"长\", \"江\", \"大\", \"桥\"]", s << words);
 
-  segment.Cut("湖南长沙市天心区", words);
-  s = Join(words.begin(), words.end(), "/");
-  ASSERT_EQ("湖南长沙市/天心区", s);
-
-  segment.Cut("湖南长沙市天心区", words, 3);
+  segment.CutToStr("湖南长沙市天心区", words);
   s = Join(words.begin(), words.end(), "/");
-  ASSERT_EQ("湖南/长沙市/天心区", s);
+  ASSERT_EQ("湖南/长沙市/天心/区", s);
 }
 
 TEST(HMMSegmentTest, Test1) {
-  HMMSegment segment("../dict/hmm_model.utf8");;
+  HMMModel model(HMM_FILE);
+  HMMSegment segment(&model);
   {
     const char* str = "我来自北京邮电大学。。。学号123456";
     const char* res[] = {"我来", "自北京", "邮电大学", "。", "。", "。", "学号", "123456"};
     vector<string> words;
-    segment.Cut(str, words);
+    segment.CutToStr(str, words);
     ASSERT_EQ(words, vector<string>(res, res + sizeof(res)/sizeof(res[0])));
   }
 
@@ -176,68 +174,73 @@ TEST(HMMSegmentTest, Test1) {
     const char* str = "IBM,1.2,123";
     const char* res[] = {"IBM", ",", "1.2", ",", "123"};
     vector<string> words;
-    segment.Cut(str, words);
+    segment.CutToStr(str, words);
     ASSERT_EQ(words, vector<string>(res, res + sizeof(res)/sizeof(res[0])));
   }
 }
 
 TEST(FullSegment, Test1) {
-  FullSegment segment("../test/testdata/extra_dict/jieba.dict.small.utf8");
+  DictTrie trie(DICT_FILE);
+  FullSegment segment(&trie);
   vector<string> words;
   string s;
 
-  segment.Cut("我来自北京邮电大学", words);
+  segment.CutToStr("我来自北京邮电大学", words);
   s << words;
   ASSERT_EQ(s, "[\"我\", \"来自\", \"北京\", \"北京邮电大学\", \"邮电\", \"电大\", \"大学\"]");
 
   
-  segment.Cut("上市公司CEO", words);
+  segment.CutToStr("上市公司CEO", words);
   s << words;
   ASSERT_EQ(s, "[\"上市\", \"公司\", \"C\", \"E\", \"O\"]");
 }
 
 TEST(QuerySegment, Test1) {
-  QuerySegment segment("../dict/jieba.dict.utf8", "../dict/hmm_model.utf8", "");
+  DictTrie trie(DICT_FILE);
+  HMMModel model(HMM_FILE);
+  QuerySegment segment(&trie, &model);
   vector<string> words;
   string s1, s2;
 
-  segment.Cut("小明硕士毕业于中国科学院计算所，后在日本京都大学深造", words);
+  segment.CutToStr("小明硕士毕业于中国科学院计算所，后在日本京都大学深造", words);
   s1 = Join(words.begin(), words.end(), "/");
-  s2 = "小明/硕士/毕业/于/中国/科学/学院/科学院/中国科学院/计算/计算所/，/后/在/日本/京都/大学/日本京都大学/深造";
+  s2 = "小明/硕士/毕业/于/中国/科学/学院/科学院/中国科学院/计算/计算所/，/后/在/日本/京都/大学/京都大学/深造";
   ASSERT_EQ(s1, s2);
 
-  segment.Cut("亲口交代", words);
+  segment.CutToStr("亲口交代", words);
   s1 = Join(words.begin(), words.end(), "/");
   s2 = "亲口/交代";
   ASSERT_EQ(s1, s2);
 
-  segment.Cut("他心理健康", words);
+  segment.CutToStr("他心理健康", words);
   s1 = Join(words.begin(), words.end(), "/");
-  s2 = "他/心理/健康/心理健康";
+  s2 = "他/心理/健康";
   ASSERT_EQ(s1, s2);
 }
 
 TEST(QuerySegment, Test2) {
-  QuerySegment segment("../test/testdata/extra_dict/jieba.dict.small.utf8", "../dict/hmm_model.utf8", "../test/testdata/userdict.utf8|../test/testdata/userdict.english");
+  DictTrie trie(DICT_FILE, "../test/testdata/userdict.utf8|../test/testdata/userdict.english");
+  HMMModel model(HMM_FILE);
+  QuerySegment segment(&trie, &model);
   vector<string> words;
   string s1, s2;
 
   {
-    segment.Cut("小明硕士毕业于中国科学院计算所，后在日本京都大学深造", words);
+    segment.CutToStr("小明硕士毕业于中国科学院计算所，后在日本京都大学深造", words);
     s1 = Join(words.begin(), words.end(), "/");
     s2 = "小明/硕士/毕业/于/中国/科学/学院/科学院/中国科学院/计算/计算所/，/后/在/日本/京都/大学/京都大学/深造";
     ASSERT_EQ(s1, s2);
   }
 
   {
-    segment.Cut("小明硕士毕业于中国科学院计算所iPhone6", words);
+    segment.CutToStr("小明硕士毕业于中国科学院计算所iPhone6", words);
     s1 = Join(words.begin(), words.end(), "/");
     s2 = "小明/硕士/毕业/于/中国/科学/学院/科学院/中国科学院/计算/计算所/iPhone6";
     ASSERT_EQ(s1, s2);
   }
 
   {
-    segment.Cut("中国科学院", words);
+    segment.CutToStr("中国科学院", words);
     s1 = Join(words.begin(), words.end(), "/");
     s2 = "中国/科学/学院/科学院/中国科学院";
     ASSERT_EQ(s1, s2);
@@ -249,8 +252,162 @@ TEST(MPSegmentTest, Unicode32) {
   string s("天气很好，🙋 我们去郊游。");
   vector<string> words;
 
-  MPSegment segment("../dict/jieba.dict.utf8");;
-  segment.Cut(s, words);
+  DictTrie trie(DICT_FILE);
+  MPSegment segment(&trie);
+  segment.CutToStr(s, words);
 
   ASSERT_EQ(Join(words.begin(), words.end(), "/"), "天气/很/好/，/🙋/ /我们/去/郊游/。");
 }
+
+TEST(QuerySegment, SubWordGranularity) {
+  DictTrie trie(DICT_FILE);
+  HMMModel model(HMM_FILE);
+  QuerySegment segment(&trie, &model);
+  vector<string> words;
+  string s1, s2;
+
+  segment.SetMaxSubWordLength(3);
+  segment.CutToStr("中华人民共和国万岁", words);
+  s1 = Join(words.begin(), words.end(), "/");
+  s2 = "中华/华人/人民/共和/共和国/中华人民共和国/万岁";
+  ASSERT_EQ(s1, s2);
+
+  segment.SetMaxSubWordLength(5);
+  segment.CutToStr("中华人民共和国万岁", words);
+  s1 = Join(words.begin(), words.end(), "/");
+  s2 = "中华/华人/人民/人民共和国/共和/共和国/中华人民共和国/万岁";
+  ASSERT_EQ(s1, s2);
+
+  segment.SetMaxSubWordLength(0);
+  segment.CutToStr("中华人民共和国万岁", words);
+  s1 = Join(words.begin(), words.end(), "/");
+  s2 = "中华/华人/人民/共和/共和国/中华人民共和国/万岁";
+  ASSERT_EQ(s1, s2);
+}
+
+TEST(MixSegmentTest, ScoreType) {
+  DictTrie trie(DICT_FILE);
+  HMMModel model(HMM_FILE);
+  MixSegment reference(&trie, &model);
+  HMMSegment hmmReference(&model);
+  const ScoreType types[] = {ScoreFloat, ScoreFixed32};
+
+  for (auto type : types) {
+    MixSegment segment(&trie, &model);
+    HMMSegment hmmSegment(&model);
+    segment.SetScoreType(type);
+    hmmSegment.SetScoreType(type);
+
+    ifstream ifs("../test/testdata/weicheng.utf8");
+    ASSERT_TRUE(ifs.is_open());
+    string line;
+    vector<string> expected, actual;
+    size_t lines = 0, diverged = 0, hmmDiverged = 0;
+
+    while (getline(ifs, line)) {
+      lines++;
+      reference.CutToStr(line, expected);
+      segment.CutToStr(line, actual);
+      diverged += (expected != actual);
+      hmmReference.CutToStr(line, expected);
+      hmmSegment.CutToStr(line, actual);
+      hmmDiverged += (expected != actual);
+    }
+
+    ASSERT_GT(lines, 0u);
+    ASSERT_EQ(0u, diverged);
+    ASSERT_EQ(0u, hmmDiverged);
+  }
+}
+
+TEST(ScoreTraitsTest, IsNearTie) {
+  typedef ScoreTraits<float> Float;
+  typedef ScoreTraits<int32_t> Fixed;
+
+  // the tolerance grows with the terms and the magnitude
+  ASSERT_TRUE(Float::IsNearTie(-10.0f, -10.0f, 1, 10.0));
+  ASSERT_FALSE(Float::IsNearTie(-10.0f, -10.01f, 10, 10.0));
+  ASSERT_TRUE(Float::IsNearTie(-10000.0f, -10000.01f, 10, 10000.0));
+  ASSERT_FALSE(Float::IsNearTie(Float::Min(), Float::Min(), 10, 10.0));
+
+  ASSERT_TRUE(Fixed::IsNearTie(-4096, -4106, 10, 4096.0));
+  ASSERT_FALSE(Fixed::IsNearTie(-4096, -4107, 10, 4096.0));
+  ASSERT_FALSE(Fixed::IsNearTie(INT32_MAX, INT32_MIN, 10, 0.0));
+  ASSERT_TRUE(Fixed::IsNearTie(Fixed::Min(), INT32_MIN, 10, 0.0));
+}
+
+TEST(MPSegmentTest, CutStream) {
+  DictTrie trie(DICT_FILE, "../test/testdata/userdict.utf8");
+  HMMModel model(HMM_FILE);
+  MPSegment mpSeg(&trie);
+  MixSegment mixSeg(&trie, &model);
+
+  ifstream ifs("../test/testdata/weicheng.utf8");
+  ASSERT_TRUE(ifs.is_open());
+  string line;
+
+  while (getline(ifs, line)) {
+    RuneStrArray runes;
+    ASSERT_TRUE(DecodeRunesInString(line, runes));
+    vector<WordRange> expected, actual;
+    auto collect = [&actual](const WordRange & wr) {
+      actual.push_back(wr);
+    };
+
+    mpSeg.CutRuneArray(runes.begin(), runes.end(), expected);
+    mpSeg.CutStream(runes.begin(), runes.end(), collect);
+    ASSERT_EQ(expected.size(), actual.size());
+    for (size_t i = 0; i < expected.size(); i++) {
+      ASSERT_EQ(expected[i].left, actual[i].left);
+      ASSERT_EQ(expected[i].right, actual[i].right);
+    }
+
+    expected.clear();
+    actual.clear();
+    mixSeg.CutRuneArray(runes.begin(), runes.end(), expected);
+    mixSeg.CutStream(runes.begin(), runes.end(), collect);
+    ASSERT_EQ(expected.size(), actual.size());
+    for (size_t i = 0; i < expected.size(); i++) {
+      ASSERT_EQ(expected[i].left, actual[i].left);
+      ASSERT_EQ(expected[i].right, actual[i].right);
+    }
+  }
+}
+
+TEST(FullSegment, CutStream) {
+  DictTrie trie(DICT_FILE);
+  FullSegment segment(&trie);
+  RuneStrArray runes;
+  ASSERT_TRUE(DecodeRunesInString("我来自北京邮电大学", runes));
+  vector<string> words;
+  segment.CutStream(runes.begin(), runes.end(), [&words](const WordRange & wr) {
+    words.push_back(EncodeRunesToString(wr.left, wr.right + 1));
+  });
+  string s;
+  s << words;
+  ASSERT_EQ(s, "[\"我\", \"来自\", \"北京\", \"北京邮电大学\", \"邮电\", \"电大\", \"大学\"]");
+}
+
+TEST(MPSegmentTest, WordRangeElem) {
+  DictTrie trie(DICT_FILE);
+  HMMModel model(HMM_FILE);
+  MPSegment mpSeg(&trie);
+  MixSegment mixSeg(&trie, &model);
+  RuneStrArray runes;
+  ASSERT_TRUE(DecodeRunesInString("我来自北京邮电大学CEO", runes));
+  vector<WordRange> wrs;
+  mpSeg.CutRuneArray(runes.begin(), runes.end() - 3, wrs);
+  ASSERT_EQ(wrs.size(), 3u);
+  for (size_t i = 0; i < wrs.size(); i++) {
+    ASSERT_TRUE(wrs[i].elem != nullptr);
+    ASSERT_EQ(wrs[i].elem, trie.Find(EncodeRunesToString(wrs[i].left, wrs[i].right + 1)));
+  }
+
+  // the single runes are cut again by the hmm
+  wrs.clear();
+  mixSeg.CutRuneArray(runes.begin(), runes.end(), wrs);
+  ASSERT_EQ(wrs.size(), 4u);
+  ASSERT_TRUE(wrs[0].elem == nullptr);
+  ASSERT_EQ(wrs[2].elem, trie.Find("北京邮电大学"));
+  ASSERT_TRUE(wrs[3].elem == nullptr);
+}
@@ -0,0 +1,103 @@
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "cppjieba/HttpServer.hpp"
+#include "gtest/gtest.h"
+
+using namespace cppjieba;
+
+// sends `request` on a new connection, then `later` a while after, reads until the server closes it (or 10s pass)
+static string Exchange(int port, const string& request, const string& later = "") {
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+  timeval timeout = {10, 0};
+  if (fd < 0 || setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0
+      || connect(fd, (const sockaddr*)&addr, sizeof(addr)) != 0) {
+    return "";
+  }
+  send(fd, request.data(), request.size(), MSG_NOSIGNAL);
+  if (!later.empty()) {
+    usleep(200 * 1000);
+    send(fd, later.data(), later.size(), MSG_NOSIGNAL);
+  }
+  string response;
+  char buf[4096];
+  for (ssize_t n; (n = read(fd, buf, sizeof(buf))) > 0;) {
+    response.append(buf, n);
+  }
+  close(fd);
+  return response;
+}
+
+static string Response(const string& body, bool close = false) {
+  return "HTTP/1.1 200 OK\r\nContent-Type: application/json; charset=utf-8\r\nContent-Length: " +
+      std::to_string(body.size()) + (close ? "\r\nConnection: close\r\n\r\n" : "\r\n\r\n") + body;
+}
+
+TEST(HttpServerTest, Pipelining) {
+  Jieba jieba("../test/testdata/extra_dict/jieba.dict.small.utf8",
+              "../dict/hmm_model.utf8",
+              "../dict/user.dict.utf8");
+  HttpServerOptions options;
+  options.port = 0;
+  options.thread_num = 2;
+  HttpServer server(&jieba, options);
+  ASSERT_EQ(Error::Ok, server.Start());
+  ASSERT_NE(0, server.GetPort());
+
+  // three requests in one write, the last one closes the connection
+  const string body = "[\"南京市长江大桥\", \"a\\\"b\\u4e2d\"]";
+  string response = Exchange(server.GetPort(),
+      "GET /?key=%E5%8D%97%E4%BA%AC%E5%B8%82%E9%95%BF%E6%B1%9F%E5%A4%A7%E6%A1%A5 HTTP/1.1\r\nHost: localhost\r\n\r\n"
+      "POST /batch HTTP/1.1\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body +
+      "GET /?key=南京市长江大桥&method=FULL HTTP/1.1\r\nConnection: close\r\n\r\n");
+  string expected = Response("[\"南京市\", \"长江大桥\"]") +
+      Response("[[\"南京市\", \"长江大桥\"], [\"a\", \"\\\"\", \"b\", \"中\"]]") +
+      Response("[\"南京\", \"南京市\", \"市长\", \"长江\", \"长江大桥\", \"大桥\"]", true);
+  ASSERT_EQ(expected, response);
+
+  // HTTP/1.0 closes by default
+  response = Exchange(server.GetPort(), "POST /?method=HMM HTTP/1.0\r\nContent-Length: 6\r\n\r\n我来");
+  ASSERT_NE(string::npos, response.find("200 OK"));
+  ASSERT_NE(string::npos, response.find("Connection: close\r\n\r\n[\"我来\"]"));
+
+  ASSERT_EQ(0u, Exchange(server.GetPort(), "POST /batch HTTP/1.0\r\nContent-Length: 3\r\n\r\n[1]").find("HTTP/1.1 400"));
+  ASSERT_EQ(0u, Exchange(server.GetPort(), "GET /x HTTP/1.0\r\n\r\n").find("HTTP/1.1 404"));
+  ASSERT_EQ(0u, Exchange(server.GetPort(), "GET /?key=a&method=X HTTP/1.0\r\n\r\n").find("HTTP/1.1 400"));
+  ASSERT_EQ(0u, Exchange(server.GetPort(), "DELETE / HTTP/1.0\r\n\r\n").find("HTTP/1.1 405"));
+  ASSERT_EQ(0u, Exchange(server.GetPort(), "bad\r\n\r\n").find("HTTP/1.1 400"));
+
+  server.Stop();
+}
+
+TEST(HttpServerTest, PipeliningWhileWriting) {
+  Jieba jieba("../test/testdata/extra_dict/jieba.dict.small.utf8",
+              "../dict/hmm_model.utf8",
+              "");
+  HttpServerOptions options;
+  options.port = 0;
+  options.thread_num = 1;
+  HttpServer server(&jieba, options);
+  ASSERT_EQ(Error::Ok, server.Start());
+
+  // an answer larger than the socket buffers, the client reading nothing until the next request is sent
+  string body = "[";
+  for (size_t i = 0; i < 100000; i++) {
+    body += i > 0 ? ", \"南京市长江大桥\"" : "\"南京市长江大桥\"";
+  }
+  body += "]";
+  const string response = Exchange(server.GetPort(),
+      "POST /batch?method=FULL HTTP/1.1\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body,
+      "GET /?key=南京市长江大桥 HTTP/1.1\r\nConnection: close\r\n\r\n");
+
+  const string last = Response("[\"南京市\", \"长江大桥\"]", true);
+  ASSERT_GT(response.size(), (size_t)(4 << 20));
+  ASSERT_EQ(0u, response.find("HTTP/1.1 200 OK"));
+  ASSERT_EQ(response.size() - last.size(), response.rfind(last));
+
+  server.Stop();
+}
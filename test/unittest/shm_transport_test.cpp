@@ -0,0 +1,162 @@
+#include <sys/wait.h>
+#include "cppjieba/ShmTransport.hpp"
+#include "gtest/gtest.h"
+
+using namespace cppjieba;
+
+static vector<string> ToWords(const string& text, const vector<TokenSpan>& spans) {
+  vector<string> words;
+  for (const auto & span : spans) {
+    words.push_back(text.substr(span.offset, span.length));
+  }
+  return words;
+}
+
+TEST(ShmTransportTest, Cut) {
+  Jieba jieba("../test/testdata/extra_dict/jieba.dict.small.utf8",
+              "../dict/hmm_model.utf8",
+              "../dict/user.dict.utf8");
+  ShmTransportOptions options;
+  options.slot_num = 4;
+  options.slot_size = 4096;
+  options.thread_num = 2;
+  ShmServer server(&jieba, options);
+  ASSERT_EQ(Error::Ok, server.Start());
+
+  ShmClient client;
+  ASSERT_EQ(Error::Ok, client.Create(server.GetFd()));
+
+  vector<TokenSpan> spans;
+  vector<string> expected;
+  const string text = "我来自北京邮电大学。。。学号123456，用AK47";
+  ASSERT_TRUE(client.Cut(text, spans));
+  jieba.Cut(text, expected);
+  ASSERT_EQ(expected, ToWords(text, spans));
+
+  ASSERT_TRUE(client.Cut(text, spans, false));
+  jieba.Cut(text, expected, false);
+  ASSERT_EQ(expected, ToWords(text, spans));
+
+  ASSERT_TRUE(client.Cut("", spans));
+  ASSERT_TRUE(spans.empty());
+  ASSERT_FALSE(client.Cut("\xff\xfe", spans));
+  ASSERT_FALSE(client.Cut(string(client.GetMaxTextSize() * 10, 'a'), spans));
+  ASSERT_TRUE(client.Cut(string(client.GetMaxTextSize(), ','), spans));
+  ASSERT_EQ(client.GetMaxTextSize(), spans.size());
+
+  // more threads than slots
+  jieba.Cut(text, expected);
+  vector<std::thread> threads;
+  std::atomic<size_t> failures(0);
+  for (size_t t = 0; t < 8; t++) {
+    threads.emplace_back([&]() {
+      vector<TokenSpan> spans;
+      for (size_t i = 0; i < 200; i++) {
+        failures += !client.Cut(text, spans) || ToWords(text, spans) != expected;
+      }
+    });
+  }
+  for (auto & thread : threads) {
+    thread.join();
+  }
+  ASSERT_EQ(0u, failures.load());
+
+  // another process, through /proc
+  const string path = "/proc/" + std::to_string(getpid()) + "/fd/" + std::to_string(server.GetFd());
+  const pid_t pid = fork();
+  ASSERT_GE(pid, 0);
+  if (pid == 0) {
+    ShmClient child;
+    vector<TokenSpan> spans;
+    bool ok = child.Create(path) == Error::Ok;
+    for (size_t i = 0; ok && i < 100; i++) {
+      ok = child.Cut(text, spans) && ToWords(text, spans) == expected;
+    }
+    _exit(ok ? 0 : 1);
+  }
+  int status = 0;
+  ASSERT_EQ(pid, waitpid(pid, &status, 0));
+  ASSERT_TRUE(WIFEXITED(status));
+  ASSERT_EQ(0, WEXITSTATUS(status));
+
+  server.Stop();
+  ASSERT_FALSE(client.Cut(text, spans));
+}
+
+TEST(ShmTransportTest, CorruptedHeader) {
+  Jieba jieba("../test/testdata/extra_dict/jieba.dict.small.utf8",
+              "../dict/hmm_model.utf8",
+              "");
+  ShmTransportOptions options;
+  options.slot_num = 4;
+  options.slot_size = 4096;
+  options.thread_num = 1;
+  ShmServer server(&jieba, options);
+  ASSERT_EQ(Error::Ok, server.Start());
+
+  ShmClient client;
+  ASSERT_EQ(Error::Ok, client.Create(server.GetFd()));
+
+  // the geometry rewritten by a client, the server keeps the one it created
+  struct stat st;
+  ASSERT_EQ(0, fstat(server.GetFd(), &st));
+  void* p = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, server.GetFd(), 0);
+  ASSERT_NE(MAP_FAILED, p);
+  shm::Header* header = (shm::Header*)p;
+  header->slotNum = 1u << 30;
+  header->slotSize = 1ull << 40;
+
+  vector<TokenSpan> spans;
+  vector<string> expected;
+  const string text = "我来自北京邮电大学";
+  jieba.Cut(text, expected);
+  for (size_t i = 0; i < 20; i++) {
+    ASSERT_TRUE(client.Cut(text, spans));
+    ASSERT_EQ(expected, ToWords(text, spans));
+  }
+
+  ShmClient late;
+  ASSERT_EQ(Error::ValueError, late.Create(server.GetFd()));
+  ASSERT_EQ(0, munmap(p, st.st_size));
+}
+
+TEST(ShmTransportTest, CorruptedSlot) {
+  Jieba jieba("../test/testdata/extra_dict/jieba.dict.small.utf8",
+              "../dict/hmm_model.utf8",
+              "");
+  ShmTransportOptions options;
+  options.slot_num = 2;
+  options.slot_size = 1 << 20;
+  options.thread_num = 1;
+  ShmServer server(&jieba, options);
+  ASSERT_EQ(Error::Ok, server.Start());
+
+  ShmClient client;
+  ASSERT_EQ(Error::Ok, client.Create(server.GetFd()));
+
+  // the span counts rewritten by a client while the requests are in flight, the server keeps its own
+  shm::Region region;
+  ASSERT_EQ(Error::Ok, region.Attach(server.GetFd()));
+  std::atomic<bool> done(false);
+  std::thread corrupter([&]() {
+    while (!done.load()) {
+      for (size_t i = 0; i < region.GetSlotNum(); i++) {
+        region.GetSlot(i)->spanNum = 1u << 30;
+      }
+    }
+  });
+
+  vector<TokenSpan> spans;
+  const string text = string(client.GetMaxTextSize(), ',');
+  // wrong answers, but neither the server nor the client reads or writes out of the slot
+  for (size_t i = 0; i < 20; i++) {
+    client.Cut(text, spans);
+  }
+  done.store(true);
+  corrupter.join();
+
+  vector<string> expected;
+  jieba.Cut("我来自北京邮电大学", expected);
+  ASSERT_TRUE(client.Cut("我来自北京邮电大学", spans));
+  ASSERT_EQ(expected, ToWords("我来自北京邮电大学", spans));
+}
@@ -0,0 +1,65 @@
+#include <atomic>
+#include "cppjieba/TaskScheduler.hpp"
+#include "gtest/gtest.h"
+
+using namespace cppjieba;
+using namespace std;
+
+TEST(TaskSchedulerTest, ParallelFor) {
+  for (size_t threadNum = 1; threadNum <= 4; threadNum++) {
+    TaskScheduler scheduler(threadNum);
+    ASSERT_EQ(threadNum, scheduler.GetThreadNum());
+    ASSERT_EQ(threadNum, scheduler.CurrentWorker());
+
+    const size_t n = 100000;
+    vector<atomic<int> > hits(n);
+    vector<size_t> sums(threadNum, 0);
+
+    for (auto & hit : hits) {
+      hit.store(0);
+    }
+
+    scheduler.ParallelFor(0, n, 16, [&](size_t begin, size_t end, size_t worker) {
+      ASSERT_LT(worker, threadNum);
+      ASSERT_EQ(worker, scheduler.CurrentWorker());
+      ASSERT_LE(end - begin, 16u);
+
+      for (size_t i = begin; i < end; i++) {
+        hits[i]++;
+        sums[worker] += i;
+      }
+    });
+
+    size_t sum = 0;
+
+    for (size_t i = 0; i < n; i++) {
+      ASSERT_EQ(1, hits[i].load());
+    }
+
+    for (size_t s : sums) {
+      sum += s;
+    }
+
+    ASSERT_EQ(n * (n - 1) / 2, sum);
+
+    // empty range
+    scheduler.ParallelFor(5, 5, 1, [&](size_t, size_t, size_t) {
+      FAIL();
+    });
+  }
+}
+
+TEST(TaskSchedulerTest, Nested) {
+  TaskScheduler scheduler(3);
+  atomic<size_t> count(0);
+
+  scheduler.ParallelFor(0, 100, 1, [&](size_t begin, size_t end, size_t) {
+    for (size_t i = begin; i < end; i++) {
+      scheduler.ParallelFor(0, 1000, 10, [&](size_t b, size_t e, size_t) {
+        count += e - b;
+      });
+    }
+  });
+
+  ASSERT_EQ(100000u, count.load());
+}
@@ -0,0 +1,137 @@
+#include <thread>
+#include "cppjieba/Jieba.hpp"
+#include "gtest/gtest.h"
+
+using namespace cppjieba;
+
+class TenantTest : public testing::Test {
+protected:
+  void SetUp() override {
+    char dir[] = "/tmp/tenant_test_XXXXXX";
+    ASSERT_TRUE(mkdtemp(dir) != nullptr);
+    dir_ = dir;
+    WriteFile(dir_ + "/a.utf8", "蓝翔 nz\n挖掘机 10000 n\n");
+    WriteFile(dir_ + "/b.utf8", "区块链 nz\n");
+  }
+
+  void TearDown() override {
+    ASSERT_EQ(0, system(("rm -rf " + dir_).c_str()));
+  }
+
+  static void WriteFile(const string& path, const string& content) {
+    ofstream ofs(path.c_str());
+    ofs << content;
+  }
+
+  string dir_;
+};
+
+TEST_F(TenantTest, Cut) {
+  const string text = "蓝翔的挖掘机和区块链";
+  Jieba jieba("../test/testdata/extra_dict/jieba.dict.small.utf8",
+              "../dict/hmm_model.utf8",
+              "");
+  const size_t base_num = jieba.GetDictTrie()->GetElementsNum();
+
+  Jieba::TenantHandle a = jieba.AddTenant(dir_ + "/a.utf8");
+  Jieba::TenantHandle b = jieba.AddTenant(dir_ + "/b.utf8");
+  ASSERT_TRUE(a != nullptr);
+  ASSERT_TRUE(b != nullptr);
+  ASSERT_TRUE(jieba.AddTenant(dir_ + "/missing.utf8") == nullptr);
+  ASSERT_EQ(2u, jieba.GetTenantNum());
+
+  // the base is shared, a tenant adds its own elements only
+  ASSERT_EQ(base_num + 2, a->GetDictTrie()->GetElementsNum());
+  ASSERT_EQ(1u, a->GetDictTrie()->GetUserLayerNum());
+  ASSERT_EQ(0u, jieba.GetDictTrie()->GetUserLayerNum());
+  ASSERT_TRUE(jieba.GetDictTrie()->Find("蓝翔") == nullptr);
+
+  vector<string> words;
+  jieba.Cut(a, text, words);
+  ASSERT_EQ("蓝翔", words[0]);
+  ASSERT_TRUE(std::find(words.begin(), words.end(), "挖掘机") != words.end());
+  ASSERT_TRUE(std::find(words.begin(), words.end(), "区块链") == words.end());
+
+  jieba.Cut(b, text, words);
+  ASSERT_EQ("区块链", words.back());
+
+  jieba.Cut(text, words);
+  ASSERT_NE("区块链", words.back());
+
+  // the same as a Jieba of the user dict of the tenant
+  Jieba own("../test/testdata/extra_dict/jieba.dict.small.utf8",
+            "../dict/hmm_model.utf8",
+            dir_ + "/a.utf8");
+  vector<string> expected;
+  std::ifstream ifs("../test/testdata/weicheng.utf8");
+  string line;
+
+  while (getline(ifs, line)) {
+    own.Cut(line, expected);
+    jieba.Cut(a, line, words);
+    ASSERT_EQ(expected, words);
+    own.CutForSearch(line, expected);
+    jieba.CutForSearch(a, line, words);
+    ASSERT_EQ(expected, words);
+    own.CutAll(line, expected);
+    jieba.CutAll(a, line, words);
+    ASSERT_EQ(expected, words);
+  }
+
+  vector<pair<string, string> > tags;
+  jieba.Tag(a, text, tags);
+  ASSERT_EQ("nz", tags[0].second);
+
+  jieba.RemoveTenant(a);
+  ASSERT_EQ(1u, jieba.GetTenantNum());
+}
+
+TEST_F(TenantTest, Overlay) {
+  DictTrie base("../test/testdata/extra_dict/jieba.dict.small.utf8");
+  DictTrie overlay(base, DictTrie::ShareLayers);
+  ASSERT_EQ(base.GetMd5(), overlay.GetMd5());
+  ASSERT_EQ(base.GetElementsNum(), overlay.GetElementsNum());
+
+  ASSERT_EQ(Error::Ok, overlay.AddUserDicts(dir_ + "/a.utf8"));
+  ASSERT_NE(base.GetMd5(), overlay.GetMd5());
+  ASSERT_EQ(base.GetElementsNum() + 2, overlay.GetElementsNum());
+  ASSERT_NE(Error::Ok, overlay.AddUserDicts(dir_ + "/missing.utf8"));
+  ASSERT_TRUE(base.Find("蓝翔") == nullptr);
+}
+
+TEST_F(TenantTest, Threads) {
+  Jieba jieba("../test/testdata/extra_dict/jieba.dict.small.utf8",
+              "../dict/hmm_model.utf8",
+              "");
+  Jieba::TenantHandle b = jieba.AddTenant(dir_ + "/b.utf8");
+  ASSERT_TRUE(b != nullptr);
+
+  vector<std::thread> threads;
+  vector<int> ok(4, 0);
+
+  for (size_t i = 0; i < ok.size(); i++) {
+    threads.emplace_back([&, i]() {
+      vector<string> words;
+      int n = 0;
+
+      for (int j = 0; j < 200; j++) {
+        jieba.Cut(b, "我在研究区块链", words);
+        n += words.back() == "区块链";
+      }
+
+      ok[i] = n;
+    });
+  }
+
+  // other tenants come and go meanwhile
+  for (int i = 0; i < 5; i++) {
+    jieba.RemoveTenant(jieba.AddTenant(dir_ + "/a.utf8"));
+  }
+
+  for (auto & thread : threads) {
+    thread.join();
+  }
+
+  ASSERT_EQ(vector<int>(4, 200), ok);
+  ASSERT_EQ(1u, jieba.GetTenantNum());
+}
@@ -4,10 +4,9 @@
 using namespace cppjieba;
 
 TEST(TextRankExtractorTest, Test1) {
-  TextRankExtractor Extractor(
-    "../test/testdata/extra_dict/jieba.dict.small.utf8",
-    "../dict/hmm_model.utf8", 
-    "../dict/stop_words.utf8");
+  DictTrie trie("../test/testdata/extra_dict/jieba.dict.small.utf8");
+  HMMModel model("../dict/hmm_model.utf8");
+  TextRankExtractor Extractor(&trie, &model, "../dict/stop_words.utf8");
   {
     string s("你好世界世界而且而且");
     string res;
@@ -58,11 +57,9 @@ TEST(TextRankExtractorTest, Test1) {
 }
 
 TEST(TextRankExtractorTest, Test2) {
-  TextRankExtractor Extractor(
-    "../test/testdata/extra_dict/jieba.dict.small.utf8",
-    "../dict/hmm_model.utf8",
-    "../dict/stop_words.utf8",
-    "../test/testdata/userdict.utf8");
+  DictTrie trie("../test/testdata/extra_dict/jieba.dict.small.utf8", "../test/testdata/userdict.utf8");
+  HMMModel model("../dict/hmm_model.utf8");
+  TextRankExtractor Extractor(&trie, &model, "../dict/stop_words.utf8");
 
   {
     string s("\xe8\x93\x9d\xe7\xbf\x94\xe4\xbc\x98\xe7\xa7\x80\xe6\xaf\x95\xe4\xb8\x9a\xe7\x94\x9f");
@@ -84,3 +81,62 @@ TEST(TextRankExtractorTest, Test2) {
     ASSERT_EQ(res, "[{\"word\": \"一部\", \"offset\": [0], \"weight\": 1}, {\"word\": \"iPhone6\", \"offset\": [6], \"weight\": 0.996126}]");
   }
 }
+
+TEST(TextRankExtractorTest, Convergence) {
+  DictTrie trie("../test/testdata/extra_dict/jieba.dict.small.utf8");
+  HMMModel model("../dict/hmm_model.utf8");
+  TextRankExtractor extractor(&trie, &model, "../dict/stop_words.utf8");
+  string s;
+  ifstream ifs("../test/testdata/weicheng.utf8");
+  s << ifs;
+  s.resize(s.find('\n', 20000));
+
+  vector<TextRankExtractor::Word> fixed, converged;
+  extractor.Extract(s, fixed, 10, 5, 1000);
+  extractor.Extract(s, converged, 10, 5, 1000, 1e-12);
+  ASSERT_EQ(fixed.size(), 10u);
+  ASSERT_EQ(converged.size(), 10u);
+  for (size_t i = 0; i < fixed.size(); i++) {
+    ASSERT_EQ(fixed[i].word, converged[i].word);
+    ASSERT_EQ(fixed[i].offsets, converged[i].offsets);
+    ASSERT_NEAR(fixed[i].weight, converged[i].weight, 1e-9);
+  }
+
+  // a word without any neighbor
+  vector<TextRankExtractor::Word> words;
+  extractor.Extract("霸占", words, 5);
+  string res;
+  res << words;
+  ASSERT_EQ(res, "[{\"word\": \"霸占\", \"offset\": [0], \"weight\": 0}]");
+}
+
+TEST(TextRankExtractorTest, SharedSegment) {
+  DictTrie trie("../test/testdata/extra_dict/jieba.dict.small.utf8");
+  HMMModel model("../dict/hmm_model.utf8");
+  MixSegment segment(&trie, &model);
+  StopWords stopWords;
+  ASSERT_EQ(stopWords.Create("../dict/stop_words.utf8", &trie), Error::Ok);
+  TextRankExtractor shared(&segment, &stopWords);
+  TextRankExtractor own(&trie, &model, "../dict/stop_words.utf8");
+
+  const string s("蓝翔优秀毕业生一部iPhone6，蓝翔毕业生");
+  vector<TextRankExtractor::Word> expected, keywords;
+  own.Extract(s, expected, 5);
+  ASSERT_FALSE(expected.empty());
+  shared.Extract(s, keywords, 5);
+  ASSERT_EQ(keywords.size(), expected.size());
+
+  vector<Word> words;
+  segment.CutToWord(s, words);
+  vector<TextRankExtractor::Word> fromWords;
+  shared.Extract(s, words, fromWords, 5);
+  string res1, res2, res3;
+  res1 << expected;
+  res2 << keywords;
+  res3 << fromWords;
+  ASSERT_EQ(res2, res1);
+  ASSERT_EQ(res3, res1);
+
+  // no abort on a missing stop word file
+  ASSERT_EQ(shared.Create(&segment, "not_exist.utf8"), Error::OpenFileFailed);
+}
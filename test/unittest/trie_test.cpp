@@ -6,18 +6,21 @@ using namespace cppjieba;
 
 static const char* const DICT_FILE = "../test/testdata/extra_dict/jieba.dict.small.utf8";
 
-TEST(TrieTest, Empty) {
-  vector<Unicode> keys;
-  vector<const DictUnit*> values;
-  Trie trie(keys, values);
-}
-
-TEST(TrieTest, Construct) {
-  vector<Unicode> keys;
-  vector<const DictUnit*> values;
-  keys.push_back(DecodeRunesInString("你"));
-  values.push_back((const DictUnit*)(NULL));
-  Trie trie(keys, values);
+TEST(DatTrieTest, Construct) {
+  const string cache = "/tmp/trie_test.dat_cache";
+  vector<DatElement> elements(1);
+  elements[0].word = "你";
+  elements[0].tag = "r";
+  elements[0].weight = -1.0;
+  DatTrie trie;
+  ASSERT_EQ(Error::Ok, trie.InitBuildDat(elements, cache, string(32, '0')));
+  ASSERT_EQ(0, unlink(cache.c_str()));
+
+  ASSERT_EQ(1u, trie.GetElementsNum());
+  const DatMemElem* elem = trie.Find("你");
+  ASSERT_TRUE(elem != NULL);
+  ASSERT_EQ("r", elem->GetTag());
+  ASSERT_TRUE(trie.Find("你好") == NULL);
 }
 
 TEST(DictTrieTest, NewAndDelete) {
@@ -30,74 +33,49 @@ TEST(DictTrieTest, Test1) {
   string s1, s2;
   DictTrie trie(DICT_FILE);
   ASSERT_LT(trie.GetMinWeight() + 15.6479, 0.001);
-  string word("来到");
+  const DatMemElem* elem = trie.Find("来到");
+  ASSERT_TRUE(elem != NULL);
+  ASSERT_EQ("v", elem->GetTag());
+  ASSERT_NEAR(-8.870, elem->weight, 0.001);
+
+  string word = "清华大学";
   cppjieba::RuneStrArray uni;
-  ASSERT_TRUE(DecodeRunesInString(word, uni));
-  //DictUnit nodeInfo;
-  //nodeInfo.word = uni;
-  //nodeInfo.tag = "v";
-  //nodeInfo.weight = -8.87033;
-  //s1 << nodeInfo;
-  //s2 << (*trie.Find(uni.begin(), uni.end()));
-  const DictUnit* du = trie.Find(uni.begin(), uni.end());
-  ASSERT_TRUE(du != NULL);
-  ASSERT_EQ(2u, du->word.size());
-  ASSERT_EQ(26469u, du->word[0]);
-  ASSERT_EQ(21040u, du->word[1]);
-  ASSERT_EQ("v", du->tag);
-  ASSERT_NEAR(-8.870, du->weight, 0.001);
-
-  //EXPECT_EQ("[\"26469\", \"21040\"] v -8.870", s2);
-  word = "清华大学";
-  LocalVector<pair<size_t, const DictUnit*> > res;
+  LocalVector<pair<size_t, const DatMemElem*> > res;
   const char * words[] = {"清", "清华", "清华大学"};
   for (size_t i = 0; i < sizeof(words)/sizeof(words[0]); i++) {
-    ASSERT_TRUE(DecodeRunesInString(words[i], uni));
-    res.push_back(make_pair(uni.size() - 1, trie.Find(uni.begin(), uni.end())));
-    //resMap[uni.size() - 1] = trie.Find(uni.begin(), uni.end());
+    res.push_back(make_pair(Utf8CharNum(words[i]), trie.Find(words[i])));
   }
-  vector<pair<size_t, const DictUnit*> > vec;
-  vector<struct Dag> dags;
+  vector<struct DatDag> dags;
   ASSERT_TRUE(DecodeRunesInString(word, uni));
   trie.Find(uni.begin(), uni.end(), dags);
   ASSERT_EQ(dags.size(), uni.size());
   ASSERT_NE(dags.size(), 0u);
-  s1 << res;
-  s2 << dags[0].nexts;
-  ASSERT_EQ(s1, s2);
-  
+  ASSERT_EQ(res.size(), dags[0].nexts.size());
+  for (size_t i = 0; i < res.size(); i++) {
+    ASSERT_EQ(res[i], dags[0].nexts[i]);
+  }
 }
 
 TEST(DictTrieTest, UserDict) {
   DictTrie trie(DICT_FILE, "../test/testdata/userdict.utf8");
-  string word = "云计算";
-  cppjieba::RuneStrArray unicode;
-  ASSERT_TRUE(DecodeRunesInString(word, unicode));
-  const DictUnit * unit = trie.Find(unicode.begin(), unicode.end());
+  const DatMemElem * unit = trie.Find("云计算");
   ASSERT_TRUE(unit != NULL);
   ASSERT_NEAR(unit->weight, -14.100, 0.001);
 
-  word = "蓝翔";
-  ASSERT_TRUE(DecodeRunesInString(word, unicode));
-  unit = trie.Find(unicode.begin(), unicode.end());
+  unit = trie.Find("蓝翔");
   ASSERT_TRUE(unit != NULL);
-  ASSERT_EQ(unit->tag, "nz");
+  ASSERT_EQ(unit->GetTag(), "nz");
   ASSERT_NEAR(unit->weight, -14.100, 0.001);
 
-  word = "区块链";
-  ASSERT_TRUE(DecodeRunesInString(word, unicode));
-  unit = trie.Find(unicode.begin(), unicode.end());
+  unit = trie.Find("区块链");
   ASSERT_TRUE(unit != NULL);
-  ASSERT_EQ(unit->tag, "nz");
+  ASSERT_EQ(unit->GetTag(), "nz");
   ASSERT_NEAR(unit->weight, -15.6478, 0.001);
 }
 
 TEST(DictTrieTest, UserDictWithMaxWeight) {
-  DictTrie trie(DICT_FILE, "../test/testdata/userdict.utf8", DictTrie::WordWeightMax);
-  string word = "云计算";
-  cppjieba::RuneStrArray unicode;
-  ASSERT_TRUE(DecodeRunesInString(word, unicode));
-  const DictUnit * unit = trie.Find(unicode.begin(), unicode.end());
+  DictTrie trie(DICT_FILE, "../test/testdata/userdict.utf8", "", DictTrie::WordWeightMax);
+  const DatMemElem * unit = trie.Find("云计算");
   ASSERT_TRUE(unit);
   ASSERT_NEAR(unit->weight, -2.975, 0.001);
 }
@@ -109,7 +87,7 @@ TEST(DictTrieTest, Dag) {
     string word = "清华大学";
     cppjieba::RuneStrArray unicode;
     ASSERT_TRUE(DecodeRunesInString(word, unicode));
-    vector<struct Dag> res;
+    vector<struct DatDag> res;
     trie.Find(unicode.begin(), unicode.end(), res);
 
     size_t nexts_sizes[] = {3, 2, 2, 1};
@@ -123,7 +101,7 @@ TEST(DictTrieTest, Dag) {
     string word = "北京邮电大学";
     cppjieba::RuneStrArray unicode;
     ASSERT_TRUE(DecodeRunesInString(word, unicode));
-    vector<struct Dag> res;
+    vector<struct DatDag> res;
     trie.Find(unicode.begin(), unicode.end(), res);
 
     size_t nexts_sizes[] = {3, 1, 2, 2, 2, 1};
@@ -137,7 +115,7 @@ TEST(DictTrieTest, Dag) {
     string word = "长江大桥";
     cppjieba::RuneStrArray unicode;
     ASSERT_TRUE(DecodeRunesInString(word, unicode));
-    vector<struct Dag> res;
+    vector<struct DatDag> res;
     trie.Find(unicode.begin(), unicode.end(), res);
 
     size_t nexts_sizes[] = {3, 1, 2, 1};
@@ -151,7 +129,7 @@ TEST(DictTrieTest, Dag) {
     string word = "长江大桥";
     cppjieba::RuneStrArray unicode;
     ASSERT_TRUE(DecodeRunesInString(word, unicode));
-    vector<struct Dag> res;
+    vector<struct DatDag> res;
     trie.Find(unicode.begin(), unicode.end(), res, 3);
 
     size_t nexts_sizes[] = {2, 1, 2, 1};
@@ -165,7 +143,7 @@ TEST(DictTrieTest, Dag) {
     string word = "长江大桥";
     cppjieba::RuneStrArray unicode;
     ASSERT_TRUE(DecodeRunesInString(word, unicode));
-    vector<struct Dag> res;
+    vector<struct DatDag> res;
     trie.Find(unicode.begin(), unicode.end(), res, 4);
 
     size_t nexts_sizes[] = {3, 1, 2, 1};
@@ -41,3 +41,19 @@ TEST(UnicodeTest, Rand) {
     DecodeRunesInString(s, runes);
   }
 }
+
+TEST(UnicodeTest, RuneBitmap) {
+  RuneBitmap bitmap;
+  ASSERT_FALSE(bitmap.Contains(0));
+  ASSERT_FALSE(bitmap.Contains(0x4E2D));
+
+  bitmap.Insert(0x4E2D);
+  bitmap.Insert(0x1F64B);
+  ASSERT_TRUE(bitmap.Contains(0x4E2D));
+  ASSERT_TRUE(bitmap.Contains(0x1F64B));
+  ASSERT_FALSE(bitmap.Contains(0x4E2C));
+  ASSERT_FALSE(bitmap.Contains(0x10FFFF));
+
+  bitmap.Clear();
+  ASSERT_FALSE(bitmap.Contains(0x4E2D));
+}
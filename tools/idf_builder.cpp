@@ -0,0 +1,67 @@
+#include <cstdlib>
+#include <iostream>
+#include <fstream>
+#include "cppjieba/IdfBuilder.hpp"
+#include "limonp/ArgvContext.hpp"
+
+using namespace cppjieba;
+
+static void Usage(const char* name) {
+    cerr << "usage: " << name << " --dict <jieba.dict.utf8> --hmm <hmm_model.utf8> [--user <user.dict.utf8>]\n"
+         << "       [--threads N] [--top-k N] [--sketch-width N] [--sketch-depth N] [--min-df N] [--no-hmm]\n"
+         << "       --output <idf.utf8> [corpus files, one document per line, stdin if none]" << endl;
+}
+
+static size_t GetSize(const ArgvContext& args, const string& key, size_t value) {
+    return args.HasKey(key) ? strtoull(args[key].c_str(), nullptr, 10) : value;
+}
+
+int main(int argc, char** argv) {
+    ArgvContext args(argc, argv);
+
+    if (args["--dict"].empty() || args["--hmm"].empty() || args["--output"].empty()) {
+        Usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    DictTrie dictTrie(args["--dict"], args["--user"]);
+    if (dictTrie.GetElementsNum() == 0) {
+        XLOG(ERROR) << "failed to load " << args["--dict"];
+        return EXIT_FAILURE;
+    }
+
+    HMMModel model(args["--hmm"]);
+
+    IdfBuilderOptions options;
+    options.thread_num = GetSize(args, "--threads", options.thread_num);
+    options.top_k = GetSize(args, "--top-k", options.top_k);
+    options.sketch_width = GetSize(args, "--sketch-width", options.sketch_width);
+    options.sketch_depth = GetSize(args, "--sketch-depth", options.sketch_depth);
+    options.min_df = GetSize(args, "--min-df", options.min_df);
+    options.hmm = !args.HasKey("--no-hmm");
+
+    IdfBuilder builder(&dictTrie, &model, options);
+
+    if (args[1].empty()) {
+        builder.Process(cin);
+    }
+
+    for (size_t i = 1; !args[i].empty(); i++) {
+        ifstream ifs(args[i].c_str());
+
+        if (!ifs.is_open()) {
+            XLOG(ERROR) << "open " << args[i] << " failed";
+            return EXIT_FAILURE;
+        }
+
+        builder.Process(ifs);
+        XLOG(INFO) << args[i] << " done, " << builder.GetDocumentsNum() << " documents so far";
+    }
+
+    if (Error::Ok != builder.Write(args["--output"])) {
+        return EXIT_FAILURE;
+    }
+
+    XLOG(INFO) << builder.GetDocumentsNum() << " documents, idf written to " << args["--output"];
+    return EXIT_SUCCESS;
+}
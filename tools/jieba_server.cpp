@@ -0,0 +1,59 @@
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include "cppjieba/HttpServer.hpp"
+#include "limonp/Config.hpp"
+
+using namespace cppjieba;
+
+// config format of test/testdata/server.conf
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        cerr << "usage: " << argv[0] << " <server.conf>" << endl;
+        return EXIT_FAILURE;
+    }
+
+    ifstream ifs(argv[1]);
+    if (!ifs.is_open()) {
+        XLOG(ERROR) << "open " << argv[1] << " failed";
+        return EXIT_FAILURE;
+    }
+    ifs.close();
+
+    Config conf(argv[1]);
+    Jieba jieba(conf.Get("dict_path", ""),
+                conf.Get("model_path", ""),
+                conf.Get("user_dict_path", ""),
+                conf.Get("idf_path", ""),
+                conf.Get("stop_words_path", ""));
+    if (jieba.GetDictTrie()->GetElementsNum() == 0) {
+        XLOG(ERROR) << "failed to load " << conf.Get("dict_path", "");
+        return EXIT_FAILURE;
+    }
+
+    HttpServerOptions options;
+    options.host = conf.Get("host", options.host);
+    options.port = conf.Get("port", options.port);
+    options.thread_num = conf.Get("thread_number", 0);
+    options.backlog = conf.Get("queue_max_size", options.backlog);
+
+    // the reactors inherit the mask, the signals are taken by sigwait below
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    HttpServer server(&jieba, options);
+    if (Error::Ok != server.Start()) {
+        return EXIT_FAILURE;
+    }
+
+    XLOG(INFO) << "listening on " << options.host << ":" << server.GetPort();
+
+    int signal = 0;
+    sigwait(&signals, &signal);
+    XLOG(INFO) << "got signal " << signal << ", stopping";
+    server.Stop();
+    return EXIT_SUCCESS;
+}
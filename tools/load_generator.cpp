@@ -0,0 +1,474 @@
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "cppjieba/Jieba.hpp"
+#include "cppjieba/LatencyHistogram.hpp"
+#include "cppjieba/PageFaults.hpp"
+#include "limonp/ArgvContext.hpp"
+
+using namespace cppjieba;
+
+typedef std::chrono::steady_clock Clock;
+
+static void Usage(const char* name) {
+    cerr << "usage: " << name << " [--rates 1000,2000,...] [--duration seconds] [--connections N] [--threads N]\n"
+         << "       [--server host:port]\n"
+         << "       [--inprocess --dict <jieba.dict.utf8> --hmm <hmm_model.utf8> [--user <user.dict.utf8>]\n"
+         << "        [--populate] [--huge-pages thp|explicit] [--mlock] [--warmup <sentence file>]]\n"
+         << "       <url or query files, one per line, e.g. test/testdata/load_test.urls>\n"
+         << "Requests are sent at the given rates whatever the latencies (open loop), each latency is measured from the\n"
+         << "time its request was scheduled. Without --inprocess, the queries which are no URLs go to --server\n"
+         << "(127.0.0.1:11200 by default) as /?key=<query>. The page faults of the process are reported for the\n"
+         << "loading, the mapping options, the warm-up and each rate." << endl;
+}
+
+static size_t GetSize(const ArgvContext& args, const string& key, size_t value) {
+    return args.HasKey(key) ? strtoull(args[key].c_str(), nullptr, 10) : value;
+}
+
+static string UrlEncode(const string& s) {
+    static const char HEX[] = "0123456789ABCDEF";
+    string res;
+
+    for (unsigned char c : s) {
+        if (isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+            res += c;
+        } else {
+            res += '%';
+            res += HEX[c >> 4];
+            res += HEX[c & 15];
+        }
+    }
+
+    return res;
+}
+
+static string UrlDecode(const string& s) {
+    string res;
+
+    for (size_t i = 0; i < s.size(); i++) {
+        if (s[i] == '%' && i + 2 < s.size() && isxdigit((unsigned char)s[i + 1]) && isxdigit((unsigned char)s[i + 2])) {
+            res += (char)strtol(s.substr(i + 1, 2).c_str(), nullptr, 16);
+            i += 2;
+        } else {
+            res += s[i] == '+' ? ' ' : s[i];
+        }
+    }
+
+    return res;
+}
+
+struct Query {
+    string host;    // of the URL, the server otherwise
+    int port = 0;
+    string request; // HTTP request
+    string text;    // for --inprocess
+};
+
+static bool LoadQueries(const ArgvContext& args, vector<Query>& queries) {
+    string server = args.HasKey("--server") ? args["--server"] : "127.0.0.1:11200";
+    const size_t colon = server.rfind(':');
+    const string defaultHost = server.substr(0, colon);
+    const int defaultPort = colon == string::npos ? 80 : atoi(server.c_str() + colon + 1);
+
+    for (size_t i = 1; !args[i].empty(); i++) {
+        ifstream ifs(args[i].c_str());
+
+        if (!ifs.is_open()) {
+            XLOG(ERROR) << "open " << args[i] << " failed";
+            return false;
+        }
+
+        string line;
+
+        while (getline(ifs, line)) {
+            Trim(line);
+
+            if (line.empty()) {
+                continue;
+            }
+
+            Query query;
+            string target;
+
+            if (StartsWith(line, "http://")) {
+                const size_t slash = line.find('/', 7);
+                const string authority = line.substr(7, slash == string::npos ? string::npos : slash - 7);
+                const size_t portPos = authority.rfind(':');
+                query.host = authority.substr(0, portPos);
+                query.port = portPos == string::npos ? 80 : atoi(authority.c_str() + portPos + 1);
+                target = slash == string::npos ? "/" : line.substr(slash);
+                const size_t key = target.find("key=");
+                query.text = key == string::npos ? "" : UrlDecode(target.substr(key + 4, target.find('&', key) - key - 4));
+            } else {
+                query.host = defaultHost;
+                query.port = defaultPort;
+                target = "/?key=" + UrlEncode(line);
+                query.text = line;
+            }
+
+            query.request = "GET " + target + " HTTP/1.1\r\nHost: " + query.host + "\r\n\r\n";
+            queries.push_back(query);
+        }
+    }
+
+    return !queries.empty();
+}
+
+// the share of a thread, running `connections` connections at `rate` requests per second in total
+struct Load {
+    double rate = 0;
+    size_t connections = 0;
+    Clock::time_point begin;
+    Clock::time_point end;
+    LatencyHistogram histogram;
+    size_t errors = 0;
+};
+
+// one outstanding request per connection, the next one is due at `due` even if the previous one is late
+class Connection {
+public:
+    ~Connection() {
+        Close();
+    }
+
+    bool Open(const Query& query, int epollFd) {
+        Close();
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(query.port);
+
+        if (inet_pton(AF_INET, query.host.c_str(), &addr.sin_addr) != 1) {
+            XLOG_RATE(ERROR, 1) << "bad host " << query.host << ", only IPv4 addresses are supported";
+            return false;
+        }
+
+        fd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        const int on = 1;
+
+        if (fd_ < 0 || connect(fd_, (const sockaddr*)&addr, sizeof(addr)) != 0) {
+            XLOG_RATE(ERROR, 1) << "connect to " << query.host << ":" << query.port << " failed: " << strerror(errno);
+            Close();
+            return false;
+        }
+
+        setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = this;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd_, &event);
+        host_ = query.host;
+        port_ = query.port;
+        return true;
+    }
+
+    void Close() {
+        if (fd_ >= 0) {
+            close(fd_);
+            fd_ = -1;
+        }
+
+        busy_ = false;
+        in_.clear();
+    }
+
+    bool Send(const Query& query, int epollFd) {
+        if ((fd_ < 0 || host_ != query.host || port_ != query.port) && !Open(query, epollFd)) {
+            return false;
+        }
+
+        if (send(fd_, query.request.data(), query.request.size(), MSG_NOSIGNAL) != (ssize_t)query.request.size()) {
+            Close();
+            return false;
+        }
+
+        busy_ = true;
+        return true;
+    }
+
+    // reads what came, true once the response is complete (or lost), `ok` telling whether it is a 200
+    bool Receive(bool& ok) {
+        char buf[1 << 16];
+        bool closed = false;
+
+        for (;;) {
+            const ssize_t n = recv(fd_, buf, sizeof(buf), MSG_DONTWAIT);
+
+            if (n > 0) {
+                in_.append(buf, n);
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            } else {
+                closed = n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+                break;
+            }
+        }
+
+        const size_t headerEnd = in_.find("\r\n\r\n");
+        size_t length = 0;
+
+        if (headerEnd != string::npos) {
+            const size_t pos = Lower(in_.substr(0, headerEnd)).find("content-length:");
+            length = pos == string::npos ? 0 : strtoull(in_.c_str() + pos + 15, nullptr, 10);
+        }
+
+        if (headerEnd == string::npos || in_.size() < headerEnd + 4 + length) {
+            if (closed) {
+                ok = false;
+                Close();
+            }
+
+            return closed;
+        }
+
+        ok = in_.compare(0, 12, "HTTP/1.1 200") == 0;
+        in_.erase(0, headerEnd + 4 + length);
+        busy_ = false;
+
+        if (closed) {
+            Close();
+        }
+
+        return true;
+    }
+
+    bool Busy() const {
+        return busy_;
+    }
+
+    Clock::time_point due;
+    size_t next = 0; // query index
+
+private:
+    static string Lower(string s) {
+        for (auto & c : s) {
+            c = tolower((unsigned char)c);
+        }
+
+        return s;
+    }
+
+    int fd_ = -1;
+    string host_;
+    int port_ = 0;
+    bool busy_ = false;
+    string in_;
+};
+
+static void RunHttp(const vector<Query>& queries, Load& load) {
+    const int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    vector<Connection> connections(load.connections);
+    const auto interval = std::chrono::duration_cast<Clock::duration>(
+                              std::chrono::duration<double>(load.connections / load.rate));
+
+    // spread the first requests over an interval
+    for (size_t i = 0; i < connections.size(); i++) {
+        connections[i].due = load.begin + interval * i / connections.size();
+        connections[i].next = i;
+    }
+
+    epoll_event events[256];
+
+    for (;;) {
+        Clock::time_point now = Clock::now();
+        Clock::time_point wake = load.end;
+        bool pending = false;
+
+        for (auto & conn : connections) {
+            if (!conn.Busy() && conn.due < load.end && conn.due <= now) {
+                if (!conn.Send(queries[conn.next % queries.size()], epollFd)) {
+                    load.errors++;
+                    conn.due += interval;
+                    conn.next += connections.size();
+                }
+            }
+
+            pending = pending || conn.Busy();
+
+            if (!conn.Busy() && conn.due < load.end) {
+                wake = std::min(wake, conn.due);
+            }
+        }
+
+        if (!pending && now >= load.end) {
+            break;
+        }
+
+        const auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(wake - now).count();
+        const int n = epoll_wait(epollFd, events, 256, now >= load.end ? 1000 : (int)std::max<int64_t>(0, timeout));
+
+        if (n == 0 && now >= load.end) {
+            // the stragglers are counted as errors
+            for (auto & conn : connections) {
+                load.errors += conn.Busy();
+            }
+
+            break;
+        }
+
+        now = Clock::now();
+
+        for (int i = 0; i < n; i++) {
+            Connection& conn = *(Connection*)events[i].data.ptr;
+            bool ok = false;
+
+            if (conn.Busy() && conn.Receive(ok)) {
+                if (ok) {
+                    load.histogram.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(now - conn.due).count());
+                } else {
+                    load.errors++;
+                }
+
+                conn.due += interval;
+                conn.next += connections.size();
+            }
+        }
+    }
+
+    close(epollFd);
+}
+
+// the faults since `since`, which is then reset to now
+static void PrintFaults(const char* phase, PageFaults& since) {
+    const PageFaults now = PageFaults::OfProcess();
+    const PageFaults faults = now - since;
+    printf("%-8s page faults: %llu minor, %llu major\n", phase, (unsigned long long)faults.minor,
+           (unsigned long long)faults.major);
+    since = now;
+}
+
+static void RunInProcess(const Jieba& jieba, const vector<Query>& queries, size_t offset, Load& load) {
+    const auto interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1 / load.rate));
+    vector<Word> words;
+    size_t next = offset;
+
+    for (Clock::time_point due = load.begin; due < load.end; due += interval, next++) {
+        std::this_thread::sleep_until(due);
+        jieba.Cut(queries[next % queries.size()].text, words);
+        load.histogram.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - due).count());
+    }
+}
+
+int main(int argc, char** argv) {
+    ArgvContext args(argc, argv);
+    vector<Query> queries;
+
+    if (args[1].empty() || !LoadQueries(args, queries)) {
+        Usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const bool inprocess = args.HasKey("--inprocess");
+    unique_ptr<Jieba> jieba;
+
+    if (inprocess) {
+        PageFaults faults = PageFaults::OfProcess();
+        jieba.reset(new Jieba(args["--dict"], args["--hmm"], args["--user"]));
+
+        if (jieba->GetDictTrie()->GetElementsNum() == 0) {
+            XLOG(ERROR) << "failed to load " << args["--dict"];
+            return EXIT_FAILURE;
+        }
+
+        PrintFaults("load", faults);
+
+        DatMapOptions options;
+        options.populate = args.HasKey("--populate");
+        options.huge_pages = args["--huge-pages"] == "explicit" ? HugePagesExplicit :
+                             args["--huge-pages"] == "thp" ? HugePagesTransparent : HugePagesNone;
+        options.lock = args.HasKey("--mlock");
+
+        if (options.populate || options.huge_pages != HugePagesNone || options.lock) {
+            if (Error::Ok != jieba->SetDictMapOptions(options)) {
+                return EXIT_FAILURE;
+            }
+
+            PrintFaults("mapping", faults);
+        }
+
+        if (args.HasKey("--warmup")) {
+            vector<string> sentences;
+            ifstream ifs(args["--warmup"].c_str());
+            string line;
+
+            while (getline(ifs, line)) {
+                sentences.push_back(line);
+            }
+
+            jieba->WarmUp(sentences);
+            PrintFaults("warm-up", faults);
+        }
+    }
+
+    vector<string> rates;
+    Split(args.HasKey("--rates") ? args["--rates"] : "1000,2000,4000,8000,16000", rates, ",");
+    const double duration = args.HasKey("--duration") ? atof(args["--duration"].c_str()) : 10;
+    const size_t threadNum = std::max<size_t>(1, GetSize(args, "--threads", std::max(1u, std::thread::hardware_concurrency())));
+    const size_t connectionNum = std::max(threadNum, GetSize(args, "--connections", 64));
+
+    printf("%10s %12s %10s %10s %10s %10s %10s %8s %10s\n", "rate", "throughput", "mean(ms)", "p50(ms)", "p99(ms)",
+           "p999(ms)", "max(ms)", "errors", "faults");
+
+    for (const auto & r : rates) {
+        const double rate = atof(r.c_str());
+
+        if (rate <= 0) {
+            continue;
+        }
+
+        vector<Load> loads(threadNum);
+        vector<std::thread> threads;
+        const PageFaults faults = PageFaults::OfProcess();
+        const Clock::time_point begin = Clock::now() + std::chrono::milliseconds(100);
+        const Clock::time_point end = begin + std::chrono::duration_cast<Clock::duration>(
+                                          std::chrono::duration<double>(duration));
+
+        for (size_t t = 0; t < threadNum; t++) {
+            Load& load = loads[t];
+            load.connections = connectionNum / threadNum + (t < connectionNum % threadNum);
+            load.rate = rate * load.connections / connectionNum;
+            load.begin = begin;
+            load.end = end;
+
+            if (inprocess) {
+                threads.emplace_back(RunInProcess, std::cref(*jieba), std::cref(queries), t, std::ref(load));
+            } else {
+                threads.emplace_back(RunHttp, std::cref(queries), std::ref(load));
+            }
+        }
+
+        for (auto & thread : threads) {
+            thread.join();
+        }
+
+        const double elapsed = std::chrono::duration<double>(Clock::now() - begin).count();
+        LatencyHistogram histogram;
+        size_t errors = 0;
+
+        for (const auto & load : loads) {
+            histogram.Merge(load.histogram);
+            errors += load.errors;
+        }
+
+        const PageFaults stepFaults = PageFaults::OfProcess() - faults;
+        printf("%10.0f %12.1f %10.3f %10.3f %10.3f %10.3f %10.3f %8zu %10llu\n", rate, histogram.GetCount() / elapsed,
+               histogram.GetMean() / 1e6, histogram.GetValueAtPercentile(50) / 1e6,
+               histogram.GetValueAtPercentile(99) / 1e6, histogram.GetValueAtPercentile(99.9) / 1e6,
+               histogram.GetMax() / 1e6, errors, (unsigned long long)(stepFaults.minor + stepFaults.major));
+        fflush(stdout);
+    }
+
+    return EXIT_SUCCESS;
+}